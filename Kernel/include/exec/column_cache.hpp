@@ -0,0 +1,43 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include "exec/coop_scan.hpp"
+#include "exec/predicate_index.hpp"
+
+extern "C" {
+#include "postgres.h"
+#include "access/xlogdefs.h"
+#include "executor/tuptable.h"
+#include "utils/rel.h"
+#include "utils/snapshot.h"
+}
+
+// [Columnar] Shared-memory mirror of chosen heap columns (lumos.column_cache_columns), one compressed
+// record per (column, heap block): frame-of-reference bit-packed integers/dates/timestamps, raw floats.
+// Only all-visible blocks of WAL-logged relations are mirrored, tagged with the LSN of their visibility
+// map page: a change to the block clears its bit and setting it again moves that LSN, so a record is
+// checked without reading the heap page, and blocks whose records rule out every tuple are skipped.
+// The index is partitioned by block under COLUMN_CACHE_PARTITIONS LWLocks; records are written into a
+// ring arena claimed by an atomic head, the oldest overwritten when it wraps.
+class ColumnCache {
+public:
+    // Defines lumos.column_cache_*; reserves shmem under shared_preload_libraries.
+    static void Init();
+
+    // Heap page-at-a-time scan of rel (only the given ranges when not NULL) that tests the envelopes
+    // on mirrored columns before touching tuples and visits the tuples that may match. False, without
+    // scanning, when the cache is off or no bounded envelope is on a mirrored column.
+    static bool Scan(Relation rel,
+                     Snapshot snapshot,
+                     const std::vector<PredicateIndex::Envelope>& envelopes,
+                     const std::vector<BlockRange>* ranges,
+                     const std::function<void(TupleTableSlot*)>& visit);
+
+private:
+    static bool Mirrored(Relation rel, AttrNumber att);
+
+    static int size_mb_;
+    static char* columns_;
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+
+extern "C" {
+#include "postgres.h"
+#include "access/tableam.h"
+#include "utils/rel.h"
+#include "utils/snapshot.h"
+}
+
+// [IO Optimization] Cooperative Scan Node: a sequential heap scan that joins the scans already
+// running on the relation in any backend. It starts at the block position published in the
+// synchronized-scan registry (shared memory, keyed by relation), runs to the end, wraps around to
+// the blocks it missed and publishes its own position as it goes, so concurrent batches on one
+// table read each page about once. PostgreSQL only does this for tables over NBuffers/4;
+// this scan always does while synchronize_seqscans is on. Other table AMs get a plain scan.
+// Given block ranges (heap only) it reads just those, in order, and stays out of the registry.
+struct BlockRange {
+    BlockNumber start;
+    BlockNumber nblocks;
+};
+
+class CooperativeScan {
+public:
+    CooperativeScan(Relation rel, Snapshot snapshot, const std::vector<BlockRange>* ranges = NULL);
+    ~CooperativeScan();
+
+    bool Next(TupleTableSlot* slot);
+    void End(); // Before the relation is closed; the destructor ends a scan left open
+
+private:
+    bool NextRange();
+
+    Relation rel_;
+    TableScanDesc scan_;
+    bool reporting_;
+    BlockNumber last_block_;
+    std::vector<BlockRange> ranges_;
+    size_t next_range_;
+};
@@ -1,12 +1,16 @@
 #pragma once
 
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "planner.hpp"
 #include "runtime.hpp"
 
 namespace mqo {
 class BatchPayload;
+class BatchChunk;
+class BatchResult;
 }
 
 class Executor {
@@ -14,12 +18,53 @@ public:
     Executor();
     ~Executor();
 
-    int Execute(const mqo::BatchPayload& payload);
+    // Defines the lumos.parallel_* and lumos.enable_* GUCs (_PG_init).
+    static void Init();
+
+    // result (optional) collects per-request rows from operators that produce them (shared aggregation).
+    int Execute(const mqo::BatchPayload& payload, mqo::BatchResult* result = NULL);
+
+    // Multi-template payload: aggregate-only batches share scans per relation, the rest run one by one.
+    void ExecuteMulti(const std::vector<const mqo::BatchPayload*>& batches, std::vector<mqo::BatchResult*>& results);
+
+    // Window payload: batches in order, one sub-transaction and snapshot. Returns whether it committed.
+    bool ExecuteWindow(const std::vector<const mqo::BatchPayload*>& batches, std::vector<mqo::BatchResult*>& results);
+
+    // Streaming ingestion: each chunk runs through Execute as a batch with the stream header, all of
+    // them under one sub-transaction and snapshot (Runtime::BeginStream). FinishStream returns false
+    // when a request failed.
+    void BeginStream();
+    int ExecuteChunk(const mqo::BatchPayload& stream, const mqo::BatchChunk& chunk);
+    bool FinishStream();
+
+    // Debug report lines: whether the batch takes a shared scan and, when it does, whether every request
+    // gets the rows it gets when run alone. Nothing is run for writing templates.
+    std::string CheckSharedScan(const mqo::BatchPayload& payload);
+
+    // Parallel worker side of Runtime::ExecuteBatchParallel and the parallel shared scan.
+    void ParallelWorkerMain(shm_toc* toc);
+
+    Planner& GetPlanner();
+    Runtime& GetRuntime();
 
 private:
     int DispatchStandard(const mqo::BatchPayload& payload);
-    int DispatchMQO(const mqo::BatchPayload& payload);
-    int DispatchSharedScan(const mqo::BatchPayload& payload);
+    int DispatchMQO(const mqo::BatchPayload& payload, mqo::BatchResult* result);
+    // Single-table SELECT batch through Runtime::ExecuteSharedScan, false when it declines.
+    bool DispatchSharedScan(SPIPlanPtr plan, const mqo::BatchPayload& payload, mqo::BatchResult* result, int& res);
+    // Row-at-a-time strategies for a prepared MQO plan: parallel workers, ReScan or the SPI loop.
+    // Only the SPI loop fills result, it is the one taken when result is not NULL.
+    int DispatchPerRow(SPIPlanPtr plan, const mqo::BatchPayload& payload, mqo::BatchResult* result);
+
+    int ParallelWorkersFor(SPIPlanPtr plan, const mqo::BatchPayload& payload);
+
+    static int parallel_batch_workers_;
+    static int parallel_batch_min_rows_;
+    static int parallel_scan_workers_;
+    static bool enable_rescan_;
+    static bool enable_set_rewrite_;
+    static bool enable_shared_agg_;
+    static bool enable_shared_scan_;
 
     std::unique_ptr<Planner> planner_;
     std::unique_ptr<Runtime> runtime_;
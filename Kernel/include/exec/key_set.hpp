@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+
+extern "C" {
+#include "postgres.h"
+#include "fmgr.h"
+}
+
+// Open-addressing set of column keys for shared scans, hashed and compared with the
+// type's own support functions from the typcache.
+// Types without hash support degrade to a linear list (typbyval/datumIsEqual).
+class DatumKeySet {
+public:
+    DatumKeySet(Oid type_id, Oid collation, size_t expected_keys);
+    ~DatumKeySet();
+
+    int Insert(Datum key); // Position of the key in Keys(), duplicates are dropped
+    bool Contains(Datum value) const;
+    int Find(Datum value) const; // Position in Keys(), -1 when absent
+
+    size_t Size() const;
+    const std::vector<Datum>& Keys() const; // Distinct keys in insertion order
+
+private:
+    uint32 Hash(Datum value) const;
+    bool Equal(Datum a, Datum b) const;
+
+    Oid collation_;
+    int16 typlen_;
+    bool typbyval_;
+    bool hashable_;
+    FmgrInfo hash_finfo_; // Copied, typcache entries can be reset by invalidations
+    FmgrInfo eq_finfo_;
+
+    std::vector<Datum> keys_;
+    std::vector<int32> slots_; // Index into keys_/hashes_, -1 when empty
+    std::vector<uint32> hashes_;
+    uint32 mask_;
+};
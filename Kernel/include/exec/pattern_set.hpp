@@ -0,0 +1,70 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+#include "postgres.h"
+}
+
+// LIKE patterns of a batch compiled into one Aho-Corasick automaton. A pattern is split at `%` into
+// literal segments, anchored at the start/end unless it begins/ends with `%`; one walk over a text
+// reports every pattern whose segments occur in order (leftmost-ending placement is always optimal).
+// Patterns with `_` or a dangling escape are rejected: the caller evaluates those itself.
+// Matching is on bytes, valid for single-byte encodings and UTF-8 under deterministic collations.
+class PatternSet {
+public:
+    PatternSet();
+
+    // Position of the pattern (default `\` escape), shared by duplicates; -1 when not supported.
+    int Insert(const char* pattern, int len);
+
+    // Failure and output links; call once after the last Insert.
+    void Build();
+
+    // Positions of the patterns text matches, each once.
+    void Match(const char* text, int len, std::vector<int>& out);
+
+    size_t Size() const;
+
+private:
+    struct Occurrence {
+        int pattern;
+        int segment;
+    };
+
+    struct Node {
+        std::vector<std::pair<uint8, int32>> next; // Root uses root_next_ instead
+        int32 fail;
+        int32 output; // Nearest node on the failure chain (itself included) with occurrences, -1 if none
+        int32 depth;
+        std::vector<Occurrence> occurrences; // Segments ending here
+    };
+
+    struct Pattern {
+        int segments;
+        bool anchored_start;
+        bool anchored_end;
+    };
+
+    struct Progress {
+        uint32 generation; // Stale unless equal to generation_
+        int segment; // Next segment to place
+        int pos; // Where it may start at the earliest
+    };
+
+    int32 Child(int32 node, uint8 c) const;
+    int32 AddSegment(const std::string& segment);
+    void Advance(int pattern, int segment, int start, int end, int len, std::vector<int>& out);
+
+    std::vector<Node> nodes_;
+    int32 root_next_[256];
+    std::vector<Pattern> patterns_;
+    std::unordered_map<std::string, int> positions_;
+    std::vector<int> universal_; // Only `%`: every text
+    std::vector<int> empty_; // '': the empty text only
+
+    std::vector<Progress> progress_;
+    uint32 generation_;
+};
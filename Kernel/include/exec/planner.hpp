@@ -3,7 +3,7 @@
 #include <string>
 #include <vector>
 #include <memory>
-#include <map>
+#include <unordered_map>
 
 extern "C" {
 #include "postgres.h"
@@ -22,6 +22,34 @@ public:
     SPIPlanPtr PrepareSPI(const mqo::BatchPayload& payload); // Basic SPI func for batch SQL exec.
     SPIPlanPtr PrepareMQO(const mqo::BatchPayload& payload); // MQO Cache mode.
 
+    // [Set-Oriented] `col = $1` templates as one unnest($1) WITH ORDINALITY join, NULL if the template doesn't qualify.
+    SPIPlanPtr PrepareSetOriented(const mqo::BatchPayload& payload);
+    static bool RewriteSetOriented(const std::string& sql, std::string& out);
+
+    // Template Registration: template_id -> SQL text, kept for the backend lifetime.
+    void RegisterTemplate(uint64_t template_id, const std::string& sql);
+    bool HasTemplate(uint64_t template_id) const;
+
+    // template_sql, or the registered text when the payload only carries template_id.
+    const std::string& ResolveSQL(const mqo::BatchPayload& payload) const;
+
+    // Plain SELECTs only (no row locks, INTO or data-modifying CTE).
+    static bool IsReadOnly(SPIPlanPtr plan);
+    // Read-only, free of parallel-unsafe/restricted functions and of temporary tables: can run inside
+    // parallel workers.
+    static bool IsParallelSafe(SPIPlanPtr plan);
+
+    // Type name -> Oid, invalidated by the pg_type syscache callback.
+    Oid ResolveType(const std::string& type_name);
+    void InvalidateTypes();
+
 private:
-    static std::map<std::string, SPIPlanPtr> plan_cache_;
-};
\ No newline at end of file
+    static uint64_t PlanKey(const mqo::BatchPayload& payload);
+    std::vector<Oid> ResolveArgTypes(const mqo::BatchPayload& payload);
+    void FlushPlanCache(std::unordered_map<uint64_t, SPIPlanPtr>& cache);
+
+    std::unordered_map<uint64_t, std::string> template_registry_;
+    std::unordered_map<uint64_t, SPIPlanPtr> plan_cache_;
+    std::unordered_map<uint64_t, SPIPlanPtr> set_plan_cache_; // NULL entries: template rejected by the rewrite
+    std::unordered_map<std::string, Oid> type_cache_;
+};
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "exec/key_set.hpp"
+#include "exec/pattern_set.hpp"
+
+extern "C" {
+#include "postgres.h"
+#include "fmgr.h"
+#include "executor/tuptable.h"
+#include "nodes/execnodes.h"
+#include "nodes/params.h"
+#include "nodes/primnodes.h"
+}
+
+// Routes a tuple to the requests of one template whose indexable conjuncts it satisfies, without
+// testing every request. Indexable: top-level `col op <operand>` with op any member of the btree opfamily
+// of the column type's default opclass (cross-type ones such as int4 = int8 included), `col = ANY(...)`,
+// `col IN (...)` and `text_col LIKE <operand>`. An operand reads params but no column (`$1`, `$1::date`);
+// it is evaluated and converted to the column type once per request. A column under an implicit cast
+// (`float8(numeric_col) = $1`) is indexed in the cast type, the cast evaluated once per tuple.
+// Per column: a hash map key -> requests for equality, an interval tree over each request's merged
+// bounds for ranges, an Aho-Corasick automaton over the LIKE patterns. Columns are intersected through a request bitset; other conjuncts are left to
+// the caller's qual.
+class PredicateIndex {
+public:
+    // Loosest bounds of one indexed column over every request (equality: smallest and largest key).
+    // A value outside them matches no request; empty when no request can match at all.
+    struct Envelope {
+        AttrNumber att;
+        Oid type_id;
+        Oid collation;
+        bool has_lo;
+        Datum lo;
+        bool has_hi;
+        Datum hi;
+        bool empty;
+    };
+
+    PredicateIndex();
+
+    // False when quals has no indexable conjunct. requests[r] NULL (malformed row) never matches.
+    bool Build(Expr* quals, const std::vector<ParamListInfo>& requests);
+
+    // Requests (ascending) whose indexed conjuncts all hold for the tuple.
+    void Match(TupleTableSlot* slot, std::vector<int>& out);
+
+    // Every top-level conjunct is indexed: matches are exact, the qual need not be rechecked.
+    bool Complete() const;
+
+    // Hashed equality keys of att (in its opclass type), NULL when att has no such column under this
+    // collation. Cast columns have none: their keys are not values of the column.
+    const DatumKeySet* EqualityKeys(AttrNumber att, Oid collation) const;
+
+    // Uncast columns with EqualityKeys.
+    void EqualityColumns(std::vector<AttrNumber>& out) const;
+
+    // Uncast columns only.
+    void Envelopes(std::vector<Envelope>& out);
+
+private:
+    struct Conjunct {
+        AttrNumber att;
+        Oid type_id;    // Column side operator input type (the opclass type, e.g. text for varchar)
+        Oid param_type; // Operand side input type, converted to type_id per request
+        int16 typlen;   // Of type_id
+        bool typbyval;
+        Oid collation;
+        Oid cast_fn; // Implicit cast over the column, InvalidOid if none
+        Oid cast_collation;
+        int strategy; // BTLessStrategyNumber.. as `col op value`
+        std::vector<Expr*> operands; // IN lists carry several
+        std::vector<ExprState*> operand_states; // NULL for a bare $n, read straight from the request
+        bool array_operand; // = ANY(operands[0]): an array
+        bool like; // LIKE operand, strategy unused
+    };
+
+    // Operand value in the column type. Cross-type values the column type cannot hold exactly lie BELOW
+    // or ABOVE every column value, or BETWEEN two (value is then the largest column value below it).
+    enum Fit { FIT_EXACT, FIT_BELOW, FIT_ABOVE, FIT_BETWEEN };
+    struct Operand {
+        Datum value;
+        Fit fit;
+    };
+
+    struct Interval {
+        int request;
+        bool has_lo;
+        bool lo_inc;
+        bool has_hi;
+        bool hi_inc;
+        Datum lo;
+        Datum hi;
+    };
+
+    struct IndexedColumn {
+        AttrNumber att;
+        Oid type_id;
+        Oid collation;
+        Oid cast_fn; // Applied to the column value before any lookup, InvalidOid if none
+        Oid cast_collation;
+        FmgrInfo cast;
+        FmgrInfo cmp; // btree support 1 of the column type
+        std::unique_ptr<DatumKeySet> keys; // Hashed equality
+        std::vector<std::vector<int>> key_requests; // Keys() position -> requests
+        std::vector<Interval> intervals; // Ranges and unhashable equality, sorted by lower bound
+        std::vector<int> max_hi; // Implicit tree node (mid) -> interval with the largest upper bound below it
+        std::unique_ptr<PatternSet> patterns; // LIKE
+        std::vector<std::vector<int>> pattern_requests; // PatternSet position -> requests
+        std::vector<int> unindexed_requests; // Patterns PatternSet rejects: always candidates
+    };
+
+    static bool ParseConjunct(Node* clause, Conjunct& out);
+    static Fit ToColumnType(Datum value, Oid from, Oid to, Datum& out);
+    bool OperandValues(const Conjunct& conj, ParamListInfo params, std::vector<Operand>& out);
+    void AddOperand(const Conjunct& conj, Datum value, std::vector<Operand>& out);
+    void AddEquality(IndexedColumn& col, const Conjunct& conj, const std::vector<ParamListInfo>& requests);
+    bool AddPatterns(IndexedColumn& col, const Conjunct& conj, const std::vector<ParamListInfo>& requests);
+    void AddRanges(IndexedColumn& col,
+                   const std::vector<const Conjunct*>& conjs,
+                   const std::vector<ParamListInfo>& requests);
+    void BuildTree(IndexedColumn& col);
+    int BuildTree(IndexedColumn& col, int lo, int hi);
+    void Stab(IndexedColumn& col, Datum value, int lo, int hi);
+    void Hit(int request);
+    void Widen(IndexedColumn& col, Envelope& env, bool has_lo, Datum lo, bool has_hi, Datum hi);
+
+    int32 Compare(IndexedColumn& col, Datum a, Datum b);
+    bool Contains(IndexedColumn& col, const Interval& iv, Datum value);
+    bool UpperAtLeast(IndexedColumn& col, const Interval& iv, Datum value);
+
+    std::vector<IndexedColumn> columns_; // Equality columns first, the most selective
+    bool complete_;
+    ExprContext* operand_context_; // Operand evaluation, during Build only
+    MemoryContext cast_context_;   // Column casts of the current tuple, NULL when no column is cast
+
+    std::vector<uint64> bits_; // Requests hit by the current column, cleared after each column
+    std::vector<int> hits_;
+    std::vector<int> patterns_; // PatternSet matches of the current value
+};
@@ -1,6 +1,12 @@
 #pragma once
 
+#include <functional>
 #include <vector>
+#include <string>
+#include <unordered_map>
+
+#include "exec/coop_scan.hpp"
+#include "exec/predicate_index.hpp"
 
 extern "C" {
 #include "postgres.h"
@@ -14,12 +20,34 @@ extern "C" {
 #include "utils/snapmgr.h"
 #include "utils/lsyscache.h"
 #include "utils/rel.h"
+#include "storage/shm_toc.h"
 }
 
 namespace mqo {
 class BatchPayload;
+class BatchResult;
+class ParamRow;
+}
+
+namespace google {
+namespace protobuf {
+template <typename T>
+class RepeatedPtrField;
+}
 }
 
+class SharedScan;
+
+// Resolved shared-scan column, cached per "table.col".
+struct ScanTarget {
+    Oid table_oid;
+    AttrNumber att_num;
+    Oid type_id;
+    Oid collation;
+    int16 typlen;
+    bool typbyval;
+};
+
 class Runtime {
 public:
     Runtime();
@@ -29,11 +57,116 @@ public:
     int ExecuteSPILoop(SPIPlanPtr plan, const mqo::BatchPayload& payload);
 
     // [MQO Core] Context Reuse + Snapshot Reuse + Dry-Run Support
-    int ExecuteBatchMQO(SPIPlanPtr plan, const mqo::BatchPayload& payload);
+    // result (may be NULL) gets one row per request: its first result row, empty when it returned none.
+    int ExecuteBatchMQO(SPIPlanPtr plan, const mqo::BatchPayload& payload, mqo::BatchResult* result = NULL);
+    int ExecuteBatchMQO(SPIPlanPtr plan,
+                        const google::protobuf::RepeatedPtrField<mqo::ParamRow>& rows,
+                        bool dry_run,
+                        mqo::BatchResult* result = NULL);
+
+    // [MQO Core] One ExecutorStart per batch, rows swap the ParamListInfo and ExecReScan (read-only plans).
+    // Returns false when the cached plan cannot be rescanned, the caller falls back to ExecuteBatchMQO.
+    bool ExecuteBatchRescan(SPIPlanPtr plan, const mqo::BatchPayload& payload, int& success_count);
+
+    // [Set-Oriented] Whole batch as one array parameter for Planner::PrepareSetOriented plans, in its own
+    // sub-transaction. result (may be NULL) gets each request's first row, mapped back through ord.
+    // False, with nothing left behind, when the join failed: the caller runs the requests one by one.
+    bool ExecuteSetOriented(SPIPlanPtr plan, const mqo::BatchPayload& payload, mqo::BatchResult* result,
+                            int& success_count);
 
-    // [IO Optimization] Shared Scan
-    int ExecuteSharedScan(const mqo::BatchPayload& payload);
+    // [IO Optimization] Shared aggregation: aggregate-only single-table template, one scan for the whole batch.
+    // Returns false when the template does not fit SharedAggregate, result (optional) gets one row per request.
+    bool ExecuteSharedAggregate(SPIPlanPtr plan, const mqo::BatchPayload& payload, mqo::BatchResult* result,
+                                int& success_count);
+    // Cross-template: matching templates are grouped per relation, each group is one scan.
+    // answered[i] is set for batches handled here, NULL plans/results are skipped.
+    void ExecuteSharedAggregates(const std::vector<SPIPlanPtr>& plans,
+                                 const std::vector<const mqo::BatchPayload*>& batches,
+                                 std::vector<mqo::BatchResult*>& results,
+                                 std::vector<bool>& answered);
+
+    // [Parallel] Read-only batch spread over PG parallel workers, the leader participates.
+    int ExecuteBatchParallel(SPIPlanPtr plan, const mqo::BatchPayload& payload, int nworkers);
+    // Claims row chunks from the shared cursor until the batch is drained (leader and workers).
+    int ExecuteParallelPartition(SPIPlanPtr plan, const mqo::BatchPayload& payload, shm_toc* toc);
+    static bool ReadParallelPayload(shm_toc* toc, mqo::BatchPayload& payload);
+
+    // [IO Optimization] Shared Scan: single-table SELECT answered by one scan, each matching tuple
+    // routed to every request it satisfies. Equality keys on an indexed column (the proxy's hinted one
+    // preferred) turn it into one index scan. False (nothing run) when the template does not qualify, its
+    // qual gives the predicate index nothing to narrow, or the sequential scan would cost more than the
+    // requests' own plans (forced: skip that estimate).
+    // nworkers > 0 splits a large heap scan into block ranges over parallel workers (payload must carry
+    // template_sql, workers resolve it themselves).
+    bool ExecuteSharedScan(SPIPlanPtr plan,
+                           const mqo::BatchPayload& payload,
+                           mqo::BatchResult* result,
+                           int& routed,
+                           int nworkers = 0,
+                           bool forced = false);
+    // Debug report: runs the shared scan (cost estimate aside) and each request on its own, one line
+    // comparing their row counts per request (read-only plans only).
+    std::string CheckSharedScan(SPIPlanPtr plan, const mqo::BatchPayload& payload);
+    // Worker side: rebuilds the predicate index from the payload, scans the blocks it claims and
+    // streams its routed rows to the leader.
+    int ExecuteParallelScanPartition(SPIPlanPtr plan, const mqo::BatchPayload& payload, shm_toc* toc);
+    static bool IsParallelScan(shm_toc* toc);
+
+    // Window: batches executed between Begin/End share one sub-transaction and one snapshot.
+    // EndWindow rolls back when commit is false or a batch failed, returns whether it committed.
+    // Each batch runs between BeginWindowBatch/EndWindowBatch, which make earlier batches' writes visible;
+    // an isolated (dry-run) batch gets its own nested sub-transaction, rolled back at its end.
+    void BeginWindow();
+    bool EndWindow(bool commit);
+    void BeginWindowBatch(bool isolated);
+    void EndWindowBatch(bool isolated);
+    bool InWindow() const;
+
+    // Stream: a window held open across the statements of one batch stream, inside the transaction block
+    // the proxy opens for it. Its sub-transaction and snapshot are taken once; each chunk runs between
+    // BeginStreamChunk/EndStreamChunk like a window batch. EndStream releases the sub-transaction and
+    // returns true, or returns false (nothing released) when a request failed: the caller raises the
+    // error that rolls the whole stream back.
+    void BeginStream();
+    void BeginStreamChunk(bool isolated);
+    void EndStreamChunk(bool isolated);
+    bool EndStream();
+
+    // Lifecycle hooks
+    void InvalidateRelation(Oid relid); // InvalidOid drops every entry
+    void ResetSessionContext();
+    void ResetWindow(); // Transaction abort
 
 private:
-    static MemoryContext mqo_session_context_;
+    Snapshot ScanSnapshot(); // Window snapshot, else the transaction snapshot
+    int ExecutePlan(SPIPlanPtr plan, Datum* values, const char* nulls, bool read_only);
+
+    bool LookupScanTarget(const std::string& table_name, const std::string& col_name, ScanTarget& out);
+    Oid FindKeyIndex(Relation rel, const ScanTarget& target);
+    bool FindBlockRanges(Relation rel,
+                         const std::vector<PredicateIndex::Envelope>& envelopes,
+                         Snapshot snapshot,
+                         std::vector<BlockRange>& ranges);
+    int ExecuteSharedScanParallel(SharedScan& shared,
+                                  Relation rel,
+                                  Snapshot snapshot,
+                                  const mqo::BatchPayload& payload,
+                                  mqo::BatchResult* result,
+                                  int nworkers);
+    uint64 ExecuteSharedIndexScan(Relation rel,
+                                  Oid index_oid,
+                                  const std::vector<Datum>& keys,
+                                  Snapshot snapshot,
+                                  const std::function<void(TupleTableSlot*)>& visit);
+    uint64 ExecuteSharedBitmapScan(Relation rel,
+                                   Oid index_oid,
+                                   const std::vector<Datum>& keys,
+                                   Snapshot snapshot,
+                                   const std::function<void(TupleTableSlot*)>& visit);
+
+    MemoryContext mqo_session_context_;
+    Snapshot window_snapshot_;
+    bool window_failed_;
+    ResourceOwner stream_owner_; // Stream sub-transaction's, holds the stream snapshot
+    std::unordered_map<std::string, ScanTarget> scan_targets_;
 };
\ No newline at end of file
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+
+#include "exec/coop_scan.hpp"
+#include "exec/predicate_index.hpp"
+
+extern "C" {
+#include "postgres.h"
+#include "executor/tuptable.h"
+#include "utils/rel.h"
+}
+
+#define SCAN_BATCH_SIZE 256 // About one to two heap pages of narrow rows
+
+// Envelope of one fixed-width ordered column as the filter kernels see it: int2/int4/int8/date/
+// timestamp[tz] widened to int64, float4/float8 to double. Missing bounds become the type's extremes.
+struct ColumnFilter {
+    AttrNumber att;
+    Oid type_id; // Base type of the column
+    bool is_float;
+    int64 lo_int;
+    int64 hi_int;
+    double lo_float;
+    double hi_float;
+};
+
+// False when env is empty, unbounded or on a type the kernels do not handle.
+bool BuildColumnFilter(const PredicateIndex::Envelope& env, ColumnFilter& out);
+int64 FilterValueInt64(Datum value, Oid type_id);
+double FilterValueDouble(Datum value, Oid type_id);
+
+// Clear bit i of bits for each of the n values outside [lo, hi] (AVX2 where the CPU has it).
+void MaskInt64(const int64* values, int n, int64 lo, int64 hi, uint64* bits);
+void MaskDouble(const double* values, int n, double lo, double hi, uint64* bits);
+
+// [Vectorized] Page-batched evaluation: SCAN_BATCH_SIZE tuples of a scan are deformed together,
+// the key/range envelopes of the predicate index are tested over column vectors (AVX2 where the CPU
+// has it) and only the tuples in the resulting match bitmap are routed one by one.
+class ScanBatch {
+public:
+    // Tuples are deformed up to max_attr, the highest column their consumers read.
+    ScanBatch(Relation rel, const std::vector<PredicateIndex::Envelope>& envelopes, AttrNumber max_attr);
+    ~ScanBatch();
+
+    bool Usable() const; // At least one envelope on a vectorizable type
+
+    // Next batch of tuples from scan, deformed up to max_attr. 0 at the end of the scan.
+    int Fill(CooperativeScan& scan);
+
+    // Bit i set when tuple i lies within every envelope (NULLs never do).
+    const uint64* Filter();
+
+    TupleTableSlot* Slot(int i) const;
+
+private:
+    std::vector<ColumnFilter> filters_;
+    std::vector<TupleTableSlot*> slots_;
+    AttrNumber max_attr_;
+    int count_;
+
+    std::vector<int64> ints_;
+    std::vector<double> floats_;
+    uint64 bits_[SCAN_BATCH_SIZE / 64];
+};
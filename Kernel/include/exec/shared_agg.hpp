@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vector>
+
+extern "C" {
+#include "postgres.h"
+#include "executor/spi.h"
+#include "nodes/execnodes.h"
+#include "nodes/parsenodes.h"
+}
+
+namespace mqo {
+class ParamRow;
+class BatchResult;
+}
+
+namespace google {
+namespace protobuf {
+template <typename T>
+class RepeatedPtrField;
+}
+}
+
+// One aggregate of a template, transition state kept per request.
+struct SharedAggDesc {
+    Oid result_type;
+    std::vector<ExprState*> args;
+    bool args_use_params; // Args read $n, evaluated per request instead of once per tuple
+    std::vector<Datum> arg_values;
+    std::vector<bool> arg_nulls;
+
+    FunctionCallInfo trans_fcinfo; // flinfo/fcinfo allocated in the aggregate context, the desc itself is copied
+    FmgrInfo* transfn;
+    FunctionCallInfo final_fcinfo;
+    FmgrInfo* finalfn;
+    bool has_final;
+
+    Oid transtype;
+    int16 translen;
+    bool transbyval;
+    Datum initval;
+    bool initval_null;
+};
+
+// One template of the scan: compiled qual, its aggregates and one ParamListInfo per request.
+struct SharedAggTemplate {
+    ExprState* qual;
+    std::vector<SharedAggDesc> aggs;
+    std::vector<ParamListInfo> requests;
+    std::vector<Datum> trans_values; // [request * aggs.size() + agg]
+    std::vector<bool> trans_nulls;
+};
+
+// [IO Optimization] Shared aggregation: one heap scan answers every request of every added template.
+// Each tuple is tested against each request's qual (same compiled ExprState, params swapped) and
+// feeds that request's accumulators through the aggregate's own transition function.
+class SharedAggregate {
+public:
+    SharedAggregate();
+    ~SharedAggregate();
+
+    // SELECT <plain aggregates> FROM <one table> [WHERE ...], NULL for any other shape.
+    static Query* MatchQuery(SPIPlanPtr plan);
+
+    // False when an aggregate is unsupported (ordered-set, DISTINCT/FILTER, polymorphic state)
+    // or the template reads a different relation than the ones already added.
+    bool AddTemplate(Query* query, SPIPlanPtr plan, const google::protobuf::RepeatedPtrField<mqo::ParamRow>& rows);
+
+    // Scans the relation once under snapshot, returns the number of tuples read.
+    uint64 Scan(Snapshot snapshot);
+
+    // Final values of template tmpl, one result row per request.
+    void Emit(size_t tmpl, mqo::BatchResult* result);
+
+    size_t NumTemplates() const;
+
+private:
+    bool InitAggregate(Aggref* aggref, SharedAggDesc& desc);
+    void EvalArgs(SharedAggDesc& desc);
+    void Advance(SharedAggDesc& desc, SharedAggTemplate& tmpl, size_t state);
+
+    Oid relid_;
+    MemoryContext agg_context_;    // Transition states, params, compiled expressions
+    ExprContext* agg_econtext_;    // Only its per-tuple memory is used: the AggCheckCallContext context
+    ExprContext* tuple_econtext_;  // Qual/arg evaluation, reset per tuple
+    AggState* agg_state_;          // fcinfo->context so transition functions see an aggregate call
+    std::vector<SharedAggTemplate> templates_;
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "exec/predicate_index.hpp"
+
+extern "C" {
+#include "postgres.h"
+#include "executor/spi.h"
+#include "nodes/execnodes.h"
+#include "nodes/parsenodes.h"
+#include "utils/sortsupport.h"
+}
+
+namespace mqo {
+class ParamRow;
+class BatchResult;
+}
+
+namespace google {
+namespace protobuf {
+template <typename T>
+class RepeatedPtrField;
+}
+}
+
+// [IO Optimization] Shared scan: one pass over the relation answers every request of a single-table
+// SELECT. The predicate index picks the candidate requests of each tuple, their WHERE is checked with
+// the same compiled qual (params swapped) and the target list is projected once per request it satisfies.
+// Ranking templates (ORDER BY <param-free keys> LIMIT $n) keep, per group of requests with equal filter
+// params, a bounded heap of the best max(LIMIT) rows; Finish() slices each request's LIMIT from it.
+class SharedScan {
+public:
+    SharedScan();
+    ~SharedScan();
+
+    // SELECT <exprs> FROM <one table> [WHERE ...] [ORDER BY ... LIMIT ...] without aggregates, NULL otherwise.
+    // ORDER BY keys that read params differ per request and are left to the row loop. Joins are not
+    // shared: ranking templates over several relations run per request.
+    static Query* MatchQuery(SPIPlanPtr plan);
+
+    // False when the table needs a permission check the scan would bypass.
+    bool Init(Query* query, SPIPlanPtr plan, const google::protobuf::RepeatedPtrField<mqo::ParamRow>& rows);
+
+    // Keys of a `att = $n` / `att IN (...)` conjunct: only tuples with one of them can match.
+    const DatumKeySet* EqualityKeys(AttrNumber att, Oid collation) const;
+    void EqualityColumns(std::vector<AttrNumber>& out) const;
+
+    // The predicate index narrows each tuple to its candidate requests, or there is no qual to test.
+    // Otherwise every tuple runs every request's qual, which the per-request plans never lose to.
+    bool Indexed() const;
+
+    // Page-batched scans keep several tuples of one scan alive at once, which is only safe when the
+    // template reads user columns (deformed up front), not system columns off the heap tuple.
+    bool Batchable() const;
+    AttrNumber MaxAttribute() const; // Highest user column the template reads, all of them for a whole-row var
+    void Envelopes(std::vector<PredicateIndex::Envelope>& out);
+
+    // Appends [request index, target list...] to result (may be NULL) for every request the tuple
+    // satisfies, returns the rows routed. Ranking templates only feed their heaps here (0 routed).
+    int Route(TupleTableSlot* slot, mqo::BatchResult* result);
+
+    // Ranking templates: appends each request's rows in ORDER BY order once the scan is over, returns
+    // the rows routed. 0 for the others.
+    int Finish(mqo::BatchResult* result);
+
+    // Per-tuple rows only; the heaps of a ranking template are not split across workers.
+    bool Parallelizable() const;
+
+    Oid RelationId() const;
+
+private:
+    Oid relid_;
+    MemoryContext scan_context_;   // Params, compiled expressions, key set
+    ExprContext* econtext_;        // Qual/target evaluation, reset per tuple
+    ExprState* qual_;
+    std::vector<ExprState*> targets_;
+    std::vector<Oid> target_types_;
+    std::vector<ParamListInfo> requests_; // NULL for malformed rows
+    bool system_attrs_;
+    AttrNumber max_attr_;
+    bool has_qual_;
+
+    std::unique_ptr<PredicateIndex> index_; // NULL when the qual has no indexable conjunct
+    std::vector<int> candidates_;
+
+    struct RankedRow {
+        Datum* keys; // Sort key values, copied into scan_context_
+        bool* nulls;
+        mqo::ParamRow* row; // Target list
+    };
+
+    bool BuildGroups(Query* query);
+    void Rank(int group);
+    int Compare(const RankedRow& a, const RankedRow& b);
+    void Release(RankedRow& row);
+
+    bool ranked_;
+    std::vector<ExprState*> sort_keys_;
+    std::vector<SortSupportData> sort_support_;
+    std::vector<int16> sort_typlen_;
+    std::vector<bool> sort_byval_;
+    RankedRow current_; // Sort keys of the current tuple, per-tuple memory
+
+    std::vector<int> group_of_;                    // Request -> group of equal filter params, -1 if malformed
+    std::vector<int64> limits_;                    // Request -> LIMIT
+    std::vector<int64> group_limits_;              // max(LIMIT) of the group
+    std::vector<std::vector<RankedRow>> groups_;   // Max-heaps on the ORDER BY, worst row on top
+    std::vector<uint64> group_seen_;               // Tuple serial the group's qual last ran for
+    uint64 tuple_serial_;
+};
@@ -27,6 +27,9 @@ class TypeMapper {
 public:
     static PgParam ToPgParam(const mqo::Value &val, Oid target_type);
 
+    // Datum -> Value: integers/floats/bools native, everything else through the type's output function.
+    static void FromDatum(Datum value, bool isnull, Oid type_oid, mqo::Value *out);
+
     static Oid DeduceTypeOid(const mqo::Value &val);
 
     static Oid ResolveTypeOid(const std::string &type_name);
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+
+#include "ipc/shm_ring_layout.hpp"
+
+// Shared-memory transport: a named POSIX segment of payload slots that a co-located
+// proxy maps directly. Created by the postmaster, inherited by every backend.
+class ShmRing {
+public:
+    // Defines the lumos.shm_* GUCs and creates the segment under shared_preload_libraries.
+    static void Init();
+
+    // NULL when the transport is disabled or slot_id is out of range.
+    static MqoSlotHeader* Slot(int slot_id);
+    static size_t SlotCapacity();
+
+private:
+    static bool Create();
+
+    static MqoRingHeader* ring_;
+    static int num_slots_;
+    static int slot_size_kb_;
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+
+extern "C" {
+#include "postgres.h"
+#include "storage/dsm.h"
+}
+
+class LumosKernel;
+
+// Background-worker executor pool: lumos.worker_pool_size static bgworkers pull job
+// descriptors (DSM handles) from a shared queue, run the payload carried by the job's
+// request shm_mq with their own Executor and answer on the reply shm_mq. Jobs run with the
+// submitting role's privileges and only in the database the workers are connected to.
+class WorkerPool {
+public:
+    // Defines the lumos.worker_* GUCs; reserves shmem and registers the workers under shared_preload_libraries.
+    static void Init();
+
+    // Backend side: queue a serialized BatchPayload, returns a ticket for Wait().
+    static int Submit(const char* data, size_t len);
+    // Blocks until the job behind ticket replies, returns its mqo_dispatch status.
+    static int Wait(int ticket);
+
+    // Worker side, entered through lumos_worker_main().
+    static void WorkerMain(int worker_id, LumosKernel& kernel);
+
+    // Path of this shared library, for bgworker / parallel worker entry points.
+    static const char* LibraryPath();
+
+private:
+    static void RunJob(dsm_handle handle, LumosKernel& kernel);
+
+    static int pool_size_;
+    static char* worker_database_;
+};
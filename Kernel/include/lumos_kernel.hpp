@@ -10,15 +10,61 @@ extern "C" {
 #include "utils/elog.h"
 }
 
+// mqo_dispatch return codes, mirrored by the proxy.
+constexpr int MQO_STATUS_ERROR = 0;
+constexpr int MQO_STATUS_OK = 1;
+constexpr int MQO_STATUS_TEMPLATE_MISS = -1; // template_id unknown to this backend, resend template_sql
+
+namespace mqo {
+class BatchPayload;
+class BatchResult;
+}
+
+// One instance per backend, created in _PG_init. Owns every cache (plans, templates,
+// type and relation metadata); the lifecycle hooks below are driven by PG callbacks.
 class LumosKernel {
 public:
     LumosKernel();
     ~LumosKernel();
 
-    void Dispatch(const char* data, size_t len);
+    int Dispatch(const char* data, size_t len, mqo::BatchResult* result = NULL);
+
+    // Dispatch and serialize the per-request BatchResult into out (status OK only).
+    int DispatchResult(const char* data, size_t len, std::string& out);
+
+    // MultiPayload -> serialized MultiResult, template misses are reported per batch.
+    void DispatchMulti(const char* data, size_t len, std::string& out);
+
+    // WindowPayload -> serialized MultiResult, all batches in one sub-transaction.
+    void DispatchWindow(const char* data, size_t len, std::string& out);
+
+    // Shared-memory transport: execute the payload in ring slot_id in place, token must match the slot's.
+    int DispatchSlot(int slot_id, uint64 token);
 
     std::string DebugAnalyze(const char* data, size_t len);
 
+    // Streaming ingestion: header payload (no rows), row chunks executed on arrival under one
+    // sub-transaction and snapshot, then finish. Must run inside a transaction block; a failed
+    // request makes finish raise an error, rolling every chunk back.
+    int BeginStream(const char* data, size_t len);
+    int AppendStream(const char* data, size_t len);
+    int FinishStream();
+
+    // Parallel worker entry for read-only batches split by the leader.
+    void ParallelWorkerMain(shm_toc* toc);
+
+    // Lifecycle hooks
+    void OnAbort();                     // Transaction abort: drop the open stream and scratch memory
+    void InvalidateRelation(Oid relid); // Relcache invalidation
+    void InvalidateTypes();             // pg_type syscache invalidation
+
 private:
+    bool ResolveTemplate(const mqo::BatchPayload& payload);
+
     std::unique_ptr<Executor> executor_;
+
+    // Batch opened by mqo_batch_begin
+    std::unique_ptr<mqo::BatchPayload> stream_header_;
+    int stream_status_;
+    int stream_executed_;
 };
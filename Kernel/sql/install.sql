@@ -8,7 +8,17 @@
 \endif
 
 DROP FUNCTION IF EXISTS mqo_dispatch(bytea);
+DROP FUNCTION IF EXISTS mqo_dispatch_result(bytea);
+DROP FUNCTION IF EXISTS mqo_dispatch_multi(bytea);
+DROP FUNCTION IF EXISTS mqo_dispatch_window(bytea);
 DROP FUNCTION IF EXISTS mqo_debug(bytea);
+DROP FUNCTION IF EXISTS mqo_dispatch_slot(integer);
+DROP FUNCTION IF EXISTS mqo_dispatch_slot(integer, bigint);
+DROP FUNCTION IF EXISTS mqo_batch_begin(bytea);
+DROP FUNCTION IF EXISTS mqo_batch_append(bytea);
+DROP FUNCTION IF EXISTS mqo_batch_execute();
+DROP FUNCTION IF EXISTS mqo_submit(bytea);
+DROP FUNCTION IF EXISTS mqo_wait(integer);
 
 
 CREATE FUNCTION mqo_dispatch(bytea)
@@ -16,9 +26,75 @@ RETURNS integer
 AS :'libpath', 'mqo_dispatch'
 LANGUAGE C STRICT;
 
+-- Like mqo_dispatch, returns a serialized BatchResult (NULL on template miss). use_mqo batches get one row
+-- per request: its aggregate values or first result row, empty when it returned none. Shared scans
+-- (scan_table set) return one row per matching (request, tuple) instead, see mqo.proto.
+-- Non-MQO batches (use_mqo false) return an empty BatchResult.
+CREATE FUNCTION mqo_dispatch_result(bytea)
+RETURNS bytea
+AS :'libpath', 'mqo_dispatch_result'
+LANGUAGE C STRICT;
+
+-- MultiPayload in, serialized MultiResult out (per-batch status and results)
+CREATE FUNCTION mqo_dispatch_multi(bytea)
+RETURNS bytea
+AS :'libpath', 'mqo_dispatch_multi'
+LANGUAGE C STRICT;
+
+-- WindowPayload in, serialized MultiResult out: one round trip, sub-transaction and snapshot per window
+CREATE FUNCTION mqo_dispatch_window(bytea)
+RETURNS bytea
+AS :'libpath', 'mqo_dispatch_window'
+LANGUAGE C STRICT;
+
 CREATE FUNCTION mqo_debug(bytea)
 RETURNS text
 AS :'libpath', 'mqo_debug'
 LANGUAGE C STRICT;
 
+-- Shared-memory transport, needs shared_preload_libraries and lumos.shm_ring_slots > 0.
+-- (slot, token): the token is the secret the proxy wrote into the slot. Only lumos_proxy members may call it.
+DO $$
+BEGIN
+    IF NOT EXISTS (SELECT FROM pg_roles WHERE rolname = 'lumos_proxy') THEN
+        CREATE ROLE lumos_proxy NOLOGIN;
+    END IF;
+END
+$$;
+
+CREATE FUNCTION mqo_dispatch_slot(integer, bigint)
+RETURNS integer
+AS :'libpath', 'mqo_dispatch_slot'
+LANGUAGE C STRICT;
+REVOKE ALL ON FUNCTION mqo_dispatch_slot(integer, bigint) FROM PUBLIC;
+GRANT EXECUTE ON FUNCTION mqo_dispatch_slot(integer, bigint) TO lumos_proxy;
+
+-- Streaming ingestion: begin(header) -> append(chunk)* -> execute(), rows run as chunks arrive
+CREATE FUNCTION mqo_batch_begin(bytea)
+RETURNS integer
+AS :'libpath', 'mqo_batch_begin'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION mqo_batch_append(bytea)
+RETURNS integer
+AS :'libpath', 'mqo_batch_append'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION mqo_batch_execute()
+RETURNS integer
+AS :'libpath', 'mqo_batch_execute'
+LANGUAGE C;
+
+-- Worker pool: submit returns a ticket, wait returns the batch status.
+-- Needs shared_preload_libraries and lumos.worker_pool_size > 0
+CREATE FUNCTION mqo_submit(bytea)
+RETURNS integer
+AS :'libpath', 'mqo_submit'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION mqo_wait(integer)
+RETURNS integer
+AS :'libpath', 'mqo_wait'
+LANGUAGE C STRICT;
+
 \echo 'LumosKernel installation attempt finished.'
@@ -1,5 +1,15 @@
 DROP FUNCTION IF EXISTS mqo_dispatch(bytea);
+DROP FUNCTION IF EXISTS mqo_dispatch_result(bytea);
+DROP FUNCTION IF EXISTS mqo_dispatch_multi(bytea);
+DROP FUNCTION IF EXISTS mqo_dispatch_window(bytea);
 DROP FUNCTION IF EXISTS mqo_debug(bytea);
+DROP FUNCTION IF EXISTS mqo_dispatch_slot(integer);
+DROP FUNCTION IF EXISTS mqo_dispatch_slot(integer, bigint);
+DROP FUNCTION IF EXISTS mqo_batch_begin(bytea);
+DROP FUNCTION IF EXISTS mqo_batch_append(bytea);
+DROP FUNCTION IF EXISTS mqo_batch_execute();
+DROP FUNCTION IF EXISTS mqo_submit(bytea);
+DROP FUNCTION IF EXISTS mqo_wait(integer);
 
 DO $$
 BEGIN
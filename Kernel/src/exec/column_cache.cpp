@@ -0,0 +1,553 @@
+#include "exec/column_cache.hpp"
+#include "exec/scan_batch.hpp"
+
+extern "C" {
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/visibilitymap.h"
+#include "access/xlog.h"
+#include "common/hashfn.h"
+#include "executor/executor.h"
+#include "miscadmin.h"
+#include "port/atomics.h"
+#include "storage/bufmgr.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/predicate.h"
+#include "storage/shmem.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/lsyscache.h"
+#include "utils/varlena.h"
+}
+
+#include <cstring>
+#include <string>
+
+#define COLUMN_CACHE_TRANCHE "lumos column cache"
+#define COLUMN_CACHE_AVG_RECORD 256 // Bytes per record assumed when sizing the index
+#define COLUMN_CACHE_WORDS ((MaxHeapTuplesPerPage + 63) / 64)
+#define COLUMN_CACHE_PARTITIONS 16 // Index lock partitions, a power of two
+
+#if PG_VERSION_NUM >= 160000
+#define RelationFileNumber(rel) ((rel)->rd_locator.relNumber)
+#else
+#define RelationFileNumber(rel) ((rel)->rd_node.relNode)
+#endif
+
+struct ColumnBlockKey {
+    Oid dbid;
+    Oid relid;
+    Oid relfilenode; // A rewrite (TRUNCATE, CLUSTER, VACUUM FULL) starts over
+    int32 att; // Not AttrNumber: the key is hashed as bytes and must have no padding
+    BlockNumber block;
+};
+
+struct ColumnBlockEntry {
+    ColumnBlockKey key;
+    XLogRecPtr lsn; // LSN of the visibility map page when the record was taken
+    uint64 pos; // Absolute arena position, overwritten once head passes pos + arena_size
+    uint32 len;
+};
+
+struct ColumnCacheShared {
+    LWLockPadded* locks; // COLUMN_CACHE_PARTITIONS, by block hash
+    pg_atomic_uint64 head; // Absolute write position of the ring, advanced by reservation
+    Size arena_size;
+    char arena[FLEXIBLE_ARRAY_MEMBER];
+};
+
+// Record layout: header, present bitmap over the page's line pointers (normal and not NULL),
+// then the present values, `bits` each above `base` (raw doubles for floats).
+struct ColumnRecordHeader {
+    uint16 nitems;
+    uint8 is_float;
+    uint8 bits;
+    int64 base;
+};
+
+int ColumnCache::size_mb_ = 0;
+char* ColumnCache::columns_ = NULL;
+
+static ColumnCacheShared* cache = NULL;
+static HTAB* cache_index = NULL;
+static Size cache_arena_size = 0; // lumos.column_cache_size as seen by the postmaster hooks
+
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static long CacheMaxEntries() {
+    return Max(static_cast<long>(cache_arena_size / COLUMN_CACHE_AVG_RECORD), 1024L);
+}
+
+static Size CacheShmemSize() {
+    return add_size(add_size(offsetof(ColumnCacheShared, arena), cache_arena_size),
+                    hash_estimate_size(CacheMaxEntries(), sizeof(ColumnBlockEntry)));
+}
+
+static void RequestCacheShmem() {
+    RequestAddinShmemSpace(CacheShmemSize());
+    RequestNamedLWLockTranche(COLUMN_CACHE_TRANCHE, COLUMN_CACHE_PARTITIONS);
+}
+
+#if PG_VERSION_NUM >= 150000
+static void lumos_cache_shmem_request(void) {
+    if (prev_shmem_request_hook) prev_shmem_request_hook();
+    RequestCacheShmem();
+}
+#endif
+
+// All columns of one block hash alike: one partition lock covers a block's records.
+static uint32 BlockKeyHash(const void* key, Size keysize) {
+    ColumnBlockKey block = *static_cast<const ColumnBlockKey*>(key);
+    block.att = 0;
+    return DatumGetUInt32(hash_any(reinterpret_cast<const unsigned char*>(&block), sizeof(block)));
+}
+
+static void lumos_cache_shmem_startup(void) {
+    if (prev_shmem_startup_hook) prev_shmem_startup_hook();
+
+    bool found;
+    LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+    cache = static_cast<ColumnCacheShared*>(
+        ShmemInitStruct("lumos column cache", offsetof(ColumnCacheShared, arena) + cache_arena_size, &found));
+    if (!found) {
+        cache->locks = GetNamedLWLockTranche(COLUMN_CACHE_TRANCHE);
+        pg_atomic_init_u64(&cache->head, 0);
+        cache->arena_size = cache_arena_size;
+    }
+
+    HASHCTL info;
+    memset(&info, 0, sizeof(info));
+    info.keysize = sizeof(ColumnBlockKey);
+    info.entrysize = sizeof(ColumnBlockEntry);
+    info.hash = BlockKeyHash;
+    info.num_partitions = COLUMN_CACHE_PARTITIONS;
+    cache_index = ShmemInitHash("lumos column cache index", CacheMaxEntries(), CacheMaxEntries(), &info,
+                                HASH_ELEM | HASH_FUNCTION | HASH_PARTITION | HASH_FIXED_SIZE);
+    LWLockRelease(AddinShmemInitLock);
+}
+
+void ColumnCache::Init() {
+    DefineCustomIntVariable("lumos.column_cache_size",
+                            "Shared memory for the columnar mirror of lumos.column_cache_columns (0 disables).",
+                            NULL,
+                            &size_mb_,
+                            0,
+                            0,
+                            MAX_KILOBYTES / 1024,
+                            PGC_POSTMASTER,
+                            GUC_UNIT_MB,
+                            NULL,
+                            NULL,
+                            NULL);
+    DefineCustomStringVariable("lumos.column_cache_columns",
+                               "Comma-separated [schema.]table.column list mirrored for shared scans.",
+                               NULL,
+                               &columns_,
+                               "",
+                               PGC_SUSET,
+                               0,
+                               NULL,
+                               NULL,
+                               NULL);
+
+    if (!process_shared_preload_libraries_in_progress || size_mb_ == 0) return;
+    cache_arena_size = static_cast<Size>(size_mb_) * 1024 * 1024;
+
+#if PG_VERSION_NUM >= 150000
+    prev_shmem_request_hook = shmem_request_hook;
+    shmem_request_hook = lumos_cache_shmem_request;
+#else
+    RequestCacheShmem();
+#endif
+    prev_shmem_startup_hook = shmem_startup_hook;
+    shmem_startup_hook = lumos_cache_shmem_startup;
+}
+
+bool ColumnCache::Mirrored(Relation rel, AttrNumber att) {
+    if (columns_ == NULL || columns_[0] == '\0') return false;
+
+    char* raw = pstrdup(columns_);
+    List* names;
+    bool found = false;
+    if (SplitIdentifierString(raw, ',', &names)) {
+        std::string relname = RelationGetRelationName(rel);
+        char* nspname = get_namespace_name(RelationGetNamespace(rel));
+        std::string qualified = std::string(nspname != NULL ? nspname : "") + "." + relname;
+        const char* attname = NameStr(TupleDescAttr(RelationGetDescr(rel), att - 1)->attname);
+
+        ListCell* lc;
+        foreach (lc, names) {
+            std::string name = static_cast<char*>(lfirst(lc));
+            size_t dot = name.rfind('.');
+            if (dot == std::string::npos || name.compare(dot + 1, std::string::npos, attname) != 0) continue;
+            std::string table = name.substr(0, dot);
+            if (table == relname || table == qualified) {
+                found = true;
+                break;
+            }
+        }
+        list_free(names);
+    }
+    pfree(raw);
+    return found;
+}
+
+static ColumnBlockKey MakeKey(Relation rel, AttrNumber att, BlockNumber block) {
+    ColumnBlockKey key;
+    key.dbid = MyDatabaseId;
+    key.relid = RelationGetRelid(rel);
+    key.relfilenode = RelationFileNumber(rel);
+    key.att = att;
+    key.block = block;
+    return key;
+}
+
+static void SetBit(uint64* bits, int i, bool on) {
+    if (on) {
+        bits[i / 64] |= UINT64CONST(1) << (i % 64);
+    } else {
+        bits[i / 64] &= ~(UINT64CONST(1) << (i % 64));
+    }
+}
+
+static bool TestBit(const uint64* bits, int i) {
+    return (bits[i / 64] >> (i % 64)) & 1;
+}
+
+// Column values of every line pointer of a share-locked page, item i at index i.
+static void ExtractColumn(Relation rel, Page page, int nitems, const ColumnFilter& filter, int64* ints,
+                          double* floats, uint64* present) {
+    TupleDesc tupdesc = RelationGetDescr(rel);
+    memset(present, 0, COLUMN_CACHE_WORDS * sizeof(uint64));
+    for (int i = 0; i < nitems; ++i) {
+        ItemId lp = PageGetItemId(page, i + FirstOffsetNumber);
+        if (!ItemIdIsNormal(lp)) continue;
+        HeapTupleData tuple;
+        tuple.t_data = (HeapTupleHeader)PageGetItem(page, lp);
+        tuple.t_len = ItemIdGetLength(lp);
+        tuple.t_tableOid = RelationGetRelid(rel);
+        bool isnull;
+        Datum value = heap_getattr(&tuple, filter.att, tupdesc, &isnull);
+        if (isnull) continue;
+        SetBit(present, i, true);
+        if (filter.is_float) {
+            floats[i] = FilterValueDouble(value, filter.type_id);
+        } else {
+            ints[i] = FilterValueInt64(value, filter.type_id);
+        }
+    }
+}
+
+static void EncodeRecord(int nitems, const ColumnFilter& filter, const int64* ints, const double* floats,
+                         const uint64* present, std::string& out) {
+    ColumnRecordHeader header = {static_cast<uint16>(nitems), filter.is_float, 64, 0};
+    if (!filter.is_float) {
+        // Frame of reference: values as offsets from the smallest, in just enough bits.
+        bool any = false;
+        int64 lo = 0, hi = 0;
+        for (int i = 0; i < nitems; ++i) {
+            if (!TestBit(present, i)) continue;
+            lo = any ? Min(lo, ints[i]) : ints[i];
+            hi = any ? Max(hi, ints[i]) : ints[i];
+            any = true;
+        }
+        uint64 range = static_cast<uint64>(hi) - static_cast<uint64>(lo);
+        header.base = lo;
+        header.bits = range == 0 ? 0 : 64 - __builtin_clzll(range);
+    }
+
+    std::vector<uint64> words;
+    uint64 bitpos = 0;
+    for (int i = 0; i < nitems; ++i) {
+        if (!TestBit(present, i) || header.bits == 0) continue;
+        uint64 value;
+        if (filter.is_float) {
+            memcpy(&value, &floats[i], sizeof(value));
+        } else {
+            value = static_cast<uint64>(ints[i]) - static_cast<uint64>(header.base);
+        }
+        size_t w = bitpos / 64;
+        int shift = bitpos % 64;
+        if (w + 1 >= words.size()) words.resize(w + 2, 0);
+        words[w] |= value << shift;
+        if (shift != 0 && shift + header.bits > 64) words[w + 1] |= value >> (64 - shift);
+        bitpos += header.bits;
+    }
+    words.resize((bitpos + 63) / 64);
+
+    out.clear();
+    out.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.append(reinterpret_cast<const char*>(present), (nitems + 7) / 8);
+    out.append(reinterpret_cast<const char*>(words.data()), words.size() * sizeof(uint64));
+}
+
+static void DecodeRecord(const char* data, int64* ints, double* floats, uint64* present) {
+    ColumnRecordHeader header;
+    memcpy(&header, data, sizeof(header));
+    int nitems = header.nitems;
+    memset(present, 0, COLUMN_CACHE_WORDS * sizeof(uint64));
+    memcpy(present, data + sizeof(header), (nitems + 7) / 8);
+    const char* packed = data + sizeof(header) + (nitems + 7) / 8;
+
+    uint64 bitpos = 0;
+    uint64 mask = header.bits == 64 ? ~UINT64CONST(0) : (UINT64CONST(1) << header.bits) - 1;
+    for (int i = 0; i < nitems; ++i) {
+        if (!TestBit(present, i)) continue;
+        uint64 value = 0;
+        if (header.bits > 0) {
+            size_t w = bitpos / 64;
+            int shift = bitpos % 64;
+            uint64 word;
+            memcpy(&word, packed + w * sizeof(uint64), sizeof(uint64));
+            value = word >> shift;
+            if (shift != 0 && shift + header.bits > 64) {
+                memcpy(&word, packed + (w + 1) * sizeof(uint64), sizeof(uint64));
+                value |= word << (64 - shift);
+            }
+            value &= mask;
+            bitpos += header.bits;
+        }
+        if (header.is_float) {
+            memcpy(&floats[i], &value, sizeof(double));
+        } else {
+            ints[i] = static_cast<int64>(value + static_cast<uint64>(header.base));
+        }
+    }
+}
+
+static LWLock* PartitionLock(uint32 hashcode) {
+    return &cache->locks[hashcode % COLUMN_CACHE_PARTITIONS].lock;
+}
+
+// Intact until a reservation reaches pos + arena_size.
+static bool RecordLive(uint64 pos, uint64 head) {
+    return head <= pos + cache->arena_size;
+}
+
+// Records of the block's filter columns taken at vm_lsn, copied out under one partition lock.
+// Writers fill the arena without the lock, so a copy counts only if head did not overtake it meanwhile.
+static void LookupRecords(Relation rel, BlockNumber block, const std::vector<ColumnFilter>& filters,
+                          XLogRecPtr vm_lsn, std::vector<std::string>& records) {
+    ColumnBlockKey key = MakeKey(rel, 0, block);
+    uint32 hashcode = get_hash_value(cache_index, &key);
+    LWLock* lock = PartitionLock(hashcode);
+    LWLockAcquire(lock, LW_SHARED);
+    for (size_t f = 0; f < filters.size(); ++f) {
+        records[f].clear();
+        key.att = filters[f].att;
+        ColumnBlockEntry* entry = static_cast<ColumnBlockEntry*>(
+            hash_search_with_hash_value(cache_index, &key, hashcode, HASH_FIND, NULL));
+        if (entry == NULL || entry->lsn != vm_lsn || !RecordLive(entry->pos, pg_atomic_read_u64(&cache->head))) {
+            continue;
+        }
+        records[f].assign(cache->arena + entry->pos % cache->arena_size, entry->len);
+        pg_read_barrier();
+        if (!RecordLive(entry->pos, pg_atomic_read_u64(&cache->head))) records[f].clear();
+    }
+    LWLockRelease(lock);
+}
+
+// Claims len bytes of the ring (never wrapping around the arena end) and copies the record in.
+static uint64 ReserveRecord(const std::string& record) {
+    uint64 head = pg_atomic_read_u64(&cache->head);
+    uint64 pos;
+    do {
+        uint64 offset = head % cache->arena_size;
+        pos = offset + record.size() > cache->arena_size ? head + (cache->arena_size - offset) : head;
+    } while (!pg_atomic_compare_exchange_u64(&cache->head, &head, pos + record.size()));
+    memcpy(cache->arena + pos % cache->arena_size, record.data(), record.size());
+    return pos;
+}
+
+// Drops the entries whose records the ring already overwrote, every partition locked.
+static void SweepIndex() {
+    for (int i = 0; i < COLUMN_CACHE_PARTITIONS; ++i) LWLockAcquire(&cache->locks[i].lock, LW_EXCLUSIVE);
+    uint64 head = pg_atomic_read_u64(&cache->head);
+    HASH_SEQ_STATUS status;
+    hash_seq_init(&status, cache_index);
+    ColumnBlockEntry* stale;
+    while ((stale = static_cast<ColumnBlockEntry*>(hash_seq_search(&status))) != NULL) {
+        if (!RecordLive(stale->pos, head)) hash_search(cache_index, &stale->key, HASH_REMOVE, NULL);
+    }
+    for (int i = COLUMN_CACHE_PARTITIONS - 1; i >= 0; --i) LWLockRelease(&cache->locks[i].lock);
+}
+
+// Publishes the fresh records of one block, taken at vm_lsn.
+static void StoreRecords(const std::vector<std::pair<ColumnBlockKey, std::string>>& fresh, XLogRecPtr vm_lsn) {
+    if (fresh.empty()) return;
+    std::vector<uint64> positions;
+    for (const auto& record : fresh) {
+        positions.push_back(record.second.size() > cache->arena_size ? 0 : ReserveRecord(record.second));
+    }
+
+    uint32 hashcode = get_hash_value(cache_index, &fresh[0].first);
+    LWLock* lock = PartitionLock(hashcode);
+    bool swept = false;
+    LWLockAcquire(lock, LW_EXCLUSIVE);
+    for (size_t r = 0; r < fresh.size(); ++r) {
+        if (fresh[r].second.size() > cache->arena_size) continue;
+        ColumnBlockEntry* entry = static_cast<ColumnBlockEntry*>(
+            hash_search_with_hash_value(cache_index, &fresh[r].first, hashcode, HASH_ENTER_NULL, NULL));
+        if (entry == NULL && !swept) {
+            // Index full: sweep once, then retry.
+            LWLockRelease(lock);
+            SweepIndex();
+            swept = true;
+            LWLockAcquire(lock, LW_EXCLUSIVE);
+            entry = static_cast<ColumnBlockEntry*>(
+                hash_search_with_hash_value(cache_index, &fresh[r].first, hashcode, HASH_ENTER_NULL, NULL));
+        }
+        if (entry == NULL) break;
+        entry->lsn = vm_lsn;
+        entry->pos = positions[r];
+        entry->len = fresh[r].second.size();
+    }
+    LWLockRelease(lock);
+}
+
+// The visibility map page's LSN moves whenever a bit on it is set (and WAL-logged). A heap change clears
+// the block's all-visible bit before anyone sees it, and setting the bit again moves the LSN: the bit
+// still set under an unchanged LSN proves the block is as it was when the record was taken.
+static XLogRecPtr AllVisibleLSN(Relation rel, BlockNumber block, Buffer* vmbuffer) {
+    if (!(visibilitymap_get_status(rel, block, vmbuffer) & VISIBILITYMAP_ALL_VISIBLE)) return InvalidXLogRecPtr;
+    pg_read_barrier();
+    return BufferGetLSNAtomic(*vmbuffer);
+}
+
+static void ApplyFilter(const ColumnFilter& filter, const int64* ints, const double* floats,
+                        const uint64* present, uint64* bits) {
+    for (int w = 0; w < COLUMN_CACHE_WORDS; ++w) bits[w] &= present[w];
+    if (filter.is_float) {
+        MaskDouble(floats, MaxHeapTuplesPerPage, filter.lo_float, filter.hi_float, bits);
+    } else {
+        MaskInt64(ints, MaxHeapTuplesPerPage, filter.lo_int, filter.hi_int, bits);
+    }
+}
+
+bool ColumnCache::Scan(Relation rel,
+                       Snapshot snapshot,
+                       const std::vector<PredicateIndex::Envelope>& envelopes,
+                       const std::vector<BlockRange>* ranges,
+                       const std::function<void(TupleTableSlot*)>& visit) {
+    if (cache == NULL || rel->rd_tableam != GetHeapamTableAmRoutine() || !RelationNeedsWAL(rel)) return false;
+
+    std::vector<ColumnFilter> filters;
+    for (const auto& env : envelopes) {
+        ColumnFilter filter;
+        if (BuildColumnFilter(env, filter) && Mirrored(rel, env.att)) filters.push_back(filter);
+    }
+    if (filters.empty()) return false;
+
+    BlockNumber nblocks = RelationGetNumberOfBlocks(rel);
+    std::vector<BlockRange> whole = {{0, nblocks}};
+    if (ranges == NULL) ranges = &whole;
+
+    BufferAccessStrategy strategy = GetAccessStrategy(BAS_BULKREAD);
+    TupleTableSlot* slot = MakeSingleTupleTableSlot(RelationGetDescr(rel), &TTSOpsBufferHeapTuple);
+    PredicateLockRelation(rel, snapshot);
+
+    // Values indexed by line pointer, unset ones are never tested (present bit clear).
+    int64 ints[MaxHeapTuplesPerPage] = {0};
+    double floats[MaxHeapTuplesPerPage] = {0};
+    uint64 present[COLUMN_CACHE_WORDS];
+    uint64 bits[COLUMN_CACHE_WORDS];
+    HeapTupleData tuples[MaxHeapTuplesPerPage];
+    std::vector<std::string> records(filters.size());
+    std::vector<bool> hit(filters.size());
+    std::vector<std::pair<ColumnBlockKey, std::string>> fresh;
+    Buffer vmbuffer = InvalidBuffer;
+    uint64 pages = 0, skipped = 0, hits = 0;
+
+    for (const BlockRange& range : *ranges) {
+        BlockNumber end = Min(range.start + range.nblocks, nblocks);
+        for (BlockNumber block = range.start; block < end; ++block) {
+            CHECK_FOR_INTERRUPTS();
+
+            // Records first, off the visibility map alone: a block they rule out is never read.
+            memset(bits, 0xFF, sizeof(bits));
+            int nhits = 0;
+            XLogRecPtr vm_lsn = AllVisibleLSN(rel, block, &vmbuffer);
+            if (!XLogRecPtrIsInvalid(vm_lsn)) {
+                LookupRecords(rel, block, filters, vm_lsn, records);
+                for (size_t f = 0; f < filters.size(); ++f) {
+                    hit[f] = !records[f].empty();
+                    if (!hit[f]) continue;
+                    DecodeRecord(records[f].data(), ints, floats, present);
+                    ApplyFilter(filters[f], ints, floats, present, bits);
+                    nhits++;
+                }
+            } else {
+                std::fill(hit.begin(), hit.end(), false);
+            }
+            hits += nhits;
+            bool any = false;
+            for (int w = 0; w < COLUMN_CACHE_WORDS; ++w) any |= bits[w] != 0;
+            if (!any) {
+                skipped++;
+                continue;
+            }
+
+            Buffer buf = ReadBufferExtended(rel, MAIN_FORKNUM, block, RBM_NORMAL, strategy);
+            LockBuffer(buf, BUFFER_LOCK_SHARE);
+            Page page = BufferGetPage(buf);
+#if PG_VERSION_NUM < 170000
+            TestForOldSnapshot(snapshot, rel, page);
+#endif
+            int nitems = PageGetMaxOffsetNumber(page);
+
+            // Missing columns are mirrored only while the share lock pins the block's all-visible bit.
+            fresh.clear();
+            XLogRecPtr mirror_lsn = nhits < static_cast<int>(filters.size()) ?
+                                        AllVisibleLSN(rel, block, &vmbuffer) : InvalidXLogRecPtr;
+            if (!XLogRecPtrIsInvalid(mirror_lsn)) {
+                for (size_t f = 0; f < filters.size(); ++f) {
+                    if (hit[f]) continue;
+                    ExtractColumn(rel, page, nitems, filters[f], ints, floats, present);
+                    fresh.emplace_back(MakeKey(rel, filters[f].att, block), std::string());
+                    EncodeRecord(nitems, filters[f], ints, floats, present, fresh.back().second);
+                    ApplyFilter(filters[f], ints, floats, present, bits);
+                }
+            }
+
+            // Visibility as heapam's page mode decides it, for the candidates only.
+            bool all_visible = PageIsAllVisible(page) && !snapshot->takenDuringRecovery;
+            int ntuples = 0;
+            for (int i = 0; i < nitems; ++i) {
+                if (!TestBit(bits, i)) continue;
+                ItemId lp = PageGetItemId(page, i + FirstOffsetNumber);
+                if (!ItemIdIsNormal(lp)) continue;
+                HeapTupleData& tuple = tuples[ntuples];
+                tuple.t_data = (HeapTupleHeader)PageGetItem(page, lp);
+                tuple.t_len = ItemIdGetLength(lp);
+                tuple.t_tableOid = RelationGetRelid(rel);
+                ItemPointerSet(&tuple.t_self, block, i + FirstOffsetNumber);
+                bool valid = all_visible || HeapTupleSatisfiesVisibility(&tuple, snapshot, buf);
+                HeapCheckForSerializableConflictOut(valid, rel, &tuple, buf, snapshot);
+                if (valid) ntuples++;
+            }
+            LockBuffer(buf, BUFFER_LOCK_UNLOCK);
+
+            // The pin keeps the tuples in place while they are routed.
+            for (int t = 0; t < ntuples; ++t) {
+                ExecStoreBufferHeapTuple(&tuples[t], slot, buf);
+                visit(slot);
+            }
+            ExecClearTuple(slot);
+            ReleaseBuffer(buf);
+
+            StoreRecords(fresh, mirror_lsn);
+            pages++;
+        }
+    }
+
+    if (BufferIsValid(vmbuffer)) ReleaseBuffer(vmbuffer);
+    ExecDropSingleTupleTableSlot(slot);
+    FreeAccessStrategy(strategy);
+    elog(DEBUG1, "[Lumos ColumnCache] %s: %lu pages read, %lu skipped, %lu mirrored column hits",
+         RelationGetRelationName(rel), pages, skipped, hits);
+    return true;
+}
@@ -0,0 +1,68 @@
+#include "exec/coop_scan.hpp"
+
+extern "C" {
+#include "access/heapam.h"
+#include "access/syncscan.h"
+}
+
+CooperativeScan::CooperativeScan(Relation rel, Snapshot snapshot, const std::vector<BlockRange>* ranges)
+    : rel_(rel), scan_(NULL), reporting_(false), last_block_(InvalidBlockNumber), next_range_(0) {
+    bool heap = rel->rd_tableam == GetHeapamTableAmRoutine();
+    if (ranges != NULL && heap) {
+        scan_ = table_beginscan_strat(rel, snapshot, 0, NULL, true, false);
+        // Clipped to the blocks this scan sees, a range past them cannot be read.
+        BlockNumber nblocks = ((HeapScanDesc)scan_)->rs_nblocks;
+        for (const BlockRange& range : *ranges) {
+            if (range.start >= nblocks) break;
+            ranges_.push_back({range.start, Min(range.nblocks, nblocks - range.start)});
+        }
+        if (ranges_.empty()) ranges_.push_back({0, 0});
+        heap_setscanlimits(scan_, ranges_[0].start, ranges_[0].nblocks);
+        next_range_ = 1;
+        return;
+    }
+
+    if (!synchronize_seqscans || !heap) {
+        scan_ = table_beginscan(rel, snapshot, 0, NULL);
+        return;
+    }
+
+    // Start position is placed by hand, heapam's own sync would skip small tables.
+    scan_ = table_beginscan_strat(rel, snapshot, 0, NULL, true, false);
+    BlockNumber nblocks = ((HeapScanDesc)scan_)->rs_nblocks;
+    if (nblocks > 0) {
+        heap_setscanlimits(scan_, ss_get_location(rel, nblocks), nblocks);
+        reporting_ = true;
+    }
+}
+
+CooperativeScan::~CooperativeScan() {
+    End();
+}
+
+void CooperativeScan::End() {
+    if (scan_ != NULL) table_endscan(scan_);
+    scan_ = NULL;
+}
+
+bool CooperativeScan::Next(TupleTableSlot* slot) {
+    while (!table_scan_getnextslot(scan_, ForwardScanDirection, slot)) {
+        if (!NextRange()) return false;
+    }
+    if (reporting_) {
+        BlockNumber block = ItemPointerGetBlockNumber(&slot->tts_tid);
+        // ss_report_location itself throttles to every SYNC_SCAN_REPORT_INTERVAL pages.
+        if (block != last_block_) ss_report_location(rel_, block);
+        last_block_ = block;
+    }
+    return true;
+}
+
+// Restarts the scan on the next block range, false after the last one.
+bool CooperativeScan::NextRange() {
+    if (next_range_ >= ranges_.size()) return false;
+    table_rescan(scan_, NULL);
+    heap_setscanlimits(scan_, ranges_[next_range_].start, ranges_[next_range_].nblocks);
+    next_range_++;
+    return true;
+}
@@ -1,8 +1,107 @@
 #include "exec/executor.hpp"
+
+extern "C" {
+#include "access/parallel.h"
+#include "portability/instr_time.h"
+#include "utils/guc.h"
+}
+
 #include "pg_under_macro.hpp"
 #include "mqo.pb.h"
+#include "pg_redef_macro.hpp"
+#include <algorithm>
+#include <climits>
 #include <stdexcept>
 
+int Executor::parallel_batch_workers_ = 0;
+int Executor::parallel_batch_min_rows_ = 256;
+int Executor::parallel_scan_workers_ = 0;
+bool Executor::enable_rescan_ = true;
+bool Executor::enable_set_rewrite_ = true;
+bool Executor::enable_shared_agg_ = true;
+bool Executor::enable_shared_scan_ = true;
+
+const int MQO_MIN_ROWS_PER_WORKER = 32;
+
+void Executor::Init() {
+    DefineCustomIntVariable("lumos.parallel_batch_workers",
+                            "Parallel workers per read-only MQO batch (0 disables).",
+                            NULL,
+                            &parallel_batch_workers_,
+                            0,
+                            0,
+                            64,
+                            PGC_USERSET,
+                            0,
+                            NULL,
+                            NULL,
+                            NULL);
+    DefineCustomIntVariable("lumos.parallel_batch_min_rows",
+                            "Smallest batch that is spread over parallel workers.",
+                            NULL,
+                            &parallel_batch_min_rows_,
+                            256,
+                            1,
+                            INT_MAX,
+                            PGC_USERSET,
+                            0,
+                            NULL,
+                            NULL,
+                            NULL);
+    DefineCustomIntVariable("lumos.parallel_scan_workers",
+                            "Parallel workers per shared scan of a large relation (0 disables).",
+                            NULL,
+                            &parallel_scan_workers_,
+                            0,
+                            0,
+                            64,
+                            PGC_USERSET,
+                            0,
+                            NULL,
+                            NULL,
+                            NULL);
+    DefineCustomBoolVariable("lumos.enable_rescan",
+                             "Run read-only MQO batches through one executor with ExecReScan per row.",
+                             "Off falls back to one SPI_execute_plan per row.",
+                             &enable_rescan_,
+                             true,
+                             PGC_USERSET,
+                             0,
+                             NULL,
+                             NULL,
+                             NULL);
+    DefineCustomBoolVariable("lumos.enable_set_rewrite",
+                             "Rewrite single-equality MQO batches into one unnest() WITH ORDINALITY join.",
+                             NULL,
+                             &enable_set_rewrite_,
+                             true,
+                             PGC_USERSET,
+                             0,
+                             NULL,
+                             NULL,
+                             NULL);
+    DefineCustomBoolVariable("lumos.enable_shared_agg",
+                             "Answer aggregate-only MQO batches with one shared scan of the relation.",
+                             NULL,
+                             &enable_shared_agg_,
+                             true,
+                             PGC_USERSET,
+                             0,
+                             NULL,
+                             NULL,
+                             NULL);
+    DefineCustomBoolVariable("lumos.enable_shared_scan",
+                             "Answer single-table SELECT batches with one shared scan routing rows to requests.",
+                             NULL,
+                             &enable_shared_scan_,
+                             true,
+                             PGC_USERSET,
+                             0,
+                             NULL,
+                             NULL,
+                             NULL);
+}
+
 Executor::Executor() {
     planner_ = std::make_unique<Planner>();
     runtime_ = std::make_unique<Runtime>();
@@ -10,19 +109,68 @@ Executor::Executor() {
 Executor::~Executor() {
 }
 
-int Executor::Execute(const mqo::BatchPayload& payload) {
+Planner& Executor::GetPlanner() {
+    return *planner_;
+}
 
-    if (!payload.scan_table().empty() && !payload.scan_col().empty()) {
-        return DispatchSharedScan(payload);
-    }
+Runtime& Executor::GetRuntime() {
+    return *runtime_;
+}
+
+int Executor::Execute(const mqo::BatchPayload& payload, mqo::BatchResult* result) {
 
     if (payload.use_mqo()) {
-        return DispatchMQO(payload);
+        return DispatchMQO(payload, result);
     }
 
     return DispatchStandard(payload);
 }
 
+void Executor::ExecuteMulti(const std::vector<const mqo::BatchPayload*>& batches,
+                            std::vector<mqo::BatchResult*>& results) {
+    std::vector<bool> answered(batches.size(), false);
+
+    if (enable_shared_agg_) {
+        int ret = SPI_connect();
+        if (ret != SPI_OK_CONNECT) throw std::runtime_error("SPI Connect failed");
+        try {
+            std::vector<SPIPlanPtr> plans;
+            for (const mqo::BatchPayload* batch : batches) {
+                bool eligible = batch->use_mqo() && !batch->dry_run() && batch->rows_size() > 0;
+                plans.push_back(eligible ? planner_->PrepareMQO(*batch) : NULL);
+            }
+            runtime_->ExecuteSharedAggregates(plans, batches, results, answered);
+        } catch (...) {
+            SPI_finish();
+            throw;
+        }
+        SPI_finish();
+    }
+
+    for (size_t i = 0; i < batches.size(); ++i) {
+        if (!answered[i]) Execute(*batches[i], results[i]);
+    }
+}
+
+bool Executor::ExecuteWindow(const std::vector<const mqo::BatchPayload*>& batches,
+                             std::vector<mqo::BatchResult*>& results) {
+    runtime_->BeginWindow();
+    for (size_t i = 0; i < batches.size(); ++i) {
+        // A dry-run batch rolls back its own writes only, the rest of the window still commits.
+        bool dry_run = batches[i]->dry_run();
+        runtime_->BeginWindowBatch(dry_run);
+        try {
+            Execute(*batches[i], results[i]);
+        } catch (...) {
+            runtime_->EndWindowBatch(dry_run);
+            runtime_->EndWindow(false);
+            throw;
+        }
+        runtime_->EndWindowBatch(dry_run);
+    }
+    return runtime_->EndWindow(true);
+}
+
 int Executor::DispatchStandard(const mqo::BatchPayload& payload) {
     int ret = SPI_connect();
     if (ret != SPI_OK_CONNECT) throw std::runtime_error("SPI Connect failed");
@@ -41,14 +189,27 @@ int Executor::DispatchStandard(const mqo::BatchPayload& payload) {
     return res;
 }
 
-int Executor::DispatchMQO(const mqo::BatchPayload& payload) {
+int Executor::DispatchMQO(const mqo::BatchPayload& payload, mqo::BatchResult* result) {
     int ret = SPI_connect();
     if (ret != SPI_OK_CONNECT) throw std::runtime_error("SPI Connect failed");
     int res = 0;
     try {
+        // Single-table SELECTs first, whatever their WHERE looks like: one scan routes every request's rows.
         SPIPlanPtr plan = planner_->PrepareMQO(payload);
-        if (plan) {
-            res = runtime_->ExecuteBatchMQO(plan, payload);
+        if (enable_shared_scan_ && plan && payload.rows_size() > 1 && DispatchSharedScan(plan, payload, result, res)) {
+            SPI_finish();
+            return res;
+        }
+
+        SPIPlanPtr set_plan = NULL;
+        if (enable_set_rewrite_ && payload.rows_size() > 1 && !payload.dry_run()) {
+            set_plan = planner_->PrepareSetOriented(payload);
+        }
+        bool joined = set_plan != NULL && runtime_->ExecuteSetOriented(set_plan, payload, result, res);
+        if (!joined && plan) {
+            bool shared = enable_shared_agg_ && payload.rows_size() > 1 && !payload.dry_run() &&
+                          runtime_->ExecuteSharedAggregate(plan, payload, result, res);
+            if (!shared) res = DispatchPerRow(plan, payload, result);
         }
     } catch (...) {
         SPI_finish();
@@ -58,16 +219,132 @@ int Executor::DispatchMQO(const mqo::BatchPayload& payload) {
     return res;
 }
 
-int Executor::DispatchSharedScan(const mqo::BatchPayload& payload) {
+int Executor::DispatchPerRow(SPIPlanPtr plan, const mqo::BatchPayload& payload, mqo::BatchResult* result) {
+    if (result != NULL) return runtime_->ExecuteBatchMQO(plan, payload, result);
+
+    int nworkers = ParallelWorkersFor(plan, payload);
+    if (nworkers > 0 && payload.template_sql().empty()) {
+        // Workers have their own template registries, ship the text along.
+        mqo::BatchPayload shipped(payload);
+        shipped.set_template_sql(planner_->ResolveSQL(payload));
+        return runtime_->ExecuteBatchParallel(plan, shipped, nworkers);
+    } else if (nworkers > 0) {
+        return runtime_->ExecuteBatchParallel(plan, payload, nworkers);
+    }
+
+    int res = 0;
+    instr_time start, elapsed;
+    INSTR_TIME_SET_CURRENT(start);
+    bool rescanned = enable_rescan_ && !payload.dry_run() && Planner::IsReadOnly(plan) &&
+                     runtime_->ExecuteBatchRescan(plan, payload, res);
+    if (!rescanned) res = runtime_->ExecuteBatchMQO(plan, payload);
+    INSTR_TIME_SET_CURRENT(elapsed);
+    INSTR_TIME_SUBTRACT(elapsed, start);
+    elog(DEBUG1, "[Lumos] %s batch: %d rows in %.3f ms", rescanned ? "ReScan" : "SPI", payload.rows_size(),
+         INSTR_TIME_GET_MILLISEC(elapsed));
+    return res;
+}
+
+void Executor::BeginStream() {
+    runtime_->BeginStream();
+}
+
+int Executor::ExecuteChunk(const mqo::BatchPayload& stream, const mqo::BatchChunk& chunk) {
+    if (chunk.rows_size() == 0) return 0;
+
+    // Each chunk is a batch of its own: ReScan, set rewrite, shared scans and shared aggregation apply.
+    mqo::BatchPayload payload(stream);
+    *payload.mutable_rows() = chunk.rows();
+    bool dry_run = payload.dry_run();
+    runtime_->BeginStreamChunk(dry_run);
+    int res;
+    try {
+        res = Execute(payload);
+    } catch (...) {
+        runtime_->EndStreamChunk(dry_run);
+        throw;
+    }
+    runtime_->EndStreamChunk(dry_run);
+    return res;
+}
+
+bool Executor::FinishStream() {
+    return runtime_->EndStream();
+}
+
+std::string Executor::CheckSharedScan(const mqo::BatchPayload& payload) {
+    if (!payload.use_mqo() || payload.rows_size() == 0) return "SharedScan: not attempted";
+
     int ret = SPI_connect();
     if (ret != SPI_OK_CONNECT) throw std::runtime_error("SPI Connect failed");
-    int res = 0;
+    std::string report;
     try {
-        res = runtime_->ExecuteSharedScan(payload);
+        SPIPlanPtr plan = planner_->PrepareMQO(payload);
+        if (plan == NULL || !Planner::IsReadOnly(plan)) {
+            report = "SharedScan: not attempted (writes)";
+        } else {
+            report = runtime_->CheckSharedScan(plan, payload);
+        }
     } catch (...) {
         SPI_finish();
         throw;
     }
     SPI_finish();
-    return res;
-}
\ No newline at end of file
+    return report;
+}
+
+int Executor::ParallelWorkersFor(SPIPlanPtr plan, const mqo::BatchPayload& payload) {
+    if (parallel_batch_workers_ == 0 || payload.rows_size() < parallel_batch_min_rows_) return 0;
+    // Parallel mode forbids writes, sub-transactions and parallel-unsafe functions: plain, safe SELECTs only.
+    if (IsInParallelMode() || runtime_->InWindow() || !Planner::IsParallelSafe(plan)) return 0;
+    return Min(parallel_batch_workers_, payload.rows_size() / MQO_MIN_ROWS_PER_WORKER);
+}
+
+void Executor::ParallelWorkerMain(shm_toc* toc) {
+    mqo::BatchPayload payload;
+    if (!Runtime::ReadParallelPayload(toc, payload)) {
+        elog(ERROR, "LumosKernel: Protobuf parsing failed in parallel worker.");
+    }
+
+    // Plans are backend-local: each worker prepares its own copy of the template.
+    int ret = SPI_connect();
+    if (ret != SPI_OK_CONNECT) throw std::runtime_error("SPI Connect failed");
+    try {
+        SPIPlanPtr plan = planner_->PrepareMQO(payload);
+        if (plan && Runtime::IsParallelScan(toc)) {
+            runtime_->ExecuteParallelScanPartition(plan, payload, toc);
+        } else if (plan) {
+            runtime_->ExecuteParallelPartition(plan, payload, toc);
+        }
+    } catch (...) {
+        SPI_finish();
+        throw;
+    }
+    SPI_finish();
+}
+
+bool Executor::DispatchSharedScan(SPIPlanPtr plan,
+                                  const mqo::BatchPayload& payload,
+                                  mqo::BatchResult* result,
+                                  int& res) {
+    bool shared;
+    int nworkers = (IsInParallelMode() || runtime_->InWindow()) ? 0 : parallel_scan_workers_;
+    if (nworkers > 0 && payload.template_sql().empty()) {
+        // Workers have their own template registries, ship the text along.
+        mqo::BatchPayload shipped(payload);
+        shipped.set_template_sql(planner_->ResolveSQL(payload));
+        shared = runtime_->ExecuteSharedScan(plan, shipped, result, res, nworkers);
+    } else {
+        shared = runtime_->ExecuteSharedScan(plan, payload, result, res, nworkers);
+    }
+    if (!shared) return false;
+    if (result != NULL) result->set_routed(true);
+
+    // Like every other strategy the count is of requests run, the routed rows only go to the log.
+    elog(DEBUG1, "[Lumos SharedScan] %d rows routed to %d requests", res, payload.rows_size());
+    int arg_count = SPI_getargcount(plan);
+    res = std::count_if(payload.rows().begin(), payload.rows().end(),
+                        [arg_count](const mqo::ParamRow& row) { return row.values_size() == arg_count; });
+    return true;
+}
+
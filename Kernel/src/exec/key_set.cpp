@@ -0,0 +1,100 @@
+#include "exec/key_set.hpp"
+
+extern "C" {
+#include "utils/datum.h"
+#include "utils/lsyscache.h"
+#include "utils/typcache.h"
+}
+
+DatumKeySet::DatumKeySet(Oid type_id, Oid collation, size_t expected_keys)
+    : collation_(collation), mask_(0) {
+    get_typlenbyval(type_id, &typlen_, &typbyval_);
+
+    TypeCacheEntry* typentry = lookup_type_cache(type_id, TYPECACHE_HASH_PROC_FINFO | TYPECACHE_EQ_OPR_FINFO);
+    hashable_ = OidIsValid(typentry->hash_proc_finfo.fn_oid) && OidIsValid(typentry->eq_opr_finfo.fn_oid);
+    if (!hashable_) return;
+
+    fmgr_info_copy(&hash_finfo_, &typentry->hash_proc_finfo, CurrentMemoryContext);
+    fmgr_info_copy(&eq_finfo_, &typentry->eq_opr_finfo, CurrentMemoryContext);
+
+    // Load factor <= 0.5
+    size_t capacity = 16;
+    while (capacity < expected_keys * 2) capacity <<= 1;
+    slots_.assign(capacity, -1);
+    mask_ = capacity - 1;
+}
+DatumKeySet::~DatumKeySet() {
+}
+
+uint32 DatumKeySet::Hash(Datum value) const {
+    return DatumGetUInt32(FunctionCall1Coll(const_cast<FmgrInfo*>(&hash_finfo_), collation_, value));
+}
+
+bool DatumKeySet::Equal(Datum a, Datum b) const {
+    if (!hashable_) return typbyval_ ? a == b : datumIsEqual(a, b, typbyval_, typlen_);
+    return DatumGetBool(FunctionCall2Coll(const_cast<FmgrInfo*>(&eq_finfo_), collation_, a, b));
+}
+
+int DatumKeySet::Insert(Datum key) {
+    if (!hashable_) {
+        int found = Find(key);
+        if (found >= 0) return found;
+        keys_.push_back(key);
+        return keys_.size() - 1;
+    }
+
+    // The table is sized for expected_keys, grow if the caller under-estimated.
+    if ((keys_.size() + 1) * 2 > slots_.size()) {
+        slots_.assign(slots_.size() * 2, -1);
+        mask_ = slots_.size() - 1;
+        for (size_t i = 0; i < keys_.size(); ++i) {
+            uint32 pos = hashes_[i] & mask_;
+            while (slots_[pos] >= 0) pos = (pos + 1) & mask_;
+            slots_[pos] = i;
+        }
+    }
+
+    uint32 hash = Hash(key);
+    uint32 pos = hash & mask_;
+    while (slots_[pos] >= 0) {
+        int32 idx = slots_[pos];
+        if (hashes_[idx] == hash && Equal(keys_[idx], key)) return idx;
+        pos = (pos + 1) & mask_;
+    }
+    slots_[pos] = keys_.size();
+    keys_.push_back(key);
+    hashes_.push_back(hash);
+    return keys_.size() - 1;
+}
+
+bool DatumKeySet::Contains(Datum value) const {
+    return Find(value) >= 0;
+}
+
+int DatumKeySet::Find(Datum value) const {
+    if (!hashable_) {
+        for (size_t i = 0; i < keys_.size(); ++i) {
+            if (Equal(value, keys_[i])) return i;
+        }
+        return -1;
+    }
+    if (keys_.empty()) return -1;
+
+    uint32 hash = Hash(value);
+
+    uint32 pos = hash & mask_;
+    while (slots_[pos] >= 0) {
+        int32 idx = slots_[pos];
+        if (hashes_[idx] == hash && Equal(keys_[idx], value)) return idx;
+        pos = (pos + 1) & mask_;
+    }
+    return -1;
+}
+
+size_t DatumKeySet::Size() const {
+    return keys_.size();
+}
+
+const std::vector<Datum>& DatumKeySet::Keys() const {
+    return keys_;
+}
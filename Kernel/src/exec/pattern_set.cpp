@@ -0,0 +1,147 @@
+#include "exec/pattern_set.hpp"
+
+#include <deque>
+
+static int32 FindEdge(const std::vector<std::pair<uint8, int32>>& edges, uint8 c) {
+    for (const auto& edge : edges) {
+        if (edge.first == c) return edge.second;
+    }
+    return -1;
+}
+
+PatternSet::PatternSet() : generation_(0) {
+    nodes_.push_back({{}, 0, -1, 0, {}});
+    for (int c = 0; c < 256; ++c) root_next_[c] = 0;
+}
+
+int PatternSet::Insert(const char* pattern, int len) {
+    std::string key(pattern, len);
+    auto it = positions_.find(key);
+    if (it != positions_.end()) return it->second;
+
+    std::vector<std::string> segments;
+    std::string current;
+    bool trailing_percent = false;
+    for (int i = 0; i < len; ++i) {
+        char c = pattern[i];
+        trailing_percent = false;
+        if (c == '\\') {
+            if (i + 1 >= len) return -1; // textlike raises an error for it
+            current += pattern[++i];
+        } else if (c == '_') {
+            return -1;
+        } else if (c == '%') {
+            if (!current.empty()) segments.push_back(current);
+            current.clear();
+            trailing_percent = true;
+        } else {
+            current += c;
+        }
+    }
+    if (!current.empty()) segments.push_back(current);
+
+    int position = patterns_.size();
+    patterns_.push_back({static_cast<int>(segments.size()), len == 0 || pattern[0] != '%', !trailing_percent});
+    positions_.emplace(std::move(key), position);
+
+    if (segments.empty()) {
+        (len == 0 ? empty_ : universal_).push_back(position);
+        return position;
+    }
+    for (size_t s = 0; s < segments.size(); ++s) {
+        nodes_[AddSegment(segments[s])].occurrences.push_back({position, static_cast<int>(s)});
+    }
+    return position;
+}
+
+int32 PatternSet::AddSegment(const std::string& segment) {
+    int32 node = 0;
+    for (char ch : segment) {
+        uint8 c = static_cast<uint8>(ch);
+        int32 child = FindEdge(nodes_[node].next, c);
+        if (child < 0) {
+            child = nodes_.size();
+            int32 depth = nodes_[node].depth + 1;
+            nodes_.push_back({{}, 0, -1, depth, {}});
+            nodes_[node].next.emplace_back(c, child);
+        }
+        node = child;
+    }
+    return node;
+}
+
+void PatternSet::Build() {
+    std::deque<int32> queue;
+    for (const auto& edge : nodes_[0].next) {
+        root_next_[edge.first] = edge.second;
+        nodes_[edge.second].fail = 0;
+        queue.push_back(edge.second);
+    }
+    nodes_[0].output = nodes_[0].occurrences.empty() ? -1 : 0;
+
+    // Breadth first: a node's failure target is shallower, its links are final when it is reached.
+    while (!queue.empty()) {
+        int32 node = queue.front();
+        queue.pop_front();
+        int32 fail = nodes_[node].fail;
+        nodes_[node].output = !nodes_[node].occurrences.empty() ? node : nodes_[fail].output;
+
+        for (const auto& edge : nodes_[node].next) {
+            int32 f = fail;
+            int32 target;
+            while ((target = Child(f, edge.first)) < 0) f = nodes_[f].fail;
+            nodes_[edge.second].fail = target;
+            queue.push_back(edge.second);
+        }
+    }
+    progress_.assign(patterns_.size(), {0, 0, 0});
+}
+
+// Goto function; the root never fails.
+int32 PatternSet::Child(int32 node, uint8 c) const {
+    if (node == 0) return root_next_[c];
+    return FindEdge(nodes_[node].next, c);
+}
+
+void PatternSet::Match(const char* text, int len, std::vector<int>& out) {
+    out.assign(universal_.begin(), universal_.end());
+    if (len == 0) out.insert(out.end(), empty_.begin(), empty_.end());
+
+    if (++generation_ == 0) { // Wrapped: no progress entry may look current
+        for (Progress& p : progress_) p.generation = 0;
+        generation_ = 1;
+    }
+
+    int32 node = 0;
+    for (int i = 0; i < len; ++i) {
+        uint8 c = static_cast<uint8>(text[i]);
+        int32 next;
+        while ((next = Child(node, c)) < 0) node = nodes_[node].fail;
+        node = next;
+
+        for (int32 n = nodes_[node].output; n >= 0; n = nodes_[nodes_[n].fail].output) {
+            for (const Occurrence& occ : nodes_[n].occurrences) {
+                Advance(occ.pattern, occ.segment, i - nodes_[n].depth + 1, i, len, out);
+            }
+            if (n == 0) break;
+        }
+    }
+}
+
+void PatternSet::Advance(int pattern, int segment, int start, int end, int len, std::vector<int>& out) {
+    Progress& progress = progress_[pattern];
+    if (progress.generation != generation_) progress = {generation_, 0, 0};
+    if (progress.segment != segment || start < progress.pos) return;
+
+    const Pattern& p = patterns_[pattern];
+    if (segment == 0 && p.anchored_start && start != 0) return;
+    if (segment == p.segments - 1 && p.anchored_end && end != len - 1) return;
+
+    progress.segment++;
+    progress.pos = end + 1;
+    if (progress.segment == p.segments) out.push_back(pattern);
+}
+
+size_t PatternSet::Size() const {
+    return patterns_.size();
+}
@@ -1,21 +1,235 @@
 #include "exec/planner.hpp"
 #include "exec/type_mapper.hpp"
 
+extern "C" {
+#include "catalog/pg_class.h"
+#include "nodes/nodeFuncs.h"
+#include "nodes/parsenodes.h"
+#include "optimizer/optimizer.h"
+#include "parser/parser.h"
+#include "utils/lsyscache.h"
+#include "utils/plancache.h"
+}
+
 #include "pg_under_macro.hpp"
 #include "mqo.pb.h"
 #include "pg_redef_macro.hpp"
 
 #include <stdexcept>
 
-std::map<std::string, SPIPlanPtr> Planner::plan_cache_;
-
 const size_t MAX_PLAN_CACHE_SIZE = 50;
+const size_t MAX_TEMPLATE_REGISTRY_SIZE = 1024;
+
+struct ParamRefScan {
+    int count;
+    int number;
+    int location;
+};
+
+static bool CollectParamRefs(Node* node, void* context) {
+    if (node == NULL) return false;
+    if (IsA(node, ParamRef)) {
+        ParamRefScan* scan = static_cast<ParamRefScan*>(context);
+        scan->count++;
+        scan->number = castNode(ParamRef, node)->number;
+        scan->location = castNode(ParamRef, node)->location;
+        return false;
+    }
+#if PG_VERSION_NUM >= 160000
+    return raw_expression_tree_walker(node, CollectParamRefs, context);
+#else
+    return raw_expression_tree_walker(node, reinterpret_cast<bool (*)()>(CollectParamRefs), context);
+#endif
+}
+
+static bool IsParamRef(Node* node) {
+    if (node != NULL && IsA(node, TypeCast)) node = castNode(TypeCast, node)->arg;
+    return node != NULL && IsA(node, ParamRef);
+}
+
+// `<expr> = $1` (either side, casts allowed) as the WHERE clause or one of its top-level AND arms.
+static bool HasParamEquality(Node* qual) {
+    if (qual == NULL) return false;
+    if (IsA(qual, BoolExpr) && castNode(BoolExpr, qual)->boolop == AND_EXPR) {
+        ListCell* lc;
+        foreach (lc, castNode(BoolExpr, qual)->args) {
+            if (HasParamEquality(static_cast<Node*>(lfirst(lc)))) return true;
+        }
+        return false;
+    }
+    if (!IsA(qual, A_Expr)) return false;
+
+    A_Expr* expr = castNode(A_Expr, qual);
+    if (expr->kind != AEXPR_OP || list_length(expr->name) != 1 || strcmp(strVal(linitial(expr->name)), "=") != 0) {
+        return false;
+    }
+    return IsParamRef(expr->lexpr) != IsParamRef(expr->rexpr);
+}
+
+// Data-modifying CTEs, the only place a SELECT can carry DML (they must sit at the top level).
+static bool HasModifyingCTE(SelectStmt* select) {
+    if (select->withClause == NULL) return false;
+    ListCell* lc;
+    foreach (lc, select->withClause->ctes) {
+        Node* query = lfirst_node(CommonTableExpr, lc)->ctequery;
+        if (!IsA(query, SelectStmt)) return true;
+    }
+    return false;
+}
+
+// Workers cannot read the leader's temporary tables, their buffers are backend-local.
+static bool ReadsTempRelation(Node* node, void* context) {
+    if (node == NULL) return false;
+    if (IsA(node, RangeTblEntry)) {
+        RangeTblEntry* rte = castNode(RangeTblEntry, node);
+        return rte->rtekind == RTE_RELATION && get_rel_persistence(rte->relid) == RELPERSISTENCE_TEMP;
+    }
+#if PG_VERSION_NUM >= 160000
+    if (IsA(node, Query)) {
+        return query_tree_walker(castNode(Query, node), ReadsTempRelation, context, QTW_EXAMINE_RTES_BEFORE);
+    }
+    return expression_tree_walker(node, ReadsTempRelation, context);
+#else
+    if (IsA(node, Query)) {
+        return query_tree_walker(castNode(Query, node), reinterpret_cast<bool (*)()>(ReadsTempRelation), context,
+                                 QTW_EXAMINE_RTES_BEFORE);
+    }
+    return expression_tree_walker(node, reinterpret_cast<bool (*)()>(ReadsTempRelation), context);
+#endif
+}
 
 Planner::Planner() {
 }
 Planner::~Planner() {
 }
 
+void Planner::RegisterTemplate(uint64_t template_id, const std::string& sql) {
+    if (template_registry_.size() >= MAX_TEMPLATE_REGISTRY_SIZE && template_registry_.count(template_id) == 0) {
+        // Evicted ids are reported as misses, the proxy then resends the text.
+        elog(DEBUG1, "[Lumos] Template registry full (%lu), flushing...", template_registry_.size());
+        template_registry_.clear();
+    }
+    template_registry_[template_id] = sql;
+}
+
+bool Planner::HasTemplate(uint64_t template_id) const {
+    return template_registry_.count(template_id) > 0;
+}
+
+const std::string& Planner::ResolveSQL(const mqo::BatchPayload& payload) const {
+    if (!payload.template_sql().empty() || payload.template_id() == 0) {
+        return payload.template_sql();
+    }
+    auto it = template_registry_.find(payload.template_id());
+    if (it == template_registry_.end()) {
+        throw std::runtime_error("Unregistered template id: " + std::to_string(payload.template_id()));
+    }
+    return it->second;
+}
+
+// Checked on the analyzed queries: the raw tree hides data-modifying CTEs and rules.
+bool Planner::IsReadOnly(SPIPlanPtr plan) {
+    ListCell* lc;
+    foreach (lc, SPI_plan_get_plan_sources(plan)) {
+        CachedPlanSource* source = static_cast<CachedPlanSource*>(lfirst(lc));
+        if (source->query_list == NIL) return false;
+        ListCell* qc;
+        foreach (qc, source->query_list) {
+            Query* query = lfirst_node(Query, qc);
+            if (query->commandType != CMD_SELECT || query->utilityStmt != NULL || query->hasModifyingCTE ||
+                query->rowMarks != NIL) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool Planner::IsParallelSafe(SPIPlanPtr plan) {
+    if (!IsReadOnly(plan)) return false;
+    ListCell* lc;
+    foreach (lc, SPI_plan_get_plan_sources(plan)) {
+        CachedPlanSource* source = static_cast<CachedPlanSource*>(lfirst(lc));
+        ListCell* qc;
+        foreach (qc, source->query_list) {
+            Query* query = lfirst_node(Query, qc);
+            if (max_parallel_hazard(query) != PROPARALLEL_SAFE || ReadsTempRelation((Node*)query, NULL)) return false;
+        }
+    }
+    return true;
+}
+
+Oid Planner::ResolveType(const std::string& type_name) {
+    auto it = type_cache_.find(type_name);
+    if (it != type_cache_.end()) return it->second;
+
+    Oid type_oid = TypeMapper::ResolveTypeOid(type_name);
+    type_cache_[type_name] = type_oid;
+    return type_oid;
+}
+
+void Planner::InvalidateTypes() {
+    type_cache_.clear();
+}
+
+uint64_t Planner::PlanKey(const mqo::BatchPayload& payload) {
+    if (payload.template_id() != 0) return payload.template_id();
+    return std::hash<std::string>{}(payload.template_sql());
+}
+
+bool Planner::RewriteSetOriented(const std::string& sql, std::string& out) {
+    List* parsed = raw_parser(sql.c_str(), RAW_PARSE_DEFAULT);
+    if (list_length(parsed) != 1) return false;
+
+    RawStmt* raw = linitial_node(RawStmt, parsed);
+    if (!IsA(raw->stmt, SelectStmt)) return false;
+    SelectStmt* select = castNode(SelectStmt, raw->stmt);
+    // Per-request writes would run once per key inside one statement, where later keys cannot see earlier ones.
+    if (select->op != SETOP_NONE || select->lockingClause != NIL || select->intoClause != NULL ||
+        HasModifyingCTE(select)) {
+        return false;
+    }
+    if (!HasParamEquality(select->whereClause)) return false;
+
+    ParamRefScan scan = {0, 0, -1};
+    CollectParamRefs(raw->stmt, &scan);
+    if (scan.count != 1 || scan.number != 1 || scan.location < 0) return false;
+
+    // Splice the key column over "$1", the template itself stays a LATERAL subquery so
+    // per-request LIMIT/aggregates keep their meaning. ord maps result rows back to batch rows.
+    std::string body = raw->stmt_len > 0 ? sql.substr(raw->stmt_location, raw->stmt_len) : sql.substr(raw->stmt_location);
+    body.replace(scan.location - raw->stmt_location, 2, "__lumos_k.val");
+    out = "SELECT __lumos_k.ord, __lumos_q.* FROM unnest($1) WITH ORDINALITY AS __lumos_k(val, ord) "
+          "CROSS JOIN LATERAL (" +
+          body + ") AS __lumos_q";
+    return true;
+}
+
+std::vector<Oid> Planner::ResolveArgTypes(const mqo::BatchPayload& payload) {
+    int arg_count = payload.rows_size() > 0 ? payload.rows(0).values_size() : payload.param_types_size();
+    std::vector<Oid> arg_types(arg_count);
+    if (payload.param_types_size() == arg_count) {
+        for (int i = 0; i < arg_count; ++i) {
+            arg_types[i] = ResolveType(payload.param_types(i));
+        }
+    } else {
+        for (int i = 0; i < arg_count; ++i) {
+            arg_types[i] = TypeMapper::DeduceTypeOid(payload.rows(0).values(i));
+        }
+    }
+    return arg_types;
+}
+
+void Planner::FlushPlanCache(std::unordered_map<uint64_t, SPIPlanPtr>& cache) {
+    elog(DEBUG1, "[Lumos] Plan cache full (%lu), flushing...", cache.size());
+    for (auto& pair : cache) {
+        if (pair.second != NULL) {
+            SPI_freeplan(pair.second);
+        }
+    }
+    cache.clear();
+}
+
 SPIPlanPtr Planner::PrepareSPI(const mqo::BatchPayload& payload) {
 
     if (payload.rows_size() == 0) {
@@ -31,7 +245,7 @@ SPIPlanPtr Planner::PrepareSPI(const mqo::BatchPayload& payload) {
         arg_types[i] = TypeMapper::DeduceTypeOid(first_row.values(i));
     }
 
-    SPIPlanPtr plan = SPI_prepare(payload.template_sql().c_str(), arg_count, arg_types.data());
+    SPIPlanPtr plan = SPI_prepare(ResolveSQL(payload).c_str(), arg_count, arg_types.data());
 
     if (!plan) {
         throw std::runtime_error("SPI_prepare failed. Code: " + std::to_string(SPI_result));
@@ -41,20 +255,13 @@ SPIPlanPtr Planner::PrepareSPI(const mqo::BatchPayload& payload) {
 }
 
 SPIPlanPtr Planner::PrepareMQO(const mqo::BatchPayload& payload) {
-    if (payload.rows_size() == 0) return NULL;
-    std::string sql_key = payload.template_sql();
+    // Stream headers carry no rows, their arity comes from param_types.
+    if (payload.rows_size() == 0 && payload.param_types_size() == 0) return NULL;
+    uint64_t plan_key = PlanKey(payload);
 
-    if (plan_cache_.size() >= MAX_PLAN_CACHE_SIZE) {
-        elog(DEBUG1, "[Lumos] Plan cache full (%lu), flushing...", plan_cache_.size());
-        for (auto& pair : plan_cache_) {
-            if (pair.second != NULL) {
-                SPI_freeplan(pair.second);
-            }
-        }
-        plan_cache_.clear();
-    }
+    if (plan_cache_.size() >= MAX_PLAN_CACHE_SIZE) FlushPlanCache(plan_cache_);
 
-    auto it = plan_cache_.find(sql_key);
+    auto it = plan_cache_.find(plan_key);
     if (it != plan_cache_.end()) {
         SPIPlanPtr cached_plan = it->second;
         if (SPI_plan_is_valid(cached_plan)) {
@@ -65,23 +272,43 @@ SPIPlanPtr Planner::PrepareMQO(const mqo::BatchPayload& payload) {
         }
     }
 
-    int arg_count = payload.rows(0).values_size();
-    std::vector<Oid> arg_types(arg_count);
-    if (payload.param_types_size() == arg_count) {
-        for (int i = 0; i < arg_count; ++i) {
-            arg_types[i] = TypeMapper::ResolveTypeOid(payload.param_types(i));
-        }
-    } else {
-        for (int i = 0; i < arg_count; ++i) {
-            arg_types[i] = TypeMapper::DeduceTypeOid(payload.rows(0).values(i));
-        }
+    std::vector<Oid> arg_types = ResolveArgTypes(payload);
+    SPIPlanPtr plan = SPI_prepare(ResolveSQL(payload).c_str(), arg_types.size(), arg_types.data());
+    if (!plan) throw std::runtime_error("SPI_prepare MQO failed.");
+
+    if (SPI_keepplan(plan) == 0) {
+        plan_cache_[plan_key] = plan;
     }
+    return plan;
+}
 
-    SPIPlanPtr plan = SPI_prepare(sql_key.c_str(), arg_count, arg_types.data());
-    if (!plan) throw std::runtime_error("SPI_prepare MQO failed.");
+SPIPlanPtr Planner::PrepareSetOriented(const mqo::BatchPayload& payload) {
+    if (payload.rows_size() == 0) return NULL;
+    uint64_t plan_key = PlanKey(payload);
+
+    if (set_plan_cache_.size() >= MAX_PLAN_CACHE_SIZE) FlushPlanCache(set_plan_cache_);
+
+    auto it = set_plan_cache_.find(plan_key);
+    if (it != set_plan_cache_.end()) {
+        if (it->second == NULL || SPI_plan_is_valid(it->second)) return it->second;
+        SPI_freeplan(it->second);
+        set_plan_cache_.erase(it);
+    }
+
+    std::vector<Oid> arg_types = ResolveArgTypes(payload);
+    std::string rewritten;
+    Oid array_type = arg_types.size() == 1 ? get_array_type(arg_types[0]) : InvalidOid;
+    if (array_type == InvalidOid || !RewriteSetOriented(ResolveSQL(payload), rewritten)) {
+        set_plan_cache_[plan_key] = NULL;
+        return NULL;
+    }
+
+    SPIPlanPtr plan = SPI_prepare(rewritten.c_str(), 1, &array_type);
+    if (!plan) throw std::runtime_error("SPI_prepare set-oriented failed.");
 
+    elog(DEBUG1, "[Lumos] Set-oriented rewrite: %s", rewritten.c_str());
     if (SPI_keepplan(plan) == 0) {
-        plan_cache_[sql_key] = plan;
+        set_plan_cache_[plan_key] = plan;
     }
     return plan;
 }
\ No newline at end of file
@@ -0,0 +1,627 @@
+#include "exec/predicate_index.hpp"
+
+extern "C" {
+#include "access/nbtree.h"
+#include "catalog/pg_proc.h"
+#include "catalog/pg_type.h"
+#include "executor/executor.h"
+#include "mb/pg_wchar.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/clauses.h"
+#include "optimizer/optimizer.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/datum.h"
+#include "utils/fmgroids.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/typcache.h"
+}
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <utility>
+
+static Node* StripRelabel(Node* node) {
+    while (node != NULL && IsA(node, RelabelType)) node = (Node*)((RelabelType*)node)->arg;
+    return node;
+}
+
+static bool ExternParam(Node* node, int& out) {
+    node = StripRelabel(node);
+    if (node == NULL || !IsA(node, Param) || ((Param*)node)->paramkind != PARAM_EXTERN) return false;
+    out = ((Param*)node)->paramid - 1;
+    return true;
+}
+
+// Column of the template's single relation.
+static bool ScanColumn(Node* node) {
+    return node != NULL && IsA(node, Var) && ((Var*)node)->varno == 1 && ((Var*)node)->varlevelsup == 0 &&
+           ((Var*)node)->varattno > 0;
+}
+
+// A scan column, bare or under the implicit cast the parser adds to compare it with another type
+// (`float8(numeric_col) = $1`). The cast must be immutable and strict: evaluated once per tuple, NULL stays NULL.
+static bool ColumnExpr(Node* node, AttrNumber& att, Oid& cast_fn, Oid& cast_collation) {
+    node = StripRelabel(node);
+    if (ScanColumn(node)) {
+        att = ((Var*)node)->varattno;
+        cast_fn = InvalidOid;
+        cast_collation = InvalidOid;
+        return true;
+    }
+    if (node == NULL || !IsA(node, FuncExpr)) return false;
+    FuncExpr* func = (FuncExpr*)node;
+    if (func->funcformat != COERCE_IMPLICIT_CAST || func->funcretset || list_length(func->args) != 1) return false;
+    Node* arg = StripRelabel(static_cast<Node*>(linitial(func->args)));
+    if (!ScanColumn(arg) || func_volatile(func->funcid) != PROVOLATILE_IMMUTABLE || !func_strict(func->funcid)) {
+        return false;
+    }
+    att = ((Var*)arg)->varattno;
+    cast_fn = func->funcid;
+    cast_collation = func->inputcollid;
+    return true;
+}
+
+// Evaluable once per request: no column, nothing volatile, no sub-select.
+static bool RequestOperand(Node* node) {
+    return node != NULL && !contain_var_clause(node) && !contain_volatile_functions(node) && !contain_subplans(node);
+}
+
+static bool ReadsExternParam(Node* node, void* context) {
+    if (node == NULL) return false;
+    if (IsA(node, Param)) return ((Param*)node)->paramkind == PARAM_EXTERN;
+#if PG_VERSION_NUM >= 160000
+    return expression_tree_walker(node, ReadsExternParam, context);
+#else
+    return expression_tree_walker(node, reinterpret_cast<bool (*)()>(ReadsExternParam), context);
+#endif
+}
+
+static bool IntegerType(Oid type_id) {
+    return type_id == INT2OID || type_id == INT4OID || type_id == INT8OID;
+}
+
+static bool FloatType(Oid type_id) {
+    return type_id == FLOAT4OID || type_id == FLOAT8OID;
+}
+
+// Operand types PredicateIndex::ToColumnType brings into the column type: the cross-type members of the
+// integer and float btree opfamilies (the proxy sends every integer as int8, every real as float8).
+static bool Convertible(Oid from, Oid to) {
+    return from == to || (IntegerType(from) && IntegerType(to)) || (FloatType(from) && FloatType(to));
+}
+
+// Strategy of opno in the btree opfamily of the column type's default opclass, 0 unless the column side is
+// the opclass type and the other input converts to it. Commuted: the column is the right input.
+static int OperatorStrategy(Oid opno, Oid column_type, bool commuted, Oid& opintype, Oid& param_type) {
+    TypeCacheEntry* typentry = lookup_type_cache(column_type, TYPECACHE_BTREE_OPFAMILY);
+    if (!OidIsValid(typentry->btree_opf)) return 0;
+    Oid left, right;
+    op_input_types(opno, &left, &right);
+    if (commuted) std::swap(left, right);
+    if (left != typentry->btree_opintype || !Convertible(right, left)) return 0;
+    opintype = left;
+    param_type = right;
+    int strategy = get_op_opfamily_strategy(opno, typentry->btree_opf);
+    return (commuted && strategy != 0) ? BTCommuteStrategyNumber(strategy) : strategy;
+}
+
+// PatternSet compares bytes: no character may contain another's bytes and equal means identical.
+static bool BytewiseLike(Oid collation) {
+    return (pg_database_encoding_max_length() == 1 || GetDatabaseEncoding() == PG_UTF8) &&
+           OidIsValid(collation) && get_collation_isdeterministic(collation);
+}
+
+PredicateIndex::PredicateIndex() : complete_(false), operand_context_(NULL), cast_context_(NULL) {
+}
+
+bool PredicateIndex::ParseConjunct(Node* clause, Conjunct& out) {
+    out.operands.clear();
+    out.operand_states.clear();
+    out.array_operand = false;
+    out.like = false;
+    if (!ReadsExternParam(clause, NULL)) return false; // The same for every request, left to the qual
+
+    if (IsA(clause, OpExpr)) {
+        OpExpr* op = (OpExpr*)clause;
+        if (list_length(op->args) != 2) return false;
+        Node* left = static_cast<Node*>(linitial(op->args));
+        Node* right = static_cast<Node*>(lsecond(op->args));
+
+        if (get_opcode(op->opno) == F_TEXTLIKE) {
+            if (!ColumnExpr(left, out.att, out.cast_fn, out.cast_collation) || OidIsValid(out.cast_fn) ||
+                !RequestOperand(right) || !BytewiseLike(op->inputcollid)) {
+                return false;
+            }
+            out.like = true;
+            out.strategy = 0;
+            out.type_id = TEXTOID;
+            out.param_type = TEXTOID;
+            out.collation = op->inputcollid;
+            out.operands.push_back((Expr*)right);
+            return true;
+        }
+
+        bool commuted = false;
+        if (!ColumnExpr(left, out.att, out.cast_fn, out.cast_collation)) {
+            if (!ColumnExpr(right, out.att, out.cast_fn, out.cast_collation)) return false;
+            std::swap(left, right);
+            commuted = true;
+        }
+        if (!RequestOperand(right)) return false;
+
+        out.strategy = OperatorStrategy(op->opno, exprType(left), commuted, out.type_id, out.param_type);
+        if (out.strategy == 0) return false;
+        out.collation = op->inputcollid;
+        out.operands.push_back((Expr*)right);
+        return true;
+    }
+
+    if (IsA(clause, ScalarArrayOpExpr)) {
+        ScalarArrayOpExpr* saop = (ScalarArrayOpExpr*)clause;
+        if (!saop->useOr || list_length(saop->args) != 2) return false;
+        Node* left = static_cast<Node*>(linitial(saop->args));
+        Node* right = static_cast<Node*>(lsecond(saop->args));
+        if (!ColumnExpr(left, out.att, out.cast_fn, out.cast_collation)) return false;
+        if (OperatorStrategy(saop->opno, exprType(left), false, out.type_id, out.param_type) != BTEqualStrategyNumber) {
+            return false;
+        }
+
+        Node* array = StripRelabel(right);
+        if (array != NULL && IsA(array, ArrayExpr) && !((ArrayExpr*)array)->multidims) {
+            ListCell* lc;
+            foreach (lc, ((ArrayExpr*)array)->elements) {
+                Node* element = static_cast<Node*>(lfirst(lc));
+                if (!RequestOperand(element)) return false;
+                out.operands.push_back((Expr*)element);
+            }
+        } else if (RequestOperand(right)) {
+            out.array_operand = true;
+            out.operands.push_back((Expr*)right);
+        } else {
+            return false;
+        }
+        out.strategy = BTEqualStrategyNumber;
+        out.collation = saop->inputcollid;
+        return true;
+    }
+    return false;
+}
+
+// Lossless for equal types and widening; otherwise the value's place among the column type's values.
+PredicateIndex::Fit PredicateIndex::ToColumnType(Datum value, Oid from, Oid to, Datum& out) {
+    out = value;
+    if (from == to) return FIT_EXACT;
+
+    if (to == FLOAT8OID) {
+        out = Float8GetDatum(DatumGetFloat4(value));
+        return FIT_EXACT;
+    }
+    if (to == FLOAT4OID) {
+        double v = DatumGetFloat8(value);
+        float4 f;
+        if (std::isnan(v) || std::isinf(v)) {
+            f = static_cast<float4>(v);
+        } else if (v > FLT_MAX) {
+            f = FLT_MAX;
+        } else if (v < -FLT_MAX) {
+            f = -INFINITY;
+        } else {
+            f = static_cast<float4>(v);
+        }
+        if (std::isnan(v) || static_cast<double>(f) == v) {
+            out = Float4GetDatum(f);
+            return FIT_EXACT;
+        }
+        if (static_cast<double>(f) > v) f = nextafterf(f, -INFINITY); // Rounded up, step back below v
+        out = Float4GetDatum(f);
+        return FIT_BETWEEN;
+    }
+
+    int64 v = from == INT2OID ? DatumGetInt16(value) : (from == INT4OID ? DatumGetInt32(value) : DatumGetInt64(value));
+    int64 lo = to == INT2OID ? PG_INT16_MIN : (to == INT4OID ? PG_INT32_MIN : PG_INT64_MIN);
+    int64 hi = to == INT2OID ? PG_INT16_MAX : (to == INT4OID ? PG_INT32_MAX : PG_INT64_MAX);
+    if (v < lo) return FIT_BELOW;
+    if (v > hi) return FIT_ABOVE;
+    out = to == INT2OID ? Int16GetDatum(v) : (to == INT4OID ? Int32GetDatum(v) : Int64GetDatum(v));
+    return FIT_EXACT;
+}
+
+// Operand values of a conjunct for one request in the column type, false when none is non-NULL (it can
+// never hold). Evaluated during Build; by-reference values are copied out of the per-request memory.
+bool PredicateIndex::OperandValues(const Conjunct& conj, ParamListInfo params, std::vector<Operand>& out) {
+    out.clear();
+    ResetExprContext(operand_context_);
+    operand_context_->ecxt_param_list_info = params;
+    for (size_t i = 0; i < conj.operands.size(); ++i) {
+        Datum value;
+        bool isnull;
+        int n;
+        if (conj.operand_states[i] == NULL && ExternParam((Node*)conj.operands[i], n)) {
+            isnull = n >= params->numParams || params->params[n].isnull;
+            value = isnull ? (Datum)0 : params->params[n].value;
+        } else {
+            value = ExecEvalExprSwitchContext(conj.operand_states[i], operand_context_, &isnull);
+        }
+        if (isnull) continue;
+        if (!conj.array_operand) {
+            AddOperand(conj, value, out);
+            continue;
+        }
+
+        ArrayType* arr = DatumGetArrayTypeP(value);
+        int16 typlen;
+        bool typbyval;
+        char typalign;
+        get_typlenbyvalalign(ARR_ELEMTYPE(arr), &typlen, &typbyval, &typalign);
+        Datum* elems;
+        bool* nulls;
+        int nelems;
+        deconstruct_array(arr, ARR_ELEMTYPE(arr), typlen, typbyval, typalign, &elems, &nulls, &nelems);
+        for (int e = 0; e < nelems; ++e) {
+            if (!nulls[e]) AddOperand(conj, elems[e], out);
+        }
+    }
+    operand_context_->ecxt_param_list_info = NULL;
+    return !out.empty();
+}
+
+void PredicateIndex::AddOperand(const Conjunct& conj, Datum value, std::vector<Operand>& out) {
+    Operand operand;
+    operand.fit = ToColumnType(value, conj.param_type, conj.type_id, operand.value);
+    bool held = operand.fit == FIT_EXACT || operand.fit == FIT_BETWEEN;
+    if (held && !conj.typbyval) operand.value = datumCopy(operand.value, false, conj.typlen);
+    out.push_back(operand);
+}
+
+bool PredicateIndex::Build(Expr* quals, const std::vector<ParamListInfo>& requests) {
+    columns_.clear();
+    List* clauses = make_ands_implicit(quals);
+
+    std::vector<Conjunct> conjs;
+    ListCell* lc;
+    foreach (lc, clauses) {
+        Conjunct conj;
+        if (!ParseConjunct(static_cast<Node*>(lfirst(lc)), conj)) continue;
+        get_typlenbyval(conj.type_id, &conj.typlen, &conj.typbyval);
+        for (Expr* operand : conj.operands) {
+            int n;
+            bool bare = ExternParam((Node*)operand, n);
+            conj.operand_states.push_back(bare ? NULL : ExecInitExpr(expression_planner(operand), NULL));
+        }
+        conjs.push_back(conj);
+    }
+    operand_context_ = CreateStandaloneExprContext();
+
+    // Conjuncts on one column (and cast) under one collation share its structure. Equality wins: with
+    // `col = $1 AND col < $2` only the equality is indexed, the range stays in the qual.
+    int indexed = 0;
+    std::vector<bool> grouped(conjs.size(), false);
+    for (size_t i = 0; i < conjs.size(); ++i) {
+        if (grouped[i]) continue;
+        const Conjunct* equality = NULL;
+        std::vector<const Conjunct*> ranges;
+        for (size_t j = i; j < conjs.size(); ++j) {
+            if (conjs[j].att != conjs[i].att || conjs[j].collation != conjs[i].collation ||
+                conjs[j].like != conjs[i].like || conjs[j].cast_fn != conjs[i].cast_fn) {
+                continue;
+            }
+            grouped[j] = true;
+            if (conjs[j].like) {
+                if (equality == NULL) equality = &conjs[j]; // Further LIKEs stay in the qual
+            } else if (conjs[j].strategy != BTEqualStrategyNumber) {
+                ranges.push_back(&conjs[j]);
+            } else if (equality == NULL) {
+                equality = &conjs[j];
+            }
+        }
+
+        IndexedColumn col;
+        col.att = conjs[i].att;
+        col.type_id = conjs[i].type_id;
+        col.collation = conjs[i].collation;
+        col.cast_fn = conjs[i].cast_fn;
+        col.cast_collation = conjs[i].cast_collation;
+        if (OidIsValid(col.cast_fn)) {
+            fmgr_info(col.cast_fn, &col.cast);
+            if (cast_context_ == NULL) {
+                cast_context_ = AllocSetContextCreate(CurrentMemoryContext, "LumosPredicateCasts", ALLOCSET_SMALL_SIZES);
+            }
+        }
+        if (conjs[i].like) {
+            if (AddPatterns(col, *equality, requests)) indexed++;
+            columns_.push_back(std::move(col));
+            continue;
+        }
+
+        TypeCacheEntry* typentry = lookup_type_cache(conjs[i].type_id, TYPECACHE_CMP_PROC_FINFO);
+        if (!OidIsValid(typentry->cmp_proc_finfo.fn_oid)) continue;
+        fmgr_info_copy(&col.cmp, &typentry->cmp_proc_finfo, CurrentMemoryContext);
+        if (equality != NULL) {
+            AddEquality(col, *equality, requests);
+            indexed++;
+        } else {
+            AddRanges(col, ranges, requests);
+            indexed += ranges.size();
+        }
+        BuildTree(col);
+        columns_.push_back(std::move(col));
+    }
+    FreeExprContext(operand_context_, true);
+    operand_context_ = NULL;
+
+    std::stable_partition(columns_.begin(), columns_.end(),
+                          [](const IndexedColumn& col) { return col.keys != nullptr; });
+    complete_ = (indexed == list_length(clauses));
+    bits_.assign((requests.size() + 63) / 64, 0);
+    return !columns_.empty();
+}
+
+void PredicateIndex::AddEquality(IndexedColumn& col, const Conjunct& conj, const std::vector<ParamListInfo>& requests) {
+    // Unhashable types (no hash opclass) get one point interval per value instead.
+    bool hashable = OidIsValid(lookup_type_cache(conj.type_id, TYPECACHE_HASH_PROC)->hash_proc);
+    if (hashable) col.keys.reset(new DatumKeySet(conj.type_id, conj.collation, requests.size()));
+
+    std::vector<Operand> values;
+    for (size_t r = 0; r < requests.size(); ++r) {
+        if (requests[r] == NULL || !OperandValues(conj, requests[r], values)) continue;
+        for (const Operand& operand : values) {
+            if (operand.fit != FIT_EXACT) continue; // No column value equals it
+            Datum value = operand.value;
+            if (!hashable) {
+                col.intervals.push_back({static_cast<int>(r), true, true, true, true, value, value});
+                continue;
+            }
+            size_t k = col.keys->Insert(value);
+            if (k >= col.key_requests.size()) col.key_requests.resize(k + 1);
+            std::vector<int>& list = col.key_requests[k];
+            if (list.empty() || list.back() != static_cast<int>(r)) list.push_back(r);
+        }
+    }
+}
+
+// True when every pattern went into the automaton, i.e. the conjunct is fully indexed.
+bool PredicateIndex::AddPatterns(IndexedColumn& col, const Conjunct& conj, const std::vector<ParamListInfo>& requests) {
+    col.patterns.reset(new PatternSet());
+    std::vector<Operand> values;
+    for (size_t r = 0; r < requests.size(); ++r) {
+        if (requests[r] == NULL || !OperandValues(conj, requests[r], values)) continue;
+        text* pattern = DatumGetTextPP(values[0].value);
+        int k = col.patterns->Insert(VARDATA_ANY(pattern), VARSIZE_ANY_EXHDR(pattern));
+        if (k < 0) {
+            col.unindexed_requests.push_back(r);
+            continue;
+        }
+        if (k >= static_cast<int>(col.pattern_requests.size())) col.pattern_requests.resize(k + 1);
+        col.pattern_requests[k].push_back(r);
+    }
+    col.patterns->Build();
+    return col.unindexed_requests.empty();
+}
+
+void PredicateIndex::AddRanges(IndexedColumn& col,
+                               const std::vector<const Conjunct*>& conjs,
+                               const std::vector<ParamListInfo>& requests) {
+    std::vector<Operand> values;
+    for (size_t r = 0; r < requests.size(); ++r) {
+        if (requests[r] == NULL) continue;
+
+        Interval iv = {static_cast<int>(r), false, false, false, false, (Datum)0, (Datum)0};
+        bool live = true;
+        for (const Conjunct* conj : conjs) {
+            if (!OperandValues(*conj, requests[r], values)) {
+                live = false;
+                break;
+            }
+            bool lower = conj->strategy == BTGreaterStrategyNumber || conj->strategy == BTGreaterEqualStrategyNumber;
+            bool inclusive = conj->strategy == BTGreaterEqualStrategyNumber || conj->strategy == BTLessEqualStrategyNumber;
+            const Operand& bound = values[0];
+            if (bound.fit == FIT_BELOW || bound.fit == FIT_ABOVE) {
+                // Past every column value: the bound holds for all of them or for none.
+                if (lower == (bound.fit == FIT_ABOVE)) {
+                    live = false;
+                    break;
+                }
+                continue;
+            }
+            // Between two column values: `col > v` is `col > below`, `col < v` is `col <= below`.
+            if (bound.fit == FIT_BETWEEN) inclusive = !lower;
+
+            // Keep the tighter bound: larger lower / smaller upper, exclusive on ties.
+            if (lower) {
+                int32 c = iv.has_lo ? Compare(col, bound.value, iv.lo) : 1;
+                if (c > 0 || (c == 0 && !inclusive)) {
+                    iv.has_lo = true;
+                    iv.lo = bound.value;
+                    iv.lo_inc = inclusive;
+                }
+            } else {
+                int32 c = iv.has_hi ? Compare(col, bound.value, iv.hi) : -1;
+                if (c < 0 || (c == 0 && !inclusive)) {
+                    iv.has_hi = true;
+                    iv.hi = bound.value;
+                    iv.hi_inc = inclusive;
+                }
+            }
+        }
+        if (!live) continue;
+
+        // Empty range: the request matches nothing.
+        if (iv.has_lo && iv.has_hi) {
+            int32 c = Compare(col, iv.lo, iv.hi);
+            if (c > 0 || (c == 0 && !(iv.lo_inc && iv.hi_inc))) continue;
+        }
+        col.intervals.push_back(iv);
+    }
+}
+
+void PredicateIndex::BuildTree(IndexedColumn& col) {
+    std::sort(col.intervals.begin(), col.intervals.end(), [&](const Interval& a, const Interval& b) {
+        if (!a.has_lo || !b.has_lo) return !a.has_lo && b.has_lo;
+        return Compare(col, a.lo, b.lo) < 0;
+    });
+    col.max_hi.assign(col.intervals.size(), 0);
+    BuildTree(col, 0, col.intervals.size());
+}
+
+// Implicit balanced tree over the sorted intervals: node = mid of [lo, hi), children its halves.
+int PredicateIndex::BuildTree(IndexedColumn& col, int lo, int hi) {
+    if (lo >= hi) return -1;
+    int mid = lo + (hi - lo) / 2;
+    int best = mid;
+    int children[2] = {BuildTree(col, lo, mid), BuildTree(col, mid + 1, hi)};
+    for (int child : children) {
+        if (child < 0 || !col.intervals[best].has_hi) continue;
+        const Interval& a = col.intervals[child];
+        const Interval& b = col.intervals[best];
+        int32 c = a.has_hi ? Compare(col, a.hi, b.hi) : 1;
+        if (c > 0 || (c == 0 && a.hi_inc && !b.hi_inc)) best = child;
+    }
+    col.max_hi[mid] = best;
+    return best;
+}
+
+// Reports every interval containing value: O(log n + hits).
+void PredicateIndex::Stab(IndexedColumn& col, Datum value, int lo, int hi) {
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (!UpperAtLeast(col, col.intervals[col.max_hi[mid]], value)) return;
+        Stab(col, value, lo, mid);
+
+        const Interval& iv = col.intervals[mid];
+        if (iv.has_lo && Compare(col, iv.lo, value) > 0) return; // The right half starts even higher
+        if (Contains(col, iv, value)) Hit(iv.request);
+        lo = mid + 1;
+    }
+}
+
+void PredicateIndex::Hit(int request) {
+    uint64 mask = UINT64CONST(1) << (request % 64);
+    if (bits_[request / 64] & mask) return;
+    bits_[request / 64] |= mask;
+    hits_.push_back(request);
+}
+
+int32 PredicateIndex::Compare(IndexedColumn& col, Datum a, Datum b) {
+    return DatumGetInt32(FunctionCall2Coll(&col.cmp, col.collation, a, b));
+}
+
+bool PredicateIndex::Contains(IndexedColumn& col, const Interval& iv, Datum value) {
+    if (iv.has_lo) {
+        int32 c = Compare(col, iv.lo, value);
+        if (c > 0 || (c == 0 && !iv.lo_inc)) return false;
+    }
+    return UpperAtLeast(col, iv, value);
+}
+
+bool PredicateIndex::UpperAtLeast(IndexedColumn& col, const Interval& iv, Datum value) {
+    if (!iv.has_hi) return true;
+    int32 c = Compare(col, iv.hi, value);
+    return c > 0 || (c == 0 && iv.hi_inc);
+}
+
+void PredicateIndex::Match(TupleTableSlot* slot, std::vector<int>& out) {
+    out.clear();
+    if (cast_context_ != NULL) MemoryContextReset(cast_context_);
+    for (size_t c = 0; c < columns_.size(); ++c) {
+        IndexedColumn& col = columns_[c];
+        bool isnull;
+        Datum value = slot_getattr(slot, col.att, &isnull);
+        if (isnull) { // No comparison holds on NULL
+            out.clear();
+            return;
+        }
+        if (OidIsValid(col.cast_fn)) {
+            MemoryContext old_ctx = MemoryContextSwitchTo(cast_context_);
+            value = FunctionCall1Coll(&col.cast, col.cast_collation, value);
+            MemoryContextSwitchTo(old_ctx);
+        }
+
+        hits_.clear();
+        if (col.patterns) {
+            text* str = DatumGetTextPP(value);
+            col.patterns->Match(VARDATA_ANY(str), VARSIZE_ANY_EXHDR(str), patterns_);
+            if ((Pointer)str != DatumGetPointer(value)) pfree(str);
+            for (int k : patterns_) {
+                for (int r : col.pattern_requests[k]) Hit(r);
+            }
+            for (int r : col.unindexed_requests) Hit(r);
+        }
+        if (col.keys) {
+            int k = col.keys->Find(value);
+            if (k >= 0) {
+                for (int r : col.key_requests[k]) Hit(r);
+            }
+        }
+        Stab(col, value, 0, col.intervals.size());
+
+        if (c == 0) {
+            out = hits_;
+        } else {
+            out.erase(std::remove_if(out.begin(), out.end(),
+                                     [&](int r) { return !(bits_[r / 64] & (UINT64CONST(1) << (r % 64))); }),
+                      out.end());
+        }
+        for (int r : hits_) bits_[r / 64] &= ~(UINT64CONST(1) << (r % 64));
+        if (out.empty()) return;
+    }
+    std::sort(out.begin(), out.end());
+}
+
+bool PredicateIndex::Complete() const {
+    return complete_;
+}
+
+const DatumKeySet* PredicateIndex::EqualityKeys(AttrNumber att, Oid collation) const {
+    for (const IndexedColumn& col : columns_) {
+        if (col.keys && !OidIsValid(col.cast_fn) && col.att == att && col.collation == collation) {
+            return col.keys.get();
+        }
+    }
+    return NULL;
+}
+
+void PredicateIndex::EqualityColumns(std::vector<AttrNumber>& out) const {
+    out.clear();
+    for (const IndexedColumn& col : columns_) {
+        if (col.keys && !OidIsValid(col.cast_fn)) out.push_back(col.att);
+    }
+}
+
+void PredicateIndex::Envelopes(std::vector<Envelope>& out) {
+    out.clear();
+    for (IndexedColumn& col : columns_) {
+        if (col.patterns || OidIsValid(col.cast_fn)) continue; // No order to bound, or not the column's
+        Envelope env = {col.att, col.type_id, col.collation, false, (Datum)0, false, (Datum)0, true};
+        if (col.keys) {
+            for (Datum key : col.keys->Keys()) Widen(col, env, true, key, true, key);
+        }
+        for (const Interval& iv : col.intervals) Widen(col, env, iv.has_lo, iv.lo, iv.has_hi, iv.hi);
+        out.push_back(env);
+    }
+}
+
+// Bounds are kept inclusive: the envelope may be a little loose, never too tight.
+void PredicateIndex::Widen(IndexedColumn& col, Envelope& env, bool has_lo, Datum lo, bool has_hi, Datum hi) {
+    if (env.empty) {
+        env.has_lo = has_lo;
+        env.lo = lo;
+        env.has_hi = has_hi;
+        env.hi = hi;
+        env.empty = false;
+        return;
+    }
+    if (!has_lo) {
+        env.has_lo = false;
+    } else if (env.has_lo && Compare(col, lo, env.lo) < 0) {
+        env.lo = lo;
+    }
+    if (!has_hi) {
+        env.has_hi = false;
+    } else if (env.has_hi && Compare(col, hi, env.hi) > 0) {
+        env.hi = hi;
+    }
+}
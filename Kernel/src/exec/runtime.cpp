@@ -1,17 +1,447 @@
 #include "exec/runtime.hpp"
+#include "exec/column_cache.hpp"
+#include "exec/coop_scan.hpp"
+#include "exec/scan_batch.hpp"
+#include "exec/shared_agg.hpp"
+#include "exec/shared_scan.hpp"
 #include "exec/type_mapper.hpp"
 
+#include "ipc/worker_pool.hpp"
+
+extern "C" {
+#include "access/genam.h"
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/parallel.h"
+#include "access/stratnum.h"
+#include "access/relscan.h"
+#include "catalog/pg_am.h"
+#include "catalog/pg_index.h"
+#include "catalog/pg_proc.h"
+#include "executor/executor.h"
+#include "miscadmin.h"
+#include "nodes/nodeFuncs.h"
+#include "nodes/tidbitmap.h"
+#include "optimizer/cost.h"
+#include "optimizer/optimizer.h"
+#include "parser/parse_coerce.h"
+#include "port/atomics.h"
+#include "storage/bufmgr.h"
+#include "storage/proc.h"
+#include "storage/shm_mq.h"
+#include "tcop/dest.h"
+#include "utils/array.h"
+#include "utils/plancache.h"
+#include "utils/spccache.h"
+#include "utils/typcache.h"
+#include "utils/wait_event.h"
+}
+
 #include "pg_under_macro.hpp"
 #include "mqo.pb.h"
 #include "pg_redef_macro.hpp"
 
 #include <malloc.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <sstream>
+
+#define MQO_PARALLEL_KEY_PAYLOAD 1
+#define MQO_PARALLEL_KEY_SHARED 2
+#define MQO_PARALLEL_CHUNK_ROWS 16
+#define MQO_PARALLEL_KEY_SCAN 3
+#define MQO_PARALLEL_KEY_QUEUES 4
+#define MQO_PARALLEL_QUEUE_SIZE 65536
+#define MQO_PARALLEL_RESULT_ROWS 256 // Routed rows per worker message
+
+// Above this fraction of reltuples, random heap fetches lose to one sequential scan.
+const double SHARED_SCAN_INDEX_MAX_FRACTION = 0.2;
+// Smaller relations are not worth the worker startup (8 MB at the default block size).
+const BlockNumber SHARED_SCAN_PARALLEL_MIN_BLOCKS = 1024;
+// Index probes whose TIDs are sorted and prefetched together.
+const size_t SHARED_INDEX_FETCH_BATCH = 1024;
+// From this many keys (IN lists of a batch) their TIDs outgrow one fetch batch: bitmap union instead.
+const size_t SHARED_SCAN_BITMAP_MIN_KEYS = 64;
+
+// Parallel batch state in the ParallelContext DSM
+struct ParallelBatchShared {
+    Size payload_len;
+    pg_atomic_uint32 next_row; // Shared cursor, participants claim MQO_PARALLEL_CHUNK_ROWS at a time
+    pg_atomic_uint32 success_count;
+};
+
+static bool HasExternParam(Node* node, void* context) {
+    if (node == NULL) return false;
+    if (IsA(node, Param)) return castNode(Param, node)->paramkind == PARAM_EXTERN;
+#if PG_VERSION_NUM >= 160000
+    return expression_tree_walker(node, HasExternParam, context);
+#else
+    return expression_tree_walker(node, reinterpret_cast<bool (*)()>(HasExternParam), context);
+#endif
+}
+
+static bool ExprsReadExternParam(std::initializer_list<const void*> exprs) {
+    for (const void* expr : exprs) {
+        if (HasExternParam(static_cast<Node*>(const_cast<void*>(expr)), NULL)) return true;
+    }
+    return false;
+}
+
+// The node's own expressions reference a $n (children, init plans and subplans are walked separately).
+// Plans carry no record of PARAM_EXTERN uses; node types not listed are assumed to read one.
+static bool ReadsExternParam(Plan* plan) {
+    if (ExprsReadExternParam({plan->targetlist, plan->qual})) return true;
+    switch (nodeTag(plan)) {
+        case T_SeqScan:
+        case T_SubqueryScan:
+        case T_CteScan:
+        case T_WorkTableScan:
+        case T_NamedTuplestoreScan:
+        case T_Material:
+        case T_Sort:
+        case T_IncrementalSort:
+        case T_Group:
+        case T_Agg:
+        case T_Unique:
+        case T_SetOp:
+        case T_LockRows:
+        case T_Append:
+        case T_MergeAppend:
+        case T_RecursiveUnion:
+        case T_BitmapAnd:
+        case T_BitmapOr:
+        case T_ProjectSet:
+        case T_Gather:
+        case T_GatherMerge:
+            return false;
+        case T_SampleScan:
+            return ExprsReadExternParam({castNode(SampleScan, plan)->tablesample});
+        case T_IndexScan: {
+            IndexScan* scan = castNode(IndexScan, plan);
+            return ExprsReadExternParam({scan->indexqual, scan->indexorderby});
+        }
+        case T_IndexOnlyScan: {
+            IndexOnlyScan* scan = castNode(IndexOnlyScan, plan);
+            return ExprsReadExternParam({scan->indexqual, scan->recheckqual, scan->indexorderby});
+        }
+        case T_BitmapIndexScan:
+            return ExprsReadExternParam({castNode(BitmapIndexScan, plan)->indexqual});
+        case T_BitmapHeapScan:
+            return ExprsReadExternParam({castNode(BitmapHeapScan, plan)->bitmapqualorig});
+        case T_TidScan:
+            return ExprsReadExternParam({castNode(TidScan, plan)->tidquals});
+        case T_TidRangeScan:
+            return ExprsReadExternParam({castNode(TidRangeScan, plan)->tidrangequals});
+        case T_FunctionScan:
+            return ExprsReadExternParam({castNode(FunctionScan, plan)->functions});
+        case T_TableFuncScan:
+            return ExprsReadExternParam({castNode(TableFuncScan, plan)->tablefunc});
+        case T_ValuesScan:
+            return ExprsReadExternParam({castNode(ValuesScan, plan)->values_lists});
+        case T_ForeignScan: {
+            ForeignScan* scan = castNode(ForeignScan, plan);
+            return ExprsReadExternParam({scan->fdw_exprs, scan->fdw_recheck_quals});
+        }
+        case T_CustomScan:
+            return ExprsReadExternParam({castNode(CustomScan, plan)->custom_exprs});
+        case T_NestLoop:
+            return ExprsReadExternParam({castNode(NestLoop, plan)->join.joinqual});
+        case T_MergeJoin: {
+            MergeJoin* join = castNode(MergeJoin, plan);
+            return ExprsReadExternParam({join->join.joinqual, join->mergeclauses});
+        }
+        case T_HashJoin: {
+            HashJoin* join = castNode(HashJoin, plan);
+            return ExprsReadExternParam({join->join.joinqual, join->hashclauses, join->hashkeys});
+        }
+        case T_Hash:
+            return ExprsReadExternParam({castNode(Hash, plan)->hashkeys});
+        case T_Result:
+            return ExprsReadExternParam({castNode(Result, plan)->resconstantqual});
+        case T_Limit: {
+            Limit* limit = castNode(Limit, plan);
+            return ExprsReadExternParam({limit->limitOffset, limit->limitCount});
+        }
+        case T_WindowAgg: {
+            WindowAgg* agg = castNode(WindowAgg, plan);
+            return ExprsReadExternParam({agg->startOffset, agg->endOffset, agg->runCondition});
+        }
+        case T_Memoize:
+            return ExprsReadExternParam({castNode(Memoize, plan)->param_exprs});
+        default:
+            return true;
+    }
+}
 
-MemoryContext Runtime::mqo_session_context_ = NULL;
+struct RescanCollector {
+    bool all; // Volatile template: every node recomputes
+    bool dirty; // Out: the walked node's subtree reads a $n
+    std::vector<PlanState*>* nodes;
+};
 
-Runtime::Runtime() {
+// [Shared Operator Injection] planstate_tree_walker callback: collects, children first, the nodes whose
+// subtree (init plans and subplans included) reads a $n. Only those are rescanned per row; the others keep
+// their state for the whole batch in the query context, so a hash join whose build side does not depend
+// on the row reuses its hash table, and Sort/Material/Memoize over constant inputs are rewound, not rebuilt.
+static bool CollectRescanNodes(PlanState* node, void* context) {
+    if (node == NULL) return false;
+    RescanCollector* parent = static_cast<RescanCollector*>(context);
+    RescanCollector child = {parent->all, false, parent->nodes};
+#if PG_VERSION_NUM >= 160000
+    planstate_tree_walker(node, CollectRescanNodes, &child);
+#else
+    planstate_tree_walker(node, reinterpret_cast<bool (*)()>(CollectRescanNodes), &child);
+#endif
+    if (!child.dirty) child.dirty = child.all || ReadsExternParam(node->plan);
+    if (child.dirty) parent->nodes->push_back(node);
+    parent->dirty |= child.dirty;
+    return false;
+}
+
+// Flag the collected nodes, and their init plans that read a $n, so the next ExecProcNode rebuilds
+// their state instead of rewinding it. Sentinel is an unused PARAM_EXEC id.
+static void MarkRescanNeeded(const std::vector<PlanState*>& nodes, int sentinel) {
+    // Children come first: an init plan's own flag is set before its parent looks at it.
+    for (PlanState* node : nodes) {
+        node->chgParam = bms_add_member(node->chgParam, sentinel);
+
+        // Init plans only track PARAM_EXEC deps, $n changes would leave their outputs stale.
+        ListCell* lc;
+        foreach (lc, node->initPlan) {
+            SubPlanState* sstate = static_cast<SubPlanState*>(lfirst(lc));
+            if (!bms_is_member(sentinel, sstate->planstate->chgParam)) continue;
+            ListCell* pl;
+            foreach (pl, sstate->subplan->setParam) {
+                int paramid = lfirst_int(pl);
+                if (sstate->subplan->subLinkType != CTE_SUBLINK) {
+                    node->state->es_param_exec_vals[paramid].execPlan = sstate;
+                }
+                node->chgParam = bms_add_member(node->chgParam, paramid);
+            }
+        }
+    }
+}
+
+// Initial partition pruning runs once in ExecutorStart with the first row's params.
+static bool HasRuntimePruning(PlanState* node, void* context) {
+    if (node == NULL) return false;
+    if (IsA(node, AppendState) && castNode(AppendState, node)->as_prune_state != NULL) return true;
+    if (IsA(node, MergeAppendState) && castNode(MergeAppendState, node)->ms_prune_state != NULL) return true;
+#if PG_VERSION_NUM >= 160000
+    return planstate_tree_walker(node, HasRuntimePruning, context);
+#else
+    return planstate_tree_walker(node, reinterpret_cast<bool (*)()>(HasRuntimePruning), context);
+#endif
+}
+
+// Worker -> leader: one serialized BatchResult per message.
+static void SendScanResult(shm_mq_handle* queue, mqo::BatchResult& part) {
+    if (part.results_size() == 0) return;
+    std::string bytes;
+    part.SerializeToString(&bytes);
+#if PG_VERSION_NUM >= 150000
+    shm_mq_result res = shm_mq_send(queue, bytes.size(), bytes.data(), false, true);
+#else
+    shm_mq_result res = shm_mq_send(queue, bytes.size(), bytes.data(), false);
+#endif
+    if (res != SHM_MQ_SUCCESS) elog(ERROR, "LumosKernel: shared scan leader detached from the result queue.");
+    part.Clear();
+}
+
+// Appends every message waiting in the worker queues to result. With wait, blocks until every
+// worker has detached. Returns whether any queue is still attached.
+static bool DrainScanQueues(std::vector<shm_mq_handle*>& queues, mqo::BatchResult* result, bool wait) {
+    while (true) {
+        bool attached = false;
+        bool received = false;
+        for (auto& queue : queues) {
+            if (queue == NULL) continue;
+            Size nbytes;
+            void* data;
+            shm_mq_result res = shm_mq_receive(queue, &nbytes, &data, true);
+            if (res == SHM_MQ_SUCCESS) {
+                mqo::BatchResult part;
+                if (!part.ParseFromArray(data, nbytes)) elog(ERROR, "LumosKernel: Protobuf parsing failed.");
+                result->MergeFrom(part);
+                received = true;
+                attached = true;
+            } else if (res == SHM_MQ_DETACHED) {
+                shm_mq_detach(queue);
+                queue = NULL;
+            } else {
+                attached = true;
+            }
+        }
+        if (!attached || !wait) return attached;
+        if (!received) {
+            (void)WaitLatch(MyLatch, WL_LATCH_SET | WL_EXIT_ON_PM_DEATH, 0, PG_WAIT_EXTENSION);
+            ResetLatch(MyLatch);
+        }
+        CHECK_FOR_INTERRUPTS();
+    }
+}
+
+Runtime::Runtime()
+    : mqo_session_context_(NULL), window_snapshot_(NULL), window_failed_(false), stream_owner_(NULL) {
 }
 Runtime::~Runtime() {
+    if (mqo_session_context_ != NULL) MemoryContextDelete(mqo_session_context_);
+}
+
+void Runtime::InvalidateRelation(Oid relid) {
+    if (relid == InvalidOid) {
+        scan_targets_.clear();
+        return;
+    }
+    for (auto it = scan_targets_.begin(); it != scan_targets_.end();) {
+        if (it->second.table_oid == relid) {
+            it = scan_targets_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void Runtime::ResetSessionContext() {
+    if (mqo_session_context_ != NULL) MemoryContextReset(mqo_session_context_);
+}
+
+void Runtime::BeginWindow() {
+    BeginInternalSubTransaction(NULL);
+    window_snapshot_ = RegisterSnapshot(GetTransactionSnapshot());
+    window_failed_ = false;
+    // The active copy is the one whose command id moves between batches.
+    PushCopiedSnapshot(window_snapshot_);
+}
+
+void Runtime::BeginWindowBatch(bool isolated) {
+    // Earlier batches' writes become visible to this one, its own scans included.
+    CommandCounterIncrement();
+    UpdateActiveSnapshotCommandId();
+    if (!isolated) return;
+
+    MemoryContext old_ctx = CurrentMemoryContext;
+    ResourceOwner old_owner = CurrentResourceOwner;
+    BeginInternalSubTransaction(NULL);
+    MemoryContextSwitchTo(old_ctx);
+    CurrentResourceOwner = old_owner;
+}
+
+void Runtime::EndWindowBatch(bool isolated) {
+    if (!isolated) return;
+    MemoryContext old_ctx = CurrentMemoryContext;
+    RollbackAndReleaseCurrentSubTransaction();
+    MemoryContextSwitchTo(old_ctx);
+}
+
+bool Runtime::EndWindow(bool commit) {
+    bool committed = commit && !window_failed_;
+    PopActiveSnapshot();
+    UnregisterSnapshot(window_snapshot_);
+    window_snapshot_ = NULL;
+    if (committed) {
+        ReleaseCurrentSubTransaction();
+    } else {
+        RollbackAndReleaseCurrentSubTransaction();
+    }
+    return committed;
+}
+
+void Runtime::ResetWindow() {
+    // Abort already released the sub-transaction and the snapshot's resource owner.
+    window_snapshot_ = NULL;
+    window_failed_ = false;
+    stream_owner_ = NULL;
+}
+
+void Runtime::BeginStream() {
+    // The sub-transaction outlives this statement: the statement keeps its own memory context and owner.
+    MemoryContext old_ctx = CurrentMemoryContext;
+    ResourceOwner old_owner = CurrentResourceOwner;
+    BeginInternalSubTransaction(NULL);
+    stream_owner_ = CurrentResourceOwner;
+    window_snapshot_ = RegisterSnapshotOnOwner(GetTransactionSnapshot(), stream_owner_);
+    window_failed_ = false;
+    MemoryContextSwitchTo(old_ctx);
+    CurrentResourceOwner = old_owner;
+}
+
+void Runtime::BeginStreamChunk(bool isolated) {
+    PushCopiedSnapshot(window_snapshot_);
+    BeginWindowBatch(isolated);
+}
+
+void Runtime::EndStreamChunk(bool isolated) {
+    EndWindowBatch(isolated);
+    PopActiveSnapshot();
+}
+
+bool Runtime::EndStream() {
+    // A failed stream is left to the error: rolling the sub-transaction back here would fail this
+    // statement's own portal, which was created inside it.
+    if (window_failed_) return false;
+    UnregisterSnapshotFromOwner(window_snapshot_, stream_owner_);
+    window_snapshot_ = NULL;
+    stream_owner_ = NULL;
+
+    MemoryContext old_ctx = CurrentMemoryContext;
+    ResourceOwner old_owner = CurrentResourceOwner;
+    ReleaseCurrentSubTransaction();
+    MemoryContextSwitchTo(old_ctx);
+    CurrentResourceOwner = old_owner;
+    return true;
+}
+
+bool Runtime::InWindow() const {
+    return window_snapshot_ != NULL;
+}
+
+// Inside a window: the active copy of the window snapshot, advanced to the current command by BeginWindowBatch.
+Snapshot Runtime::ScanSnapshot() {
+    return window_snapshot_ != NULL ? GetActiveSnapshot() : GetTransactionSnapshot();
+}
+
+int Runtime::ExecutePlan(SPIPlanPtr plan, Datum* values, const char* nulls, bool read_only) {
+    // SPI copies the window snapshot and only advances its command id, earlier batches' writes stay visible.
+    if (window_snapshot_ != NULL) {
+        return SPI_execute_snapshot(plan, values, nulls, ScanSnapshot(), InvalidSnapshot, read_only, true, 0);
+    }
+    return SPI_execute_plan(plan, values, nulls, read_only, 0);
+}
+
+bool Runtime::LookupScanTarget(const std::string& table_name, const std::string& col_name, ScanTarget& out) {
+    std::string key = table_name + "." + col_name;
+    auto it = scan_targets_.find(key);
+    if (it != scan_targets_.end()) {
+        out = it->second;
+        return true;
+    }
+
+    Oid table_oid = InvalidOid;
+    try {
+        table_oid = DatumGetObjectId(DirectFunctionCall1(regclassin, CStringGetDatum(table_name.c_str())));
+    } catch (...) {
+        elog(WARNING, "SharedScan: Table '%s' not found.", table_name.c_str());
+        return false;
+    }
+
+    AttrNumber att_num = get_attnum(table_oid, col_name.c_str());
+    if (att_num == InvalidAttrNumber) {
+        elog(WARNING, "SharedScan: Column '%s' not found.", col_name.c_str());
+        return false;
+    }
+
+    out.table_oid = table_oid;
+    out.att_num = att_num;
+    int32 typmod;
+    get_atttypetypmodcoll(table_oid, att_num, &out.type_id, &typmod, &out.collation);
+    get_typlenbyval(out.type_id, &out.typlen, &out.typbyval);
+    scan_targets_[key] = out;
+    return true;
 }
 
 int Runtime::ExecuteSPILoop(SPIPlanPtr plan, const mqo::BatchPayload& payload) {
@@ -27,7 +457,7 @@ int Runtime::ExecuteSPILoop(SPIPlanPtr plan, const mqo::BatchPayload& payload) {
             values[i] = p.value;
             nulls[i] = p.null_flag;
         }
-        int ret = SPI_execute_plan(plan, values.data(), nulls.data(), false, 0);
+        int ret = ExecutePlan(plan, values.data(), nulls.data(), false);
         if (ret >= 0) {
             success_count++;
             SPI_freetuptable(SPI_tuptable);
@@ -36,8 +466,27 @@ int Runtime::ExecuteSPILoop(SPIPlanPtr plan, const mqo::BatchPayload& payload) {
     return success_count;
 }
 
-int Runtime::ExecuteBatchMQO(SPIPlanPtr plan, const mqo::BatchPayload& payload) {
-    if (plan == NULL || payload.rows_size() == 0) return 0;
+// First row of the last SPI execution, in target-list order.
+static void AppendFirstRow(mqo::ParamRow* out) {
+    if (SPI_tuptable == NULL || SPI_processed == 0) return;
+    TupleDesc desc = SPI_tuptable->tupdesc;
+    HeapTuple tuple = SPI_tuptable->vals[0];
+    for (int i = 0; i < desc->natts; ++i) {
+        bool isnull;
+        Datum value = SPI_getbinval(tuple, desc, i + 1, &isnull);
+        TypeMapper::FromDatum(value, isnull, TupleDescAttr(desc, i)->atttypid, out->add_values());
+    }
+}
+
+int Runtime::ExecuteBatchMQO(SPIPlanPtr plan, const mqo::BatchPayload& payload, mqo::BatchResult* result) {
+    return ExecuteBatchMQO(plan, payload.rows(), payload.dry_run(), result);
+}
+
+int Runtime::ExecuteBatchMQO(SPIPlanPtr plan,
+                             const google::protobuf::RepeatedPtrField<mqo::ParamRow>& rows,
+                             bool dry_run,
+                             mqo::BatchResult* result) {
+    if (plan == NULL || rows.empty()) return 0;
 
     int success_count = 0;
     int arg_count = SPI_getargcount(plan);
@@ -48,8 +497,12 @@ int Runtime::ExecuteBatchMQO(SPIPlanPtr plan, const mqo::BatchPayload& payload)
     std::vector<Datum> values(arg_count);
     std::vector<char> nulls(arg_count);
 
-    BeginInternalSubTransaction(NULL);
-    PushActiveSnapshot(GetTransactionSnapshot());
+    // Inside a window the window's sub-transaction and snapshot cover this batch.
+    bool in_window = InWindow();
+    if (!in_window) {
+        BeginInternalSubTransaction(NULL);
+        PushActiveSnapshot(GetTransactionSnapshot());
+    }
 
     if (mqo_session_context_ == NULL) {
         mqo_session_context_ = AllocSetContextCreate(TopMemoryContext, "LumosSessionContext", ALLOCSET_DEFAULT_SIZES);
@@ -62,7 +515,9 @@ int Runtime::ExecuteBatchMQO(SPIPlanPtr plan, const mqo::BatchPayload& payload)
     bool error_occurred = false;
 
     try {
-        for (const auto& row : payload.rows()) {
+        for (const auto& row : rows) {
+            // Malformed rows still get their (empty) result row, results stay aligned with the requests.
+            mqo::ParamRow* out = result != NULL ? result->add_results() : NULL;
             if (row.values_size() != arg_count) continue;
 
             old_ctx = MemoryContextSwitchTo(mqo_session_context_);
@@ -73,10 +528,11 @@ int Runtime::ExecuteBatchMQO(SPIPlanPtr plan, const mqo::BatchPayload& payload)
                 nulls[i] = p.null_flag;
             }
 
-            int ret = SPI_execute_plan(plan, values.data(), nulls.data(), read_only_mode, 0);
+            int ret = ExecutePlan(plan, values.data(), nulls.data(), read_only_mode);
 
             if (ret >= 0) {
                 success_count++;
+                if (out != NULL) AppendFirstRow(out);
                 SPI_freetuptable(SPI_tuptable);
             } else {
                 error_occurred = true;
@@ -90,15 +546,18 @@ int Runtime::ExecuteBatchMQO(SPIPlanPtr plan, const mqo::BatchPayload& payload)
         error_occurred = true;
     }
 
-    PopActiveSnapshot();
-
-    if (payload.dry_run() || error_occurred) {
-        RollbackAndReleaseCurrentSubTransaction();
-        if (payload.dry_run()) {
-            elog(DEBUG1, "[Lumos Dry-Run] Simulated %d ops.", success_count);
-        }
+    if (in_window) {
+        window_failed_ = window_failed_ || error_occurred;
     } else {
-        ReleaseCurrentSubTransaction();
+        PopActiveSnapshot();
+        if (dry_run || error_occurred) {
+            RollbackAndReleaseCurrentSubTransaction();
+            if (dry_run) {
+                elog(DEBUG1, "[Lumos Dry-Run] Simulated %d ops.", success_count);
+            }
+        } else {
+            ReleaseCurrentSubTransaction();
+        }
     }
 
     malloc_trim(0);
@@ -106,71 +565,1001 @@ int Runtime::ExecuteBatchMQO(SPIPlanPtr plan, const mqo::BatchPayload& payload)
     return success_count;
 }
 
-int Runtime::ExecuteSharedScan(const mqo::BatchPayload& payload) {
-    if (payload.scan_table().empty() || payload.scan_col().empty()) return 0;
+bool Runtime::ExecuteBatchRescan(SPIPlanPtr plan, const mqo::BatchPayload& payload, int& success_count) {
+    success_count = 0;
+    if (plan == NULL || payload.rows_size() == 0) return true;
 
-    std::string table_name = payload.scan_table();
-    std::string col_name = payload.scan_col();
-    int match_count = 0;
+    List* sources = SPI_plan_get_plan_sources(plan);
+    if (list_length(sources) != 1) return false;
+    CachedPlanSource* source = static_cast<CachedPlanSource*>(linitial(sources));
 
-    Oid table_oid = InvalidOid;
-    try {
-        table_oid = DatumGetObjectId(DirectFunctionCall1(regclassin, CStringGetDatum(table_name.c_str())));
-    } catch (...) {
-        elog(WARNING, "SharedScan: Table '%s' not found.", table_name.c_str());
-        return 0;
+    // No bound params, so plancache hands back the generic plan: $n stay PARAM_EXTERN refs.
+    CachedPlan* cplan = SPI_plan_get_cached_plan(plan);
+    if (cplan == NULL) return false;
+    PlannedStmt* stmt = list_length(cplan->stmt_list) == 1 ? linitial_node(PlannedStmt, cplan->stmt_list) : NULL;
+    if (stmt == NULL || stmt->commandType != CMD_SELECT || stmt->hasModifyingCTE || stmt->rowMarks != NIL) {
+        ReleaseCachedPlan(cplan, CurrentResourceOwner);
+        return false;
     }
 
-    AttrNumber att_num = get_attnum(table_oid, col_name.c_str());
-    if (att_num == InvalidAttrNumber) {
-        elog(WARNING, "SharedScan: Column '%s' not found.", col_name.c_str());
-        return 0;
+    int arg_count = SPI_getargcount(plan);
+    ParamListInfo params = makeParamList(arg_count);
+    for (int i = 0; i < arg_count; ++i) {
+        params->params[i].ptype = SPI_getargtypeid(plan, i);
+        params->params[i].pflags = PARAM_FLAG_CONST;
+        params->params[i].value = (Datum)0;
+        params->params[i].isnull = true;
+    }
+
+    if (mqo_session_context_ == NULL) {
+        mqo_session_context_ = AllocSetContextCreate(TopMemoryContext, "LumosSessionContext", ALLOCSET_DEFAULT_SIZES);
+    } else {
+        MemoryContextReset(mqo_session_context_);
+    }
+
+    PushActiveSnapshot(ScanSnapshot());
+    QueryDesc* qd = CreateQueryDesc(stmt, source->query_string, GetActiveSnapshot(), InvalidSnapshot, None_Receiver,
+                                    params, NULL, 0);
+    ExecutorStart(qd, 0);
+
+    if (HasRuntimePruning(qd->planstate, NULL)) {
+        ExecutorFinish(qd);
+        ExecutorEnd(qd);
+        FreeQueryDesc(qd);
+        PopActiveSnapshot();
+        ReleaseCachedPlan(cplan, CurrentResourceOwner);
+        return false;
+    }
+
+    int sentinel = list_length(stmt->paramExecTypes);
+    bool started = false;
+
+    // Volatile functions must see every row re-evaluate them, as separate statements would.
+    std::vector<PlanState*> rescan_nodes;
+    RescanCollector collector = {contain_volatile_functions((Node*)source->query_list), false, &rescan_nodes};
+    CollectRescanNodes(qd->planstate, &collector);
+    elog(DEBUG1, "[Lumos ReScan] %zu plan nodes depend on the row params", rescan_nodes.size());
+
+    for (const auto& row : payload.rows()) {
+        if (row.values_size() != arg_count) continue;
+
+        MemoryContext old_ctx = MemoryContextSwitchTo(mqo_session_context_);
+        for (int i = 0; i < arg_count; ++i) {
+            PgParam p = TypeMapper::ToPgParam(row.values(i), params->params[i].ptype);
+            params->params[i].value = p.value;
+            params->params[i].isnull = (p.null_flag == 'n');
+        }
+        MemoryContextSwitchTo(old_ctx);
+
+        if (started) {
+            MarkRescanNeeded(rescan_nodes, sentinel);
+            ExecReScan(qd->planstate);
+        }
+        ExecutorRun(qd, ForwardScanDirection, 0, false);
+        started = true;
+        success_count++;
+
+        MemoryContextReset(mqo_session_context_);
     }
 
-    Oid type_id = get_atttype(table_oid, att_num);
+    ExecutorFinish(qd);
+    ExecutorEnd(qd);
+    FreeQueryDesc(qd);
+    PopActiveSnapshot();
+    ReleaseCachedPlan(cplan, CurrentResourceOwner);
+    return true;
+}
+
+bool Runtime::ExecuteSetOriented(SPIPlanPtr plan,
+                                 const mqo::BatchPayload& payload,
+                                 mqo::BatchResult* result,
+                                 int& success_count) {
+    success_count = 0;
+    if (plan == NULL || payload.rows_size() == 0) return true;
+
+    Oid elem_type = get_element_type(SPI_getargtypeid(plan, 0));
     int16 typlen;
     bool typbyval;
-    get_typlenbyval(type_id, &typlen, &typbyval);
+    char typalign;
+    get_typlenbyvalalign(elem_type, &typlen, &typbyval, &typalign);
 
-    std::vector<Datum> search_keys;
-    for (const auto& row : payload.rows()) {
-        if (row.values_size() > 0) {
-            PgParam p = TypeMapper::ToPgParam(row.values(0), type_id);
-            if (p.null_flag != 'n') {
-                search_keys.push_back(p.value);
+    if (mqo_session_context_ == NULL) {
+        mqo_session_context_ = AllocSetContextCreate(TopMemoryContext, "LumosSessionContext", ALLOCSET_DEFAULT_SIZES);
+    } else {
+        MemoryContextReset(mqo_session_context_);
+    }
+    MemoryContext old_ctx = MemoryContextSwitchTo(mqo_session_context_);
+
+    // Malformed rows become NULL keys (never match) so array positions stay equal to batch positions.
+    int nrows = payload.rows_size();
+    int well_formed = 0;
+    Datum* keys = static_cast<Datum*>(palloc(nrows * sizeof(Datum)));
+    bool* key_nulls = static_cast<bool*>(palloc(nrows * sizeof(bool)));
+    for (int r = 0; r < nrows; ++r) {
+        const auto& row = payload.rows(r);
+        if (row.values_size() != 1) {
+            keys[r] = (Datum)0;
+            key_nulls[r] = true;
+            continue;
+        }
+        PgParam p = TypeMapper::ToPgParam(row.values(0), elem_type);
+        keys[r] = p.value;
+        key_nulls[r] = (p.null_flag == 'n');
+        well_formed++;
+    }
+
+    int dims[1] = {nrows};
+    int lbs[1] = {1};
+    Datum array =
+        PointerGetDatum(construct_md_array(keys, key_nulls, 1, dims, lbs, elem_type, typlen, typbyval, typalign));
+    MemoryContextSwitchTo(old_ctx);
+
+    // One sub-transaction for the join: on any error nothing of it remains and the caller runs the
+    // requests one by one, where a failing request only costs itself.
+    ResourceOwner old_owner = CurrentResourceOwner;
+    BeginInternalSubTransaction(NULL);
+    MemoryContextSwitchTo(old_ctx);
+
+    char array_null = ' ';
+    std::vector<bool> answered(nrows, false); // Outside PG_TRY, a longjmp skips destructors
+    volatile bool failed = false;
+    volatile uint64 nresults = 0;
+    PG_TRY();
+    {
+        int ret = ExecutePlan(plan, &array, &array_null, false);
+        if (ret < 0) {
+            failed = true;
+        } else {
+            nresults = SPI_processed;
+            if (result != NULL) {
+                // Column 1 is ord (1-based batch position), the template's columns follow. Requests keep the
+                // first row they produce, like ExecuteBatchMQO.
+                for (int r = 0; r < nrows; ++r) result->add_results();
+                TupleDesc desc = SPI_tuptable->tupdesc;
+                for (uint64 t = 0; t < SPI_processed; ++t) {
+                    HeapTuple tuple = SPI_tuptable->vals[t];
+                    bool isnull;
+                    int64 ord = DatumGetInt64(SPI_getbinval(tuple, desc, 1, &isnull));
+                    if (isnull || ord < 1 || ord > nrows || answered[ord - 1]) continue;
+                    answered[ord - 1] = true;
+                    mqo::ParamRow* out = result->mutable_results(ord - 1);
+                    for (int i = 1; i < desc->natts; ++i) {
+                        Datum value = SPI_getbinval(tuple, desc, i + 1, &isnull);
+                        TypeMapper::FromDatum(value, isnull, TupleDescAttr(desc, i)->atttypid, out->add_values());
+                    }
+                }
             }
+            SPI_freetuptable(SPI_tuptable);
+        }
+        if (failed) {
+            RollbackAndReleaseCurrentSubTransaction();
+        } else {
+            ReleaseCurrentSubTransaction();
         }
+        MemoryContextSwitchTo(old_ctx);
+        CurrentResourceOwner = old_owner;
+    }
+    PG_CATCH();
+    {
+        MemoryContextSwitchTo(old_ctx);
+        ErrorData* edata = CopyErrorData();
+        FlushErrorState();
+        RollbackAndReleaseCurrentSubTransaction();
+        MemoryContextSwitchTo(old_ctx);
+        CurrentResourceOwner = old_owner;
+        elog(DEBUG1, "[Lumos Set-Oriented] Join failed (%s), falling back to per-request execution.",
+             edata->message);
+        FreeErrorData(edata);
+        failed = true;
+    }
+    PG_END_TRY();
+
+    MemoryContextReset(mqo_session_context_);
+    if (failed) {
+        if (result != NULL) result->clear_results();
+        return false;
     }
+    elog(DEBUG1, "[Lumos Set-Oriented] %d requests, %lu result rows in one join.", nrows, (unsigned long)nresults);
+    success_count = well_formed;
+    return true;
+}
+
+bool Runtime::ExecuteSharedAggregate(SPIPlanPtr plan,
+                                     const mqo::BatchPayload& payload,
+                                     mqo::BatchResult* result,
+                                     int& success_count) {
+    std::vector<bool> answered(1, false);
+    std::vector<mqo::BatchResult*> results(1, result);
+    ExecuteSharedAggregates({plan}, {&payload}, results, answered);
+    success_count = answered[0] ? payload.rows_size() : 0;
+    return answered[0];
+}
+
+// What one request costs on its own: the total cost of the generic plan, -1 when there is none.
+static Cost GenericPlanCost(SPIPlanPtr plan) {
+    CachedPlan* cplan = SPI_plan_get_cached_plan(plan);
+    if (cplan == NULL) return -1;
+    Cost request_cost = 0;
+    ListCell* lc;
+    foreach (lc, cplan->stmt_list) {
+        PlannedStmt* stmt = lfirst_node(PlannedStmt, lc);
+        if (stmt->planTree != NULL) request_cost += stmt->planTree->total_cost;
+    }
+    ReleaseCachedPlan(cplan, CurrentResourceOwner);
+    return request_cost;
+}
 
-    Relation rel = table_open(table_oid, AccessShareLock);
-    Snapshot snapshot = GetTransactionSnapshot(); 
-    TableScanDesc scan = table_beginscan(rel, snapshot, 0, NULL);
+// One shared scan reads the whole relation and tests every request's qual on each tuple; the per-request
+// generic plan may be far cheaper (an indexed point aggregate). Unanalyzed relations keep the shared scan.
+// One scan for every request of the relation's templates against running each on its own (requests_cost).
+static bool SharedAggregatePays(Oid relid, int nrequests, Cost requests_cost) {
+    Relation rel = table_open(relid, AccessShareLock);
+    BlockNumber pages = RelationGetNumberOfBlocks(rel);
+    double reltuples = rel->rd_rel->reltuples;
+    table_close(rel, AccessShareLock);
+    if (reltuples < 0) return true;
+
+    Cost shared_cost = pages * seq_page_cost + reltuples * (cpu_tuple_cost + nrequests * cpu_operator_cost);
+    elog(DEBUG1, "[Lumos SharedAgg] relation %u: shared scan %.0f vs %d requests %.0f", relid, shared_cost,
+         nrequests, requests_cost);
+    return shared_cost < requests_cost;
+}
+
+void Runtime::ExecuteSharedAggregates(const std::vector<SPIPlanPtr>& plans,
+                                      const std::vector<const mqo::BatchPayload*>& batches,
+                                      std::vector<mqo::BatchResult*>& results,
+                                      std::vector<bool>& answered) {
+    // Relation -> its candidate batches, gated together: the scan is paid once for all of them.
+    std::map<Oid, std::vector<std::pair<size_t, Query*>>> groups;
+    for (size_t i = 0; i < batches.size(); ++i) {
+        if (plans[i] == NULL) continue;
+        Query* query = SharedAggregate::MatchQuery(plans[i]);
+        if (query != NULL) groups[linitial_node(RangeTblEntry, query->rtable)->relid].emplace_back(i, query);
+    }
+
+    // Relation -> one shared scan; per batch its relation and template slot in that scan.
+    std::map<Oid, std::unique_ptr<SharedAggregate>> scans;
+    std::vector<Oid> member_rel(batches.size(), InvalidOid);
+    std::vector<size_t> member_slot(batches.size(), SIZE_MAX);
+
+    for (const auto& group : groups) {
+        int nrequests = 0;
+        Cost requests_cost = 0;
+        bool costed = true;
+        for (const auto& member : group.second) {
+            Cost request_cost = GenericPlanCost(plans[member.first]);
+            costed = costed && request_cost >= 0;
+            nrequests += batches[member.first]->rows_size();
+            requests_cost += batches[member.first]->rows_size() * request_cost;
+        }
+        if (!costed || !SharedAggregatePays(group.first, nrequests, requests_cost)) continue;
+
+        auto& agg = scans[group.first];
+        agg = std::make_unique<SharedAggregate>();
+        for (const auto& member : group.second) {
+            size_t i = member.first;
+            if (!agg->AddTemplate(member.second, plans[i], batches[i]->rows())) continue;
+            member_rel[i] = group.first;
+            member_slot[i] = agg->NumTemplates() - 1;
+        }
+    }
+
+    for (auto& entry : scans) {
+        if (entry.second->NumTemplates() == 0) continue;
+        uint64 ntuples = entry.second->Scan(ScanSnapshot());
+        elog(DEBUG1, "[Lumos SharedAgg] %lu templates on relation %u answered by one scan of %lu tuples.",
+             (unsigned long)entry.second->NumTemplates(), entry.first, (unsigned long)ntuples);
+    }
+
+    for (size_t i = 0; i < batches.size(); ++i) {
+        if (member_slot[i] == SIZE_MAX) continue;
+        if (results[i] != NULL) scans[member_rel[i]]->Emit(member_slot[i], results[i]);
+        answered[i] = true;
+    }
+}
+
+int Runtime::ExecuteBatchParallel(SPIPlanPtr plan, const mqo::BatchPayload& payload, int nworkers) {
+    if (plan == NULL || payload.rows_size() == 0) return 0;
+
+    std::string payload_bytes;
+    if (!payload.SerializeToString(&payload_bytes)) return 0;
+
+    // Workers restore the leader's transaction and active snapshots, so every row sees the same data.
+    EnterParallelMode();
+    ParallelContext* pcxt = CreateParallelContext(WorkerPool::LibraryPath(), "lumos_parallel_main", nworkers);
+    shm_toc_estimate_chunk(&pcxt->estimator, payload_bytes.size());
+    shm_toc_estimate_chunk(&pcxt->estimator, sizeof(ParallelBatchShared));
+    shm_toc_estimate_keys(&pcxt->estimator, 2);
+    InitializeParallelDSM(pcxt);
+
+    char* payload_space = static_cast<char*>(shm_toc_allocate(pcxt->toc, payload_bytes.size()));
+    memcpy(payload_space, payload_bytes.data(), payload_bytes.size());
+    shm_toc_insert(pcxt->toc, MQO_PARALLEL_KEY_PAYLOAD, payload_space);
+
+    ParallelBatchShared* shared = static_cast<ParallelBatchShared*>(shm_toc_allocate(pcxt->toc, sizeof(ParallelBatchShared)));
+    shared->payload_len = payload_bytes.size();
+    pg_atomic_init_u32(&shared->next_row, 0);
+    pg_atomic_init_u32(&shared->success_count, 0);
+    shm_toc_insert(pcxt->toc, MQO_PARALLEL_KEY_SHARED, shared);
+
+    LaunchParallelWorkers(pcxt);
+    int leader_count = ExecuteParallelPartition(plan, payload, pcxt->toc);
+    WaitForParallelWorkersToFinish(pcxt);
+
+    elog(DEBUG1, "[Lumos Parallel] %d rows over %d workers + leader (leader ran %d).",
+         payload.rows_size(), pcxt->nworkers_launched, leader_count);
+    int success_count = pg_atomic_read_u32(&shared->success_count);
+
+    DestroyParallelContext(pcxt);
+    ExitParallelMode();
+    return success_count;
+}
+
+int Runtime::ExecuteParallelPartition(SPIPlanPtr plan, const mqo::BatchPayload& payload, shm_toc* toc) {
+    ParallelBatchShared* shared = static_cast<ParallelBatchShared*>(shm_toc_lookup(toc, MQO_PARALLEL_KEY_SHARED, false));
+
+    int arg_count = SPI_getargcount(plan);
+    std::vector<Oid> arg_types(arg_count);
+    for (int i = 0; i < arg_count; ++i) arg_types[i] = SPI_getargtypeid(plan, i);
+
+    std::vector<Datum> values(arg_count);
+    std::vector<char> nulls(arg_count);
+    uint32 total_rows = payload.rows_size();
+    int local_count = 0;
+
+    while (true) {
+        uint32 start = pg_atomic_fetch_add_u32(&shared->next_row, MQO_PARALLEL_CHUNK_ROWS);
+        if (start >= total_rows) break;
+        uint32 end = Min(start + MQO_PARALLEL_CHUNK_ROWS, total_rows);
+
+        for (uint32 r = start; r < end; ++r) {
+            const auto& row = payload.rows(r);
+            if (row.values_size() != arg_count) continue;
+
+            for (int i = 0; i < arg_count; ++i) {
+                PgParam p = TypeMapper::ToPgParam(row.values(i), arg_types[i]);
+                values[i] = p.value;
+                nulls[i] = p.null_flag;
+            }
+            if (SPI_execute_plan(plan, values.data(), nulls.data(), true, 0) >= 0) {
+                local_count++;
+                SPI_freetuptable(SPI_tuptable);
+            }
+        }
+    }
+
+    pg_atomic_fetch_add_u32(&shared->success_count, local_count);
+    return local_count;
+}
+
+bool Runtime::ReadParallelPayload(shm_toc* toc, mqo::BatchPayload& payload) {
+    ParallelBatchShared* shared = static_cast<ParallelBatchShared*>(shm_toc_lookup(toc, MQO_PARALLEL_KEY_SHARED, false));
+    char* payload_space = static_cast<char*>(shm_toc_lookup(toc, MQO_PARALLEL_KEY_PAYLOAD, false));
+    return payload.ParseFromArray(payload_space, shared->payload_len);
+}
+
+// The sequential shared scan reads the scanned blocks once and routes each tuple through the predicate
+// index (a log-time stab per request bound), against every request running its generic plan, often an
+// index probe. Unanalyzed relations keep the shared scan.
+static bool SharedScanPays(SPIPlanPtr plan, Relation rel, BlockNumber nblocks, BlockNumber scanned, int nrequests) {
+    double reltuples = rel->rd_rel->reltuples;
+    if (reltuples < 0 || nblocks == 0) return true;
+    Cost request_cost = GenericPlanCost(plan);
+    if (request_cost < 0) return false;
+
+    double tuples = reltuples * scanned / nblocks;
+    Cost route_cost = cpu_operator_cost * (1 + log2(static_cast<double>(nrequests)));
+    Cost shared_cost = scanned * seq_page_cost + tuples * (cpu_tuple_cost + route_cost);
+    elog(DEBUG1, "[Lumos SharedScan] relation %u: shared scan of %u blocks %.0f vs %d requests x %.0f",
+         RelationGetRelid(rel), scanned, shared_cost, nrequests, request_cost);
+    return shared_cost < nrequests * request_cost;
+}
+
+bool Runtime::ExecuteSharedScan(SPIPlanPtr plan,
+                                const mqo::BatchPayload& payload,
+                                mqo::BatchResult* result,
+                                int& routed,
+                                int nworkers,
+                                bool forced) {
+    Query* query = SharedScan::MatchQuery(plan);
+    if (query == NULL) return false;
+
+    SharedScan shared;
+    if (!shared.Init(query, plan, payload.rows()) || !shared.Indexed()) return false;
+
+    routed = 0;
+    std::vector<PredicateIndex::Envelope> envelopes;
+    shared.Envelopes(envelopes);
+    for (const auto& env : envelopes) {
+        if (env.empty) return true;
+    }
+
+    // Equality columns, the proxy's hinted one first.
+    std::vector<AttrNumber> key_atts;
+    shared.EqualityColumns(key_atts);
+    ScanTarget hinted;
+    if (!key_atts.empty() && !payload.scan_table().empty() && !payload.scan_col().empty() &&
+        LookupScanTarget(payload.scan_table(), payload.scan_col(), hinted) &&
+        hinted.table_oid == shared.RelationId()) {
+        auto it = std::find(key_atts.begin(), key_atts.end(), hinted.att_num);
+        if (it != key_atts.end()) std::rotate(key_atts.begin(), it, it + 1);
+    }
+
+    Relation rel = table_open(shared.RelationId(), AccessShareLock);
+    Snapshot snapshot = ScanSnapshot();
+
+    // Equality keys bound the scan to the tuples carrying them, through an index on their column.
+    const DatumKeySet* keys = NULL;
+    Oid index_oid = InvalidOid;
+    double reltuples = rel->rd_rel->reltuples;
+    for (AttrNumber att : key_atts) {
+        Form_pg_attribute attr = TupleDescAttr(RelationGetDescr(rel), att - 1);
+        const DatumKeySet* att_keys = shared.EqualityKeys(att, attr->attcollation);
+        if (att_keys == NULL || (reltuples >= 0 && att_keys->Size() > reltuples * SHARED_SCAN_INDEX_MAX_FRACTION)) {
+            continue;
+        }
+        ScanTarget target = {RelationGetRelid(rel), att, attr->atttypid, attr->attcollation, attr->attlen,
+                             attr->attbyval};
+        index_oid = FindKeyIndex(rel, target);
+        if (OidIsValid(index_oid)) {
+            keys = att_keys;
+            break;
+        }
+    }
+
+    // The batch's distinct keys probe the index once each, where the requests' own plans would probe it
+    // per request: no cost estimate needed.
+    if (OidIsValid(index_oid)) {
+        auto route = [&](TupleTableSlot* slot) { routed += shared.Route(slot, result); };
+        if (keys->Size() >= SHARED_SCAN_BITMAP_MIN_KEYS && rel->rd_tableam == GetHeapamTableAmRoutine()) {
+            ExecuteSharedBitmapScan(rel, index_oid, keys->Keys(), snapshot, route);
+        } else {
+            ExecuteSharedIndexScan(rel, index_oid, keys->Keys(), snapshot, route);
+        }
+        routed += shared.Finish(result);
+        table_close(rel, AccessShareLock);
+        return true;
+    }
+
+    BlockNumber nblocks = RelationGetNumberOfBlocks(rel);
+    bool parallel = nworkers > 0 && shared.Parallelizable() && nblocks >= SHARED_SCAN_PARALLEL_MIN_BLOCKS &&
+                    max_parallel_hazard(query) == PROPARALLEL_SAFE;
+
+    // Block ranges no request can match are skipped by their BRIN summaries.
+    std::vector<BlockRange> ranges;
+    bool pruned = !parallel && FindBlockRanges(rel, envelopes, snapshot, ranges);
+    BlockNumber scanned = nblocks;
+    if (pruned) {
+        scanned = 0;
+        for (const BlockRange& range : ranges) scanned += range.nblocks;
+    }
+    if (!forced && !SharedScanPays(plan, rel, nblocks, scanned, payload.rows_size())) {
+        table_close(rel, AccessShareLock);
+        return false;
+    }
+
+    if (parallel) {
+        routed = ExecuteSharedScanParallel(shared, rel, snapshot, payload, result, nworkers);
+        table_close(rel, AccessShareLock);
+        return true;
+    }
+
+    // Mirrored columns answer the envelope tests without deforming the tuples.
+    if (ColumnCache::Scan(rel, snapshot, envelopes, pruned ? &ranges : NULL,
+                          [&](TupleTableSlot* slot) { routed += shared.Route(slot, result); })) {
+        routed += shared.Finish(result);
+        table_close(rel, AccessShareLock);
+        return true;
+    }
+
+    CooperativeScan scan(rel, snapshot, pruned ? &ranges : NULL);
+    std::unique_ptr<ScanBatch> batch;
+    if (shared.Batchable()) {
+        batch.reset(new ScanBatch(rel, envelopes, shared.MaxAttribute()));
+        if (!batch->Usable()) batch.reset();
+    }
+
+    if (batch) {
+        // Envelope tests over the whole batch first, the per-request routing only for what passes.
+        int count;
+        while ((count = batch->Fill(scan)) > 0) {
+            CHECK_FOR_INTERRUPTS();
+            const uint64* bits = batch->Filter();
+            for (int w = 0; w * 64 < count; ++w) {
+                for (uint64 word = bits[w]; word != 0; word &= word - 1) {
+                    routed += shared.Route(batch->Slot(w * 64 + __builtin_ctzll(word)), result);
+                }
+            }
+        }
+        batch.reset();
+    } else {
+        TupleTableSlot* slot = table_slot_create(rel, NULL);
+        while (scan.Next(slot)) {
+            CHECK_FOR_INTERRUPTS();
+            routed += shared.Route(slot, result);
+        }
+        ExecDropSingleTupleTableSlot(slot);
+    }
+
+    scan.End();
+    routed += shared.Finish(result);
+    table_close(rel, AccessShareLock);
+    return true;
+}
+
+std::string Runtime::CheckSharedScan(SPIPlanPtr plan, const mqo::BatchPayload& payload) {
+    mqo::BatchResult shared;
+    int routed = 0;
+    if (!ExecuteSharedScan(plan, payload, &shared, routed, 0, true)) return "SharedScan: declined";
+
+    std::vector<uint64> counts(payload.rows_size(), 0);
+    for (const auto& row : shared.results()) counts[row.values(0).int_val()]++;
+
+    std::stringstream ss;
+    ss << "SharedScan: " << routed << " rows routed\nCheck: ";
+    int arg_count = SPI_getargcount(plan);
+    std::vector<Datum> values(arg_count);
+    std::vector<char> nulls(arg_count);
+    for (int r = 0; r < payload.rows_size(); ++r) {
+        const auto& row = payload.rows(r);
+        if (row.values_size() != arg_count) continue;
+        for (int i = 0; i < arg_count; ++i) {
+            PgParam p = TypeMapper::ToPgParam(row.values(i), SPI_getargtypeid(plan, i));
+            values[i] = p.value;
+            nulls[i] = p.null_flag;
+        }
+        if (ExecutePlan(plan, values.data(), nulls.data(), true) < 0) continue;
+        uint64 expected = SPI_processed;
+        SPI_freetuptable(SPI_tuptable);
+        if (expected != counts[r]) {
+            ss << "MISMATCH on request " << r << " (shared scan " << counts[r] << " rows, alone " << expected << ")";
+            return ss.str();
+        }
+    }
+    ss << "OK (" << payload.rows_size() << " requests)";
+    return ss.str();
+}
+
+// Block-partitioned heap scan: participants claim block ranges from the parallel scan descriptor,
+// each rebuilds the predicate index from the payload, routed rows come back through one shm_mq per worker.
+int Runtime::ExecuteSharedScanParallel(SharedScan& shared,
+                                       Relation rel,
+                                       Snapshot snapshot,
+                                       const mqo::BatchPayload& payload,
+                                       mqo::BatchResult* result,
+                                       int nworkers) {
+    std::string payload_bytes;
+    if (!payload.SerializeToString(&payload_bytes)) return 0;
+
+    EnterParallelMode();
+    ParallelContext* pcxt = CreateParallelContext(WorkerPool::LibraryPath(), "lumos_parallel_main", nworkers);
+    Size pscan_size = table_parallelscan_estimate(rel, snapshot);
+    shm_toc_estimate_chunk(&pcxt->estimator, payload_bytes.size());
+    shm_toc_estimate_chunk(&pcxt->estimator, sizeof(ParallelBatchShared));
+    shm_toc_estimate_chunk(&pcxt->estimator, pscan_size);
+    shm_toc_estimate_keys(&pcxt->estimator, 3);
+    if (result != NULL) {
+        shm_toc_estimate_chunk(&pcxt->estimator, mul_size(MQO_PARALLEL_QUEUE_SIZE, nworkers));
+        shm_toc_estimate_keys(&pcxt->estimator, 1);
+    }
+    InitializeParallelDSM(pcxt);
+
+    char* payload_space = static_cast<char*>(shm_toc_allocate(pcxt->toc, payload_bytes.size()));
+    memcpy(payload_space, payload_bytes.data(), payload_bytes.size());
+    shm_toc_insert(pcxt->toc, MQO_PARALLEL_KEY_PAYLOAD, payload_space);
+
+    ParallelBatchShared* batch_shared = static_cast<ParallelBatchShared*>(shm_toc_allocate(pcxt->toc, sizeof(ParallelBatchShared)));
+    batch_shared->payload_len = payload_bytes.size();
+    pg_atomic_init_u32(&batch_shared->next_row, 0);
+    pg_atomic_init_u32(&batch_shared->success_count, 0); // Rows routed by the workers
+    shm_toc_insert(pcxt->toc, MQO_PARALLEL_KEY_SHARED, batch_shared);
+
+    ParallelTableScanDesc pscan = static_cast<ParallelTableScanDesc>(shm_toc_allocate(pcxt->toc, pscan_size));
+    table_parallelscan_initialize(rel, pscan, snapshot);
+    shm_toc_insert(pcxt->toc, MQO_PARALLEL_KEY_SCAN, pscan);
+
+    // Rows are only shipped back when the caller collects them, a bare count needs no queues.
+    char* queue_space = NULL;
+    if (result != NULL) {
+        queue_space = static_cast<char*>(shm_toc_allocate(pcxt->toc, mul_size(MQO_PARALLEL_QUEUE_SIZE, nworkers)));
+        for (int i = 0; i < nworkers; ++i) {
+            shm_mq* mq = shm_mq_create(queue_space + i * MQO_PARALLEL_QUEUE_SIZE, MQO_PARALLEL_QUEUE_SIZE);
+            shm_mq_set_receiver(mq, MyProc);
+        }
+        shm_toc_insert(pcxt->toc, MQO_PARALLEL_KEY_QUEUES, queue_space);
+    }
+
+    LaunchParallelWorkers(pcxt);
+    std::vector<shm_mq_handle*> queues;
+    if (result != NULL) {
+        for (int i = 0; i < pcxt->nworkers_launched; ++i) {
+            shm_mq* mq = reinterpret_cast<shm_mq*>(queue_space + i * MQO_PARALLEL_QUEUE_SIZE);
+            queues.push_back(shm_mq_attach(mq, pcxt->seg, pcxt->worker[i].bgwhandle));
+        }
+    }
+
+    // The leader takes its share of the blocks, draining the queues as it goes so workers never stall.
+    int leader_count = 0;
+    uint64 ntuples = 0;
+    TableScanDesc scan = table_beginscan_parallel(rel, pscan);
+    TupleTableSlot* slot = table_slot_create(rel, NULL);
+    while (table_scan_getnextslot(scan, ForwardScanDirection, slot)) {
+        CHECK_FOR_INTERRUPTS();
+        leader_count += shared.Route(slot, result);
+        if (!queues.empty() && ++ntuples % MQO_PARALLEL_RESULT_ROWS == 0) DrainScanQueues(queues, result, false);
+    }
+    ExecDropSingleTupleTableSlot(slot);
+    table_endscan(scan);
+
+    if (!queues.empty()) DrainScanQueues(queues, result, true);
+    WaitForParallelWorkersToFinish(pcxt);
+
+    int routed = leader_count + pg_atomic_read_u32(&batch_shared->success_count);
+    elog(DEBUG1, "[Lumos Parallel] Shared scan of %s over %d workers + leader: %d rows routed (leader %d).",
+         RelationGetRelationName(rel), pcxt->nworkers_launched, routed, leader_count);
+
+    DestroyParallelContext(pcxt);
+    ExitParallelMode();
+    return routed;
+}
+
+int Runtime::ExecuteParallelScanPartition(SPIPlanPtr plan, const mqo::BatchPayload& payload, shm_toc* toc) {
+    ParallelBatchShared* batch_shared = static_cast<ParallelBatchShared*>(shm_toc_lookup(toc, MQO_PARALLEL_KEY_SHARED, false));
+    ParallelTableScanDesc pscan = static_cast<ParallelTableScanDesc>(shm_toc_lookup(toc, MQO_PARALLEL_KEY_SCAN, false));
+    char* queue_space = static_cast<char*>(shm_toc_lookup(toc, MQO_PARALLEL_KEY_QUEUES, true));
+
+    Query* query = SharedScan::MatchQuery(plan);
+    SharedScan shared;
+    if (query == NULL || !shared.Init(query, plan, payload.rows())) {
+        elog(ERROR, "LumosKernel: shared scan template no longer qualifies in the parallel worker.");
+    }
+
+    shm_mq_handle* queue = NULL;
+    if (queue_space != NULL) {
+        shm_mq* mq = reinterpret_cast<shm_mq*>(queue_space + ParallelWorkerNumber * MQO_PARALLEL_QUEUE_SIZE);
+        shm_mq_set_sender(mq, MyProc);
+        queue = shm_mq_attach(mq, NULL, NULL);
+    }
+
+    int local_count = 0;
+    mqo::BatchResult part;
+    Relation rel = table_open(shared.RelationId(), AccessShareLock);
+    TableScanDesc scan = table_beginscan_parallel(rel, pscan);
     TupleTableSlot* slot = table_slot_create(rel, NULL);
 
     while (table_scan_getnextslot(scan, ForwardScanDirection, slot)) {
-        bool isnull;
-        Datum val = slot_getattr(slot, att_num, &isnull);
+        CHECK_FOR_INTERRUPTS();
+        local_count += shared.Route(slot, queue ? &part : NULL);
+        if (queue && part.results_size() >= MQO_PARALLEL_RESULT_ROWS) SendScanResult(queue, part);
+    }
+
+    ExecDropSingleTupleTableSlot(slot);
+    table_endscan(scan);
+    table_close(rel, AccessShareLock);
+
+    if (queue) {
+        SendScanResult(queue, part);
+        shm_mq_detach(queue);
+    }
+    pg_atomic_fetch_add_u32(&batch_shared->success_count, local_count);
+    return local_count;
+}
+
+bool Runtime::IsParallelScan(shm_toc* toc) {
+    return shm_toc_lookup(toc, MQO_PARALLEL_KEY_SCAN, true) != NULL;
+}
+
+#if PG_VERSION_NUM >= 180000
+typedef TBMPrivateIterator BitmapPageIterator;
+#define BeginBitmapPages(tbm) tbm_begin_private_iterate(tbm)
+#define EndBitmapPages(it) tbm_end_private_iterate(it)
+#else
+typedef TBMIterator BitmapPageIterator;
+#define BeginBitmapPages(tbm) tbm_begin_iterate(tbm)
+#define EndBitmapPages(it) tbm_end_iterate(it)
+#endif
+
+// Next page of a TID bitmap in block order. ntuples is -1 for a lossy page (any offset may match),
+// offsets holds MaxHeapTuplesPerPage entries.
+static bool NextBitmapPage(BitmapPageIterator* it, BlockNumber& block, OffsetNumber* offsets, int& ntuples) {
+#if PG_VERSION_NUM >= 180000
+    TBMIterateResult page;
+    if (!tbm_private_iterate(it, &page)) return false;
+    block = page.blockno;
+    ntuples = page.lossy ? -1 : tbm_extract_page_tuple(&page, offsets, MaxHeapTuplesPerPage);
+#else
+    TBMIterateResult* page = tbm_iterate(it);
+    if (page == NULL) return false;
+    block = page->blockno;
+    ntuples = page->ntuples;
+    if (ntuples > 0) memcpy(offsets, page->offsets, ntuples * sizeof(OffsetNumber));
+#endif
+    return true;
+}
+
+// `key = ANY(keys)` on the leading column of idx. The array is the caller's to free.
+static ArrayType* InitArrayScanKey(Relation idx, const std::vector<Datum>& keys, ScanKey skey) {
+    Oid opcintype = idx->rd_opcintype[0];
+    Oid eq_opr = get_opfamily_member(idx->rd_opfamily[0], opcintype, opcintype, BTEqualStrategyNumber);
+    if (!OidIsValid(eq_opr)) {
+        elog(ERROR, "LumosKernel: no equality operator in opfamily %u", idx->rd_opfamily[0]);
+    }
+
+    int16 typlen;
+    bool typbyval;
+    char typalign;
+    get_typlenbyvalalign(opcintype, &typlen, &typbyval, &typalign);
+    ArrayType* arr = construct_array(const_cast<Datum*>(keys.data()), keys.size(), opcintype, typlen, typbyval, typalign);
+
+    ScanKeyEntryInitialize(skey, SK_SEARCHARRAY, 1, BTEqualStrategyNumber, InvalidOid, idx->rd_indcollation[0],
+                           get_opcode(eq_opr), PointerGetDatum(arr));
+    return arr;
+}
+
+// Valid, non-partial btree whose leading key is the scan column under the column's collation.
+Oid Runtime::FindKeyIndex(Relation rel, const ScanTarget& target) {
+    Oid found = InvalidOid;
+    List* indexes = RelationGetIndexList(rel);
+    ListCell* lc;
+    foreach (lc, indexes) {
+        Relation idx = index_open(lfirst_oid(lc), AccessShareLock);
+        bool usable = idx->rd_rel->relam == BTREE_AM_OID && idx->rd_index->indisvalid &&
+                      idx->rd_index->indkey.values[0] == target.att_num &&
+                      idx->rd_indcollation[0] == target.collation &&
+                      IsBinaryCoercible(target.type_id, idx->rd_opcintype[0]) &&
+                      heap_attisnull(idx->rd_indextuple, Anum_pg_index_indpred, NULL);
+        index_close(idx, AccessShareLock);
+        if (usable) {
+            found = lfirst_oid(lc);
+            break;
+        }
+    }
+    list_free(indexes);
+    return found;
+}
+
+// Block ranges whose BRIN summaries overlap every envelope the index covers. False when no valid,
+// non-partial minmax BRIN index bounds an envelope or nothing would be skipped.
+bool Runtime::FindBlockRanges(Relation rel,
+                              const std::vector<PredicateIndex::Envelope>& envelopes,
+                              Snapshot snapshot,
+                              std::vector<BlockRange>& ranges) {
+    ranges.clear();
+    List* indexes = RelationGetIndexList(rel);
+    ListCell* lc;
+    foreach (lc, indexes) {
+        Relation idx = index_open(lfirst_oid(lc), AccessShareLock);
+        if (idx->rd_rel->relam != BRIN_AM_OID || !idx->rd_index->indisvalid ||
+            !heap_attisnull(idx->rd_indextuple, Anum_pg_index_indpred, NULL)) {
+            index_close(idx, AccessShareLock);
+            continue;
+        }
+
+        // `col >= lo` and `col <= hi` on each covered column. Only minmax opclasses order their strategies
+        // like btree: the operator must be the type's btree >= / <= (inclusion's 4 and 2 mean other things).
+        std::vector<ScanKeyData> skeys;
+        for (int k = 0; k < idx->rd_index->indnkeyatts; ++k) {
+            Oid opcintype = idx->rd_opcintype[k];
+            for (const auto& env : envelopes) {
+                if (idx->rd_index->indkey.values[k] != env.att || opcintype != env.type_id ||
+                    idx->rd_indcollation[k] != env.collation) {
+                    continue;
+                }
+                TypeCacheEntry* typentry = lookup_type_cache(opcintype, TYPECACHE_BTREE_OPFAMILY);
+                if (!OidIsValid(typentry->btree_opf)) continue;
+                const int strategies[2] = {BTGreaterEqualStrategyNumber, BTLessEqualStrategyNumber};
+                const bool has[2] = {env.has_lo, env.has_hi};
+                const Datum bounds[2] = {env.lo, env.hi};
+                for (int b = 0; b < 2; ++b) {
+                    Oid opr = get_opfamily_member(idx->rd_opfamily[k], opcintype, opcintype, strategies[b]);
+                    if (!has[b] || !OidIsValid(opr) ||
+                        opr != get_opfamily_member(typentry->btree_opf, opcintype, opcintype, strategies[b])) {
+                        continue;
+                    }
+                    ScanKeyData skey;
+                    ScanKeyEntryInitialize(&skey, 0, k + 1, strategies[b], opcintype, idx->rd_indcollation[k],
+                                           get_opcode(opr), bounds[b]);
+                    skeys.push_back(skey);
+                }
+            }
+        }
+        if (skeys.empty()) {
+            index_close(idx, AccessShareLock);
+            continue;
+        }
 
-        if (isnull) continue;
+        TIDBitmap* tbm = tbm_create(work_mem * 1024L, NULL);
+#if PG_VERSION_NUM >= 180000
+        IndexScanDesc scan = index_beginscan_bitmap(idx, snapshot, NULL, skeys.size());
+#else
+        IndexScanDesc scan = index_beginscan_bitmap(idx, snapshot, skeys.size());
+#endif
+        index_rescan(scan, skeys.data(), skeys.size(), NULL, 0);
+        index_getbitmap(scan, tbm);
+        index_endscan(scan);
+        Oid index_oid = RelationGetRelid(idx);
+        index_close(idx, AccessShareLock);
 
-        for (Datum key : search_keys) {
-            bool equal = false;
-            if (typbyval) {
-                if (val == key) equal = true;
+        // BRIN marks every page of a matching range (lossy), consecutive pages merge back into ranges.
+        BitmapPageIterator* pages = BeginBitmapPages(tbm);
+        OffsetNumber offsets[MaxHeapTuplesPerPage];
+        BlockNumber block;
+        int count;
+        BlockNumber kept = 0;
+        while (NextBitmapPage(pages, block, offsets, count)) {
+            if (!ranges.empty() && ranges.back().start + ranges.back().nblocks == block) {
+                ranges.back().nblocks++;
             } else {
-                if (datumIsEqual(val, key, typbyval, typlen)) equal = true;
+                ranges.push_back({block, 1});
+            }
+            kept++;
+        }
+        EndBitmapPages(pages);
+        tbm_free(tbm);
+        list_free(indexes);
+
+        elog(DEBUG1, "[Lumos SharedScan] BRIN %u keeps %u of %u blocks in %zu ranges", index_oid, kept,
+             RelationGetNumberOfBlocks(rel), ranges.size());
+        return kept < RelationGetNumberOfBlocks(rel);
+    }
+    list_free(indexes);
+    return false;
+}
+
+// One btree descent over key = ANY(keys): nbtree sorts the array and walks the leaves in key order.
+uint64 Runtime::ExecuteSharedIndexScan(Relation rel,
+                                       Oid index_oid,
+                                       const std::vector<Datum>& keys,
+                                       Snapshot snapshot,
+                                       const std::function<void(TupleTableSlot*)>& visit) {
+    uint64 ntuples = 0;
+    Relation idx = index_open(index_oid, AccessShareLock);
+
+    ScanKeyData skey;
+    ArrayType* arr = InitArrayScanKey(idx, keys, &skey);
+
+#if PG_VERSION_NUM >= 180000
+    IndexScanDesc scan = index_beginscan(rel, idx, snapshot, NULL, 1, 0);
+#else
+    IndexScanDesc scan = index_beginscan(rel, idx, snapshot, 1, 0);
+#endif
+    index_rescan(scan, &skey, 1, NULL, 0);
+    TupleTableSlot* slot = table_slot_create(rel, NULL);
+    IndexFetchTableData* fetch = table_index_fetch_begin(rel);
+
+    // TIDs of a whole batch are collected first and fetched in block order, with the next blocks
+    // prefetched ahead of the fetch: the random heap reads of the probes overlap and mostly run forward.
+    bool prefetch = rel->rd_tableam == GetHeapamTableAmRoutine();
+    size_t distance = Max(get_tablespace_io_concurrency(rel->rd_rel->reltablespace), 1);
+    std::vector<ItemPointerData> tids;
+    std::vector<BlockNumber> blocks; // Distinct blocks of tids, in order
+    tids.reserve(SHARED_INDEX_FETCH_BATCH);
+    bool more = true;
+
+    while (more) {
+        tids.clear();
+        while (tids.size() < SHARED_INDEX_FETCH_BATCH) {
+            ItemPointer tid = index_getnext_tid(scan, ForwardScanDirection);
+            if (tid == NULL) {
+                more = false;
+                break;
             }
+            tids.push_back(*tid);
+        }
+        std::sort(tids.begin(), tids.end(), [](const ItemPointerData& a, const ItemPointerData& b) {
+            return ItemPointerCompare(const_cast<ItemPointer>(&a), const_cast<ItemPointer>(&b)) < 0;
+        });
+
+        blocks.clear();
+        for (const ItemPointerData& tid : tids) {
+            BlockNumber block = ItemPointerGetBlockNumber(&tid);
+            if (blocks.empty() || blocks.back() != block) blocks.push_back(block);
+        }
+
+        size_t current = 0; // blocks[current] is being fetched, blocks[.. prefetched) were requested
+        size_t prefetched = 0;
+        for (size_t i = 0; i < tids.size(); ++i) {
+            CHECK_FOR_INTERRUPTS();
+            while (blocks[current] != ItemPointerGetBlockNumber(&tids[i])) current++;
+            for (; prefetch && prefetched < blocks.size() && prefetched <= current + distance; ++prefetched) {
+                PrefetchBuffer(rel, MAIN_FORKNUM, blocks[prefetched]);
+            }
+
+            // A non-MVCC snapshot may see several members of a HOT chain.
+            bool call_again = false;
+            do {
+                bool all_dead = false;
+                if (!table_index_fetch_tuple(fetch, &tids[i], snapshot, slot, &call_again, &all_dead)) break;
+                visit(slot);
+                ntuples++;
+            } while (call_again);
+        }
+    }
+
+    table_index_fetch_end(fetch);
+    ExecDropSingleTupleTableSlot(slot);
+    index_endscan(scan);
+    index_close(idx, AccessShareLock);
+    pfree(arr);
+
+    return ntuples;
+}
 
-            if (equal) {
-                match_count++;
+uint64 Runtime::ExecuteSharedBitmapScan(Relation rel,
+                                        Oid index_oid,
+                                        const std::vector<Datum>& keys,
+                                        Snapshot snapshot,
+                                        const std::function<void(TupleTableSlot*)>& visit) {
+    uint64 ntuples = 0;
+    Relation idx = index_open(index_oid, AccessShareLock);
+
+    ScanKeyData skey;
+    ArrayType* arr = InitArrayScanKey(idx, keys, &skey);
+
+    // One bitmap over the union of every request's keys: each heap block is read once however many
+    // requests' keys it holds. Beyond work_mem the bitmap turns lossy and whole pages are visited.
+    TIDBitmap* tbm = tbm_create(work_mem * 1024L, NULL);
+#if PG_VERSION_NUM >= 180000
+    IndexScanDesc scan = index_beginscan_bitmap(idx, snapshot, NULL, 1);
+#else
+    IndexScanDesc scan = index_beginscan_bitmap(idx, snapshot, 1);
+#endif
+    index_rescan(scan, &skey, 1, NULL, 0);
+    index_getbitmap(scan, tbm);
+    index_endscan(scan);
+    index_close(idx, AccessShareLock);
+    pfree(arr);
+
+    TupleTableSlot* slot = table_slot_create(rel, NULL);
+    IndexFetchTableData* fetch = table_index_fetch_begin(rel);
+    OffsetNumber offsets[MaxHeapTuplesPerPage];
+    OffsetNumber ahead_offsets[MaxHeapTuplesPerPage];
+
+    // A second iterator runs effective_io_concurrency pages ahead and prefetches them.
+    int distance = Max(get_tablespace_io_concurrency(rel->rd_rel->reltablespace), 1);
+    BitmapPageIterator* pages = BeginBitmapPages(tbm);
+    BitmapPageIterator* ahead = BeginBitmapPages(tbm);
+    int64 fetched = 0;
+    int64 prefetched = 0;
+
+    BlockNumber block;
+    int count;
+    while (NextBitmapPage(pages, block, offsets, count)) {
+        CHECK_FOR_INTERRUPTS();
+        fetched++;
+        while (ahead != NULL && prefetched < fetched + distance) {
+            BlockNumber ahead_block;
+            int ahead_count;
+            if (!NextBitmapPage(ahead, ahead_block, ahead_offsets, ahead_count)) {
+                EndBitmapPages(ahead);
+                ahead = NULL;
                 break;
             }
+            if (++prefetched > fetched) PrefetchBuffer(rel, MAIN_FORKNUM, ahead_block);
+        }
+
+        int n = count >= 0 ? count : MaxHeapTuplesPerPage;
+        for (int i = 0; i < n; ++i) {
+            // Lossy pages probe every offset: past the last item or at a heap-only tuple nothing is found,
+            // so each HOT chain is still visited once from its root.
+            ItemPointerData tid;
+            ItemPointerSet(&tid, block, count >= 0 ? offsets[i] : (OffsetNumber)(FirstOffsetNumber + i));
+
+            bool call_again = false;
+            do {
+                bool all_dead = false;
+                if (!table_index_fetch_tuple(fetch, &tid, snapshot, slot, &call_again, &all_dead)) break;
+                visit(slot);
+                ntuples++;
+            } while (call_again);
         }
     }
 
+    if (ahead != NULL) EndBitmapPages(ahead);
+    EndBitmapPages(pages);
+    table_index_fetch_end(fetch);
     ExecDropSingleTupleTableSlot(slot);
-    table_endscan(scan);
-    table_close(rel, AccessShareLock);
+    tbm_free(tbm);
 
-    return match_count;
+    return ntuples;
 }
@@ -0,0 +1,191 @@
+#include "exec/scan_batch.hpp"
+
+extern "C" {
+#include "access/tableam.h"
+#include "catalog/pg_type.h"
+#include "executor/executor.h"
+#include "utils/lsyscache.h"
+}
+
+#include <cmath>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define LUMOS_AVX2_KERNELS 1
+#endif
+
+static bool IsIntegerOrdered(Oid type_id) {
+    return type_id == INT2OID || type_id == INT4OID || type_id == INT8OID || type_id == DATEOID ||
+           type_id == TIMESTAMPOID || type_id == TIMESTAMPTZOID;
+}
+
+int64 FilterValueInt64(Datum value, Oid type_id) {
+    switch (type_id) {
+        case INT2OID:
+            return DatumGetInt16(value);
+        case INT4OID:
+        case DATEOID:
+            return DatumGetInt32(value);
+        default: // int8, timestamp, timestamptz
+            return DatumGetInt64(value);
+    }
+}
+
+double FilterValueDouble(Datum value, Oid type_id) {
+    return type_id == FLOAT4OID ? DatumGetFloat4(value) : DatumGetFloat8(value);
+}
+
+static void MaskInt64Scalar(const int64* values, int n, int64 lo, int64 hi, uint64* bits) {
+    for (int i = 0; i < n; ++i) {
+        if (values[i] < lo || values[i] > hi) bits[i / 64] &= ~(UINT64CONST(1) << (i % 64));
+    }
+}
+
+// NaN sorts above everything in PostgreSQL, so it never fails the envelope here (unordered compares).
+static void MaskDoubleScalar(const double* values, int n, double lo, double hi, uint64* bits) {
+    for (int i = 0; i < n; ++i) {
+        if (values[i] < lo || values[i] > hi) bits[i / 64] &= ~(UINT64CONST(1) << (i % 64));
+    }
+}
+
+#ifdef LUMOS_AVX2_KERNELS
+__attribute__((target("avx2"))) static void MaskInt64Avx2(const int64* values, int n, int64 lo, int64 hi,
+                                                          uint64* bits) {
+    __m256i vlo = _mm256_set1_epi64x(lo);
+    __m256i vhi = _mm256_set1_epi64x(hi);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+        __m256i out = _mm256_or_si256(_mm256_cmpgt_epi64(vlo, v), _mm256_cmpgt_epi64(v, vhi));
+        uint64 reject = static_cast<uint64>(_mm256_movemask_pd(_mm256_castsi256_pd(out)));
+        bits[i / 64] &= ~(reject << (i % 64));
+    }
+    MaskInt64Scalar(values + i, n - i, lo, hi, bits + i / 64);
+}
+
+__attribute__((target("avx2"))) static void MaskDoubleAvx2(const double* values, int n, double lo, double hi,
+                                                           uint64* bits) {
+    __m256d vlo = _mm256_set1_pd(lo);
+    __m256d vhi = _mm256_set1_pd(hi);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d v = _mm256_loadu_pd(values + i);
+        __m256d out = _mm256_or_pd(_mm256_cmp_pd(v, vlo, _CMP_LT_OQ), _mm256_cmp_pd(v, vhi, _CMP_GT_OQ));
+        uint64 reject = static_cast<uint64>(_mm256_movemask_pd(out));
+        bits[i / 64] &= ~(reject << (i % 64));
+    }
+    MaskDoubleScalar(values + i, n - i, lo, hi, bits + i / 64);
+}
+
+static bool HaveAvx2() {
+    static const bool have = __builtin_cpu_supports("avx2");
+    return have;
+}
+#endif
+
+void MaskInt64(const int64* values, int n, int64 lo, int64 hi, uint64* bits) {
+#ifdef LUMOS_AVX2_KERNELS
+    if (HaveAvx2()) return MaskInt64Avx2(values, n, lo, hi, bits);
+#endif
+    MaskInt64Scalar(values, n, lo, hi, bits);
+}
+
+void MaskDouble(const double* values, int n, double lo, double hi, uint64* bits) {
+#ifdef LUMOS_AVX2_KERNELS
+    if (HaveAvx2()) return MaskDoubleAvx2(values, n, lo, hi, bits);
+#endif
+    MaskDoubleScalar(values, n, lo, hi, bits);
+}
+
+bool BuildColumnFilter(const PredicateIndex::Envelope& env, ColumnFilter& out) {
+    if (env.empty || (!env.has_lo && !env.has_hi)) return false;
+    // Domains over these types compare the same way.
+    Oid base_type = getBaseType(env.type_id);
+    out.att = env.att;
+    out.type_id = base_type;
+    if (IsIntegerOrdered(base_type)) {
+        out.is_float = false;
+        out.lo_int = env.has_lo ? FilterValueInt64(env.lo, base_type) : PG_INT64_MIN;
+        out.hi_int = env.has_hi ? FilterValueInt64(env.hi, base_type) : PG_INT64_MAX;
+        return true;
+    }
+    if (base_type == FLOAT4OID || base_type == FLOAT8OID) {
+        out.is_float = true;
+        out.lo_float = env.has_lo ? FilterValueDouble(env.lo, base_type) : -INFINITY;
+        out.hi_float = env.has_hi ? FilterValueDouble(env.hi, base_type) : INFINITY;
+        // A NaN bound means "everything up from NaN", which the double compares cannot express.
+        return !std::isnan(out.lo_float) && !std::isnan(out.hi_float);
+    }
+    return false;
+}
+
+ScanBatch::ScanBatch(Relation rel, const std::vector<PredicateIndex::Envelope>& envelopes, AttrNumber max_attr)
+    : max_attr_(max_attr), count_(0) {
+    for (const auto& env : envelopes) {
+        ColumnFilter filter;
+        if (BuildColumnFilter(env, filter)) {
+            filters_.push_back(filter);
+            max_attr_ = Max(max_attr_, filter.att);
+        }
+    }
+    if (filters_.empty()) return;
+
+    for (int i = 0; i < SCAN_BATCH_SIZE; ++i) slots_.push_back(table_slot_create(rel, NULL));
+    ints_.resize(SCAN_BATCH_SIZE);
+    floats_.resize(SCAN_BATCH_SIZE);
+}
+
+ScanBatch::~ScanBatch() {
+    for (TupleTableSlot* slot : slots_) ExecDropSingleTupleTableSlot(slot);
+}
+
+bool ScanBatch::Usable() const {
+    return !filters_.empty();
+}
+
+int ScanBatch::Fill(CooperativeScan& scan) {
+    count_ = 0;
+    while (count_ < SCAN_BATCH_SIZE && scan.Next(slots_[count_])) {
+        // Heap slots of one scan share its current HeapTupleData, deform before the next tuple overwrites it.
+        // Columns past max_attr_ are never read, wide rows stop deforming there.
+        slot_getsomeattrs(slots_[count_], max_attr_);
+        count_++;
+    }
+    return count_;
+}
+
+const uint64* ScanBatch::Filter() {
+    for (int w = 0; w < SCAN_BATCH_SIZE / 64; ++w) {
+        int remaining = count_ - w * 64;
+        bits_[w] = remaining >= 64 ? ~UINT64CONST(0) : (remaining > 0 ? (UINT64CONST(1) << remaining) - 1 : 0);
+    }
+
+    for (const ColumnFilter& filter : filters_) {
+        int col = filter.att - 1;
+        for (int i = 0; i < count_; ++i) {
+            TupleTableSlot* slot = slots_[i];
+            if (slot->tts_isnull[col]) {
+                bits_[i / 64] &= ~(UINT64CONST(1) << (i % 64));
+                ints_[i] = 0;
+                floats_[i] = 0;
+                continue;
+            }
+            Datum value = slot->tts_values[col];
+            if (filter.is_float) {
+                floats_[i] = FilterValueDouble(value, filter.type_id);
+            } else {
+                ints_[i] = FilterValueInt64(value, filter.type_id);
+            }
+        }
+        if (filter.is_float) {
+            MaskDouble(floats_.data(), count_, filter.lo_float, filter.hi_float, bits_);
+        } else {
+            MaskInt64(ints_.data(), count_, filter.lo_int, filter.hi_int, bits_);
+        }
+    }
+    return bits_;
+}
+
+TupleTableSlot* ScanBatch::Slot(int i) const {
+    return slots_[i];
+}
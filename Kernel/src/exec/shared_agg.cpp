@@ -0,0 +1,347 @@
+#include "exec/shared_agg.hpp"
+#include "exec/coop_scan.hpp"
+#include "exec/type_mapper.hpp"
+
+extern "C" {
+#include "access/table.h"
+#include "access/tableam.h"
+#include "catalog/pg_aggregate.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_inherits.h"
+#include "executor/executor.h"
+#include "miscadmin.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/optimizer.h"
+#include "parser/parse_agg.h"
+#include "utils/acl.h"
+#include "utils/plancache.h"
+#include "utils/snapmgr.h"
+}
+
+#include "pg_under_macro.hpp"
+#include "mqo.pb.h"
+#include "pg_redef_macro.hpp"
+
+static bool ContainsParam(Node* node, void* context) {
+    if (node == NULL) return false;
+    if (IsA(node, Param)) return true;
+#if PG_VERSION_NUM >= 160000
+    return expression_tree_walker(node, ContainsParam, context);
+#else
+    return expression_tree_walker(node, reinterpret_cast<bool (*)()>(ContainsParam), context);
+#endif
+}
+
+SharedAggregate::SharedAggregate() : relid_(InvalidOid) {
+    agg_context_ = AllocSetContextCreate(CurrentMemoryContext, "LumosSharedAgg", ALLOCSET_DEFAULT_SIZES);
+    MemoryContext old_ctx = MemoryContextSwitchTo(agg_context_);
+    agg_econtext_ = CreateStandaloneExprContext();
+    tuple_econtext_ = CreateStandaloneExprContext();
+    agg_state_ = makeNode(AggState);
+    agg_state_->curaggcontext = agg_econtext_;
+    MemoryContextSwitchTo(old_ctx);
+}
+SharedAggregate::~SharedAggregate() {
+    FreeExprContext(tuple_econtext_, true);
+    FreeExprContext(agg_econtext_, true);
+    MemoryContextDelete(agg_context_);
+}
+
+Query* SharedAggregate::MatchQuery(SPIPlanPtr plan) {
+    List* sources = SPI_plan_get_plan_sources(plan);
+    if (list_length(sources) != 1) return NULL;
+    CachedPlanSource* source = static_cast<CachedPlanSource*>(linitial(sources));
+    if (list_length(source->query_list) != 1) return NULL;
+
+    Query* query = linitial_node(Query, source->query_list);
+    if (query->commandType != CMD_SELECT || !query->hasAggs || query->hasWindowFuncs || query->hasTargetSRFs ||
+        query->hasSubLinks || query->hasForUpdate || query->hasRowSecurity || query->cteList != NIL ||
+        query->groupClause != NIL || query->groupingSets != NIL || query->havingQual != NULL ||
+        query->distinctClause != NIL || query->sortClause != NIL || query->limitCount != NULL ||
+        query->limitOffset != NULL || query->setOperations != NULL) {
+        return NULL;
+    }
+
+    if (list_length(query->rtable) != 1 || list_length(query->jointree->fromlist) != 1 ||
+        !IsA(linitial(query->jointree->fromlist), RangeTblRef)) {
+        return NULL;
+    }
+    RangeTblEntry* rte = linitial_node(RangeTblEntry, query->rtable);
+    if (rte->rtekind != RTE_RELATION || rte->relkind != RELKIND_RELATION) return NULL;
+    if (rte->inh && has_subclass(rte->relid)) return NULL;
+
+    ListCell* lc;
+    foreach (lc, query->targetList) {
+        TargetEntry* tle = lfirst_node(TargetEntry, lc);
+        if (!tle->resjunk && !IsA(tle->expr, Aggref)) return NULL;
+    }
+    return query;
+}
+
+bool SharedAggregate::InitAggregate(Aggref* aggref, SharedAggDesc& desc) {
+    if (aggref->aggkind != AGGKIND_NORMAL || aggref->aggdistinct != NIL || aggref->aggorder != NIL ||
+        aggref->aggfilter != NULL || aggref->agglevelsup != 0) {
+        return false;
+    }
+
+    HeapTuple tup = SearchSysCache1(AGGFNOID, ObjectIdGetDatum(aggref->aggfnoid));
+    if (!HeapTupleIsValid(tup)) return false;
+    Form_pg_aggregate form = (Form_pg_aggregate)GETSTRUCT(tup);
+    Oid transfn_oid = form->aggtransfn;
+    Oid finalfn_oid = form->aggfinalfn;
+    bool finalextra = form->aggfinalextra;
+    desc.transtype = form->aggtranstype;
+    bool init_isnull;
+    Datum init_text = SysCacheGetAttr(AGGFNOID, tup, Anum_pg_aggregate_agginitval, &init_isnull);
+    char* init_str = init_isnull ? NULL : TextDatumGetCString(init_text);
+    ReleaseSysCache(tup);
+
+    if (IsPolymorphicType(desc.transtype) || finalextra) return false;
+
+    int num_inputs = list_length(aggref->aggargtypes);
+    std::vector<Oid> input_types;
+    ListCell* lc;
+    foreach (lc, aggref->aggargtypes) input_types.push_back(lfirst_oid(lc));
+
+    // fn_expr as nodeAgg builds it, some transition functions look up their argument types.
+    Expr* transfn_expr;
+    Expr* finalfn_expr = NULL;
+    build_aggregate_transfn_expr(input_types.data(), num_inputs, 0, aggref->aggvariadic, desc.transtype,
+                                 aggref->inputcollid, transfn_oid, InvalidOid, &transfn_expr, NULL);
+    desc.transfn = static_cast<FmgrInfo*>(palloc0(sizeof(FmgrInfo)));
+    fmgr_info_cxt(transfn_oid, desc.transfn, agg_context_);
+    fmgr_info_set_expr((Node*)transfn_expr, desc.transfn);
+    desc.trans_fcinfo = static_cast<FunctionCallInfo>(palloc0(SizeForFunctionCallInfo(num_inputs + 1)));
+    InitFunctionCallInfoData(*desc.trans_fcinfo, desc.transfn, num_inputs + 1, aggref->inputcollid,
+                             (Node*)agg_state_, NULL);
+
+    desc.has_final = OidIsValid(finalfn_oid);
+    desc.finalfn = NULL;
+    desc.final_fcinfo = NULL;
+    if (desc.has_final) {
+        build_aggregate_finalfn_expr(input_types.data(), 1, desc.transtype, aggref->aggtype, aggref->inputcollid,
+                                     finalfn_oid, &finalfn_expr);
+        desc.finalfn = static_cast<FmgrInfo*>(palloc0(sizeof(FmgrInfo)));
+        fmgr_info_cxt(finalfn_oid, desc.finalfn, agg_context_);
+        fmgr_info_set_expr((Node*)finalfn_expr, desc.finalfn);
+        desc.final_fcinfo = static_cast<FunctionCallInfo>(palloc0(SizeForFunctionCallInfo(1)));
+        InitFunctionCallInfoData(*desc.final_fcinfo, desc.finalfn, 1, aggref->inputcollid, (Node*)agg_state_, NULL);
+    }
+
+    get_typlenbyval(desc.transtype, &desc.translen, &desc.transbyval);
+    desc.initval = (Datum)0;
+    desc.initval_null = (init_str == NULL);
+    if (init_str != NULL) {
+        Oid typinput;
+        Oid typioparam;
+        getTypeInputInfo(desc.transtype, &typinput, &typioparam);
+        desc.initval = OidInputFunctionCall(typinput, init_str, typioparam, -1);
+    }
+
+    desc.result_type = aggref->aggtype;
+    desc.args_use_params = false;
+    foreach (lc, aggref->args) {
+        Expr* arg = expression_planner(lfirst_node(TargetEntry, lc)->expr);
+        desc.args.push_back(ExecInitExpr(arg, NULL));
+        desc.args_use_params = desc.args_use_params || ContainsParam((Node*)arg, NULL);
+    }
+    desc.arg_values.resize(desc.args.size());
+    desc.arg_nulls.resize(desc.args.size());
+    return true;
+}
+
+bool SharedAggregate::AddTemplate(Query* query,
+                                  SPIPlanPtr plan,
+                                  const google::protobuf::RepeatedPtrField<mqo::ParamRow>& rows) {
+    Oid relid = linitial_node(RangeTblEntry, query->rtable)->relid;
+    if (!templates_.empty() && relid != relid_) return false;
+    // The scan bypasses the executor's permission check, let the regular path raise the error.
+    if (pg_class_aclcheck(relid, GetUserId(), ACL_SELECT) != ACLCHECK_OK) return false;
+
+    MemoryContext old_ctx = MemoryContextSwitchTo(agg_context_);
+    SharedAggTemplate tmpl;
+
+    ListCell* lc;
+    foreach (lc, query->targetList) {
+        TargetEntry* tle = lfirst_node(TargetEntry, lc);
+        if (tle->resjunk) continue;
+        SharedAggDesc desc;
+        if (!InitAggregate(castNode(Aggref, tle->expr), desc)) {
+            MemoryContextSwitchTo(old_ctx);
+            return false;
+        }
+        tmpl.aggs.push_back(desc);
+    }
+
+    Expr* qual = query->jointree->quals ? expression_planner((Expr*)query->jointree->quals) : NULL;
+    tmpl.qual = ExecInitQual(make_ands_implicit(qual), NULL);
+
+    // Malformed rows keep their slot (NULL params) so results stay aligned with the batch.
+    int arg_count = SPI_getargcount(plan);
+    for (const auto& row : rows) {
+        if (row.values_size() != arg_count) {
+            tmpl.requests.push_back(NULL);
+            continue;
+        }
+        ParamListInfo params = makeParamList(arg_count);
+        for (int i = 0; i < arg_count; ++i) {
+            Oid type_id = SPI_getargtypeid(plan, i);
+            PgParam p = TypeMapper::ToPgParam(row.values(i), type_id);
+            params->params[i].ptype = type_id;
+            params->params[i].pflags = PARAM_FLAG_CONST;
+            params->params[i].value = p.value;
+            params->params[i].isnull = (p.null_flag == 'n');
+        }
+        tmpl.requests.push_back(params);
+    }
+    MemoryContextSwitchTo(old_ctx);
+
+    // Transition states live in the aggregate context, each request gets its own copy of initval.
+    size_t naggs = tmpl.aggs.size();
+    tmpl.trans_values.resize(tmpl.requests.size() * naggs);
+    tmpl.trans_nulls.resize(tmpl.requests.size() * naggs);
+    old_ctx = MemoryContextSwitchTo(agg_econtext_->ecxt_per_tuple_memory);
+    for (size_t r = 0; r < tmpl.requests.size(); ++r) {
+        for (size_t a = 0; a < naggs; ++a) {
+            const SharedAggDesc& desc = tmpl.aggs[a];
+            tmpl.trans_values[r * naggs + a] =
+                desc.initval_null ? (Datum)0 : datumCopy(desc.initval, desc.transbyval, desc.translen);
+            tmpl.trans_nulls[r * naggs + a] = desc.initval_null;
+        }
+    }
+    MemoryContextSwitchTo(old_ctx);
+
+    relid_ = relid;
+    templates_.push_back(std::move(tmpl));
+    return true;
+}
+
+size_t SharedAggregate::NumTemplates() const {
+    return templates_.size();
+}
+
+void SharedAggregate::EvalArgs(SharedAggDesc& desc) {
+    for (size_t i = 0; i < desc.args.size(); ++i) {
+        bool isnull;
+        desc.arg_values[i] = ExecEvalExprSwitchContext(desc.args[i], tuple_econtext_, &isnull);
+        desc.arg_nulls[i] = isnull;
+    }
+}
+
+void SharedAggregate::Advance(SharedAggDesc& desc, SharedAggTemplate& tmpl, size_t state) {
+    Datum trans = tmpl.trans_values[state];
+    bool trans_null = tmpl.trans_nulls[state];
+    size_t nargs = desc.arg_values.size();
+
+    if (desc.transfn->fn_strict) {
+        for (size_t i = 0; i < nargs; ++i) {
+            if (desc.arg_nulls[i]) return;
+        }
+        if (trans_null) {
+            // Strict transition without initval: the first non-null input becomes the state.
+            if (desc.initval_null && nargs > 0) {
+                MemoryContext old_ctx = MemoryContextSwitchTo(agg_econtext_->ecxt_per_tuple_memory);
+                tmpl.trans_values[state] = datumCopy(desc.arg_values[0], desc.transbyval, desc.translen);
+                tmpl.trans_nulls[state] = false;
+                MemoryContextSwitchTo(old_ctx);
+            }
+            return;
+        }
+    }
+
+    FunctionCallInfo fcinfo = desc.trans_fcinfo;
+    fcinfo->args[0].value = trans;
+    fcinfo->args[0].isnull = trans_null;
+    for (size_t i = 0; i < nargs; ++i) {
+        fcinfo->args[i + 1].value = desc.arg_values[i];
+        fcinfo->args[i + 1].isnull = desc.arg_nulls[i];
+    }
+    fcinfo->isnull = false;
+
+    MemoryContext old_ctx = MemoryContextSwitchTo(tuple_econtext_->ecxt_per_tuple_memory);
+    Datum value = FunctionCallInvoke(fcinfo);
+    MemoryContextSwitchTo(old_ctx);
+
+    // By-ref states returned in fresh memory move into the aggregate context, as in nodeAgg.
+    if (!desc.transbyval && DatumGetPointer(value) != DatumGetPointer(trans)) {
+        if (!fcinfo->isnull) {
+            old_ctx = MemoryContextSwitchTo(agg_econtext_->ecxt_per_tuple_memory);
+            value = datumCopy(value, false, desc.translen);
+            MemoryContextSwitchTo(old_ctx);
+        }
+        if (!trans_null) pfree(DatumGetPointer(trans));
+    }
+    tmpl.trans_values[state] = value;
+    tmpl.trans_nulls[state] = fcinfo->isnull;
+}
+
+uint64 SharedAggregate::Scan(Snapshot snapshot) {
+    if (templates_.empty()) return 0;
+
+    Relation rel = table_open(relid_, AccessShareLock);
+    CooperativeScan scan(rel, snapshot);
+    TupleTableSlot* slot = table_slot_create(rel, NULL);
+    uint64 ntuples = 0;
+
+    while (scan.Next(slot)) {
+        CHECK_FOR_INTERRUPTS();
+        ResetExprContext(tuple_econtext_);
+        tuple_econtext_->ecxt_scantuple = slot;
+        ntuples++;
+
+        for (auto& tmpl : templates_) {
+            size_t naggs = tmpl.aggs.size();
+            bool shared_args_ready = false; // Param-free args are evaluated once per tuple
+            for (size_t r = 0; r < tmpl.requests.size(); ++r) {
+                if (tmpl.requests[r] == NULL) continue;
+                tuple_econtext_->ecxt_param_list_info = tmpl.requests[r];
+                if (!ExecQual(tmpl.qual, tuple_econtext_)) continue;
+
+                for (size_t a = 0; a < naggs; ++a) {
+                    SharedAggDesc& desc = tmpl.aggs[a];
+                    if (desc.args_use_params || !shared_args_ready) EvalArgs(desc);
+                    Advance(desc, tmpl, r * naggs + a);
+                }
+                shared_args_ready = true;
+            }
+        }
+    }
+
+    tuple_econtext_->ecxt_scantuple = NULL;
+    ExecDropSingleTupleTableSlot(slot);
+    scan.End();
+    table_close(rel, AccessShareLock);
+    return ntuples;
+}
+
+void SharedAggregate::Emit(size_t t, mqo::BatchResult* result) {
+    SharedAggTemplate& tmpl = templates_[t];
+    size_t naggs = tmpl.aggs.size();
+
+    for (size_t r = 0; r < tmpl.requests.size(); ++r) {
+        mqo::ParamRow* out = result->add_results();
+        if (tmpl.requests[r] == NULL) continue;
+
+        for (size_t a = 0; a < naggs; ++a) {
+            SharedAggDesc& desc = tmpl.aggs[a];
+            Datum value = tmpl.trans_values[r * naggs + a];
+            bool isnull = tmpl.trans_nulls[r * naggs + a];
+
+            if (desc.has_final && !(desc.finalfn->fn_strict && isnull)) {
+                FunctionCallInfo fcinfo = desc.final_fcinfo;
+                fcinfo->args[0].value = value;
+                fcinfo->args[0].isnull = isnull;
+                fcinfo->isnull = false;
+                MemoryContext old_ctx = MemoryContextSwitchTo(tuple_econtext_->ecxt_per_tuple_memory);
+                value = FunctionCallInvoke(fcinfo);
+                MemoryContextSwitchTo(old_ctx);
+                isnull = fcinfo->isnull;
+            } else if (desc.has_final) {
+                value = (Datum)0;
+            }
+            TypeMapper::FromDatum(value, isnull, desc.result_type, out->add_values());
+        }
+        ResetExprContext(tuple_econtext_);
+    }
+}
@@ -0,0 +1,400 @@
+#include "exec/shared_scan.hpp"
+#include "exec/type_mapper.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+
+extern "C" {
+#include "access/sysattr.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_inherits.h"
+#include "executor/executor.h"
+#include "miscadmin.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/optimizer.h"
+#include "optimizer/tlist.h"
+#include "utils/acl.h"
+#include "utils/datum.h"
+#include "utils/lsyscache.h"
+#include "utils/plancache.h"
+}
+
+#include "pg_under_macro.hpp"
+#include "mqo.pb.h"
+#include "pg_redef_macro.hpp"
+
+// Ids of the extern params node reads.
+static bool CollectParams(Node* node, Bitmapset** params) {
+    if (node == NULL) return false;
+    if (IsA(node, Param) && castNode(Param, node)->paramkind == PARAM_EXTERN) {
+        *params = bms_add_member(*params, castNode(Param, node)->paramid);
+        return false;
+    }
+#if PG_VERSION_NUM >= 160000
+    return expression_tree_walker(node, CollectParams, params);
+#else
+    return expression_tree_walker(node, reinterpret_cast<bool (*)()>(CollectParams), params);
+#endif
+}
+
+SharedScan::SharedScan()
+    : relid_(InvalidOid), qual_(NULL), system_attrs_(false), max_attr_(0), has_qual_(false), ranked_(false), current_{NULL, NULL, NULL},
+      tuple_serial_(0) {
+    scan_context_ = AllocSetContextCreate(CurrentMemoryContext, "LumosSharedScan", ALLOCSET_DEFAULT_SIZES);
+    MemoryContext old_ctx = MemoryContextSwitchTo(scan_context_);
+    econtext_ = CreateStandaloneExprContext();
+    MemoryContextSwitchTo(old_ctx);
+}
+SharedScan::~SharedScan() {
+    for (auto& heap : groups_) {
+        for (RankedRow& row : heap) delete row.row;
+    }
+    index_.reset(); // Its key sets live in scan_context_
+    FreeExprContext(econtext_, true);
+    MemoryContextDelete(scan_context_);
+}
+
+Query* SharedScan::MatchQuery(SPIPlanPtr plan) {
+    List* sources = SPI_plan_get_plan_sources(plan);
+    if (list_length(sources) != 1) return NULL;
+    CachedPlanSource* source = static_cast<CachedPlanSource*>(linitial(sources));
+    if (list_length(source->query_list) != 1) return NULL;
+
+    // Per-request OFFSET/DISTINCT would need per-request state, leave them to the executor.
+    Query* query = linitial_node(Query, source->query_list);
+    if (query->commandType != CMD_SELECT || query->hasAggs || query->hasWindowFuncs || query->hasTargetSRFs ||
+        query->hasSubLinks || query->hasForUpdate || query->hasRowSecurity || query->cteList != NIL ||
+        query->groupClause != NIL || query->groupingSets != NIL || query->havingQual != NULL ||
+        query->distinctClause != NIL || query->limitOffset != NULL || query->setOperations != NULL ||
+        query->rowMarks != NIL) {
+        return NULL;
+    }
+
+    // Ranking: ORDER BY with LIMIT. Keys reading params order every request differently, and volatile
+    // expressions cannot be evaluated once for a whole group of requests.
+    if ((query->sortClause != NIL) != (query->limitCount != NULL) ||
+        query->limitOption == LIMIT_OPTION_WITH_TIES) {
+        return NULL;
+    }
+    if (query->sortClause != NIL) {
+        if (contain_volatile_functions(query->jointree->quals) ||
+            contain_volatile_functions((Node*)query->targetList)) {
+            return NULL;
+        }
+        ListCell* lc;
+        foreach (lc, query->sortClause) {
+            Node* key = (Node*)get_sortgroupclause_tle(lfirst_node(SortGroupClause, lc), query->targetList)->expr;
+            Bitmapset* params = NULL;
+            CollectParams(key, &params);
+            if (!bms_is_empty(params)) return NULL;
+        }
+    }
+
+    if (list_length(query->rtable) != 1 || list_length(query->jointree->fromlist) != 1 ||
+        !IsA(linitial(query->jointree->fromlist), RangeTblRef)) {
+        return NULL;
+    }
+    RangeTblEntry* rte = linitial_node(RangeTblEntry, query->rtable);
+    // A sampled scan reads a subset of the blocks, the shared scan would read them all.
+    if (rte->rtekind != RTE_RELATION || rte->relkind != RELKIND_RELATION || rte->tablesample != NULL) return NULL;
+    if (rte->inh && has_subclass(rte->relid)) return NULL;
+    return query;
+}
+
+bool SharedScan::Init(Query* query, SPIPlanPtr plan, const google::protobuf::RepeatedPtrField<mqo::ParamRow>& rows) {
+    Oid relid = linitial_node(RangeTblEntry, query->rtable)->relid;
+    // The scan bypasses the executor's permission check, let the regular path raise the error.
+    if (pg_class_aclcheck(relid, GetUserId(), ACL_SELECT) != ACLCHECK_OK) return false;
+
+    MemoryContext old_ctx = MemoryContextSwitchTo(scan_context_);
+    ListCell* lc;
+    foreach (lc, query->targetList) {
+        TargetEntry* tle = lfirst_node(TargetEntry, lc);
+        if (tle->resjunk) continue;
+        targets_.push_back(ExecInitExpr(expression_planner(tle->expr), NULL));
+        target_types_.push_back(exprType((Node*)tle->expr));
+    }
+
+    Bitmapset* attrs = NULL;
+    pull_varattnos((Node*)query->targetList, 1, &attrs);
+    pull_varattnos(query->jointree->quals, 1, &attrs);
+    int first_attr = bms_next_member(attrs, -1);
+    system_attrs_ = first_attr >= 0 && first_attr < -FirstLowInvalidHeapAttributeNumber;
+    int last_attr = -1;
+    for (int m = first_attr; m >= 0; m = bms_next_member(attrs, m)) last_attr = m;
+    if (bms_is_member(-FirstLowInvalidHeapAttributeNumber, attrs)) {
+        max_attr_ = get_relnatts(relid);
+    } else if (last_attr > -FirstLowInvalidHeapAttributeNumber) {
+        max_attr_ = last_attr + FirstLowInvalidHeapAttributeNumber;
+    }
+
+    Expr* qual = query->jointree->quals ? expression_planner((Expr*)query->jointree->quals) : NULL;
+    qual_ = ExecInitQual(make_ands_implicit(qual), NULL);
+
+    ranked_ = query->sortClause != NIL;
+    sort_support_.resize(list_length(query->sortClause));
+    int k = 0;
+    foreach (lc, query->sortClause) {
+        SortGroupClause* clause = lfirst_node(SortGroupClause, lc);
+        Expr* key = get_sortgroupclause_tle(clause, query->targetList)->expr;
+        sort_keys_.push_back(ExecInitExpr(expression_planner(key), NULL));
+        int16 typlen;
+        bool typbyval;
+        get_typlenbyval(exprType((Node*)key), &typlen, &typbyval);
+        sort_typlen_.push_back(typlen);
+        sort_byval_.push_back(typbyval);
+
+        SortSupport ssup = &sort_support_[k++];
+        ssup->ssup_cxt = scan_context_;
+        ssup->ssup_collation = exprCollation((Node*)key);
+        ssup->ssup_nulls_first = clause->nulls_first;
+        PrepareSortSupportFromOrderingOp(clause->sortop, ssup);
+    }
+    if (ranked_) {
+        current_.keys = static_cast<Datum*>(palloc(sort_keys_.size() * sizeof(Datum)));
+        current_.nulls = static_cast<bool*>(palloc(sort_keys_.size() * sizeof(bool)));
+    }
+
+    // Malformed rows keep their slot (NULL params) so request indexes stay aligned with the batch.
+    int arg_count = SPI_getargcount(plan);
+    for (const auto& row : rows) {
+        if (row.values_size() != arg_count) {
+            requests_.push_back(NULL);
+            continue;
+        }
+        ParamListInfo params = makeParamList(arg_count);
+        for (int i = 0; i < arg_count; ++i) {
+            Oid type_id = SPI_getargtypeid(plan, i);
+            PgParam p = TypeMapper::ToPgParam(row.values(i), type_id);
+            params->params[i].ptype = type_id;
+            params->params[i].pflags = PARAM_FLAG_CONST;
+            params->params[i].value = p.value;
+            params->params[i].isnull = (p.null_flag == 'n');
+        }
+        requests_.push_back(params);
+    }
+    has_qual_ = query->jointree->quals != NULL;
+    if (has_qual_) {
+        index_.reset(new PredicateIndex());
+        if (!index_->Build((Expr*)query->jointree->quals, requests_)) index_.reset();
+    }
+    if (ranked_) BuildGroups(query);
+    MemoryContextSwitchTo(old_ctx);
+
+    relid_ = relid;
+    return true;
+}
+
+// Requests with equal params in the WHERE and target list produce the same rows in the same order: one
+// heap serves the group, bounded by its largest LIMIT. Params read only by the LIMIT do not split groups.
+void SharedScan::BuildGroups(Query* query) {
+    Bitmapset* used = NULL;
+    CollectParams((Node*)query->targetList, &used);
+    CollectParams(query->jointree->quals, &used);
+
+    ExprState* limit = ExecInitExpr(expression_planner((Expr*)query->limitCount), NULL);
+    std::unordered_map<std::string, int> groups;
+    for (ParamListInfo params : requests_) {
+        if (params == NULL) {
+            group_of_.push_back(-1);
+            limits_.push_back(0);
+            continue;
+        }
+
+        econtext_->ecxt_param_list_info = params;
+        bool limit_null;
+        Datum limit_value = ExecEvalExprSwitchContext(limit, econtext_, &limit_null);
+        int64 count = limit_null ? PG_INT64_MAX : DatumGetInt64(limit_value); // LIMIT NULL/ALL
+        if (count < 0) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_ROW_COUNT_IN_LIMIT_CLAUSE), errmsg("LIMIT must not be negative")));
+        }
+        limits_.push_back(count);
+
+        std::string key;
+        for (int id = bms_next_member(used, -1); id >= 0; id = bms_next_member(used, id)) {
+            const ParamExternData& param = params->params[id - 1];
+            key += param.isnull ? 'n' : 'v';
+            if (param.isnull) continue;
+            int16 typlen;
+            bool typbyval;
+            get_typlenbyval(param.ptype, &typlen, &typbyval);
+            if (typbyval) {
+                key.append(reinterpret_cast<const char*>(&param.value), sizeof(Datum));
+                continue;
+            }
+            Size size = datumGetSize(param.value, false, typlen);
+            key.append(reinterpret_cast<const char*>(&size), sizeof(size));
+            key.append(DatumGetPointer(param.value), size);
+        }
+        auto it = groups.emplace(std::move(key), static_cast<int>(groups_.size()));
+        if (it.second) {
+            groups_.emplace_back();
+            group_limits_.push_back(0);
+        }
+        int group = it.first->second;
+        group_of_.push_back(group);
+        group_limits_[group] = Max(group_limits_[group], count);
+    }
+    econtext_->ecxt_param_list_info = NULL;
+    ResetExprContext(econtext_);
+    group_seen_.assign(groups_.size(), 0);
+    elog(DEBUG1, "[Lumos SharedScan] %zu ranking requests in %zu groups", requests_.size(), groups_.size());
+}
+
+Oid SharedScan::RelationId() const {
+    return relid_;
+}
+
+bool SharedScan::Parallelizable() const {
+    return !ranked_;
+}
+
+bool SharedScan::Indexed() const {
+    return index_ != nullptr || !has_qual_;
+}
+
+bool SharedScan::Batchable() const {
+    return index_ != nullptr && !system_attrs_;
+}
+
+AttrNumber SharedScan::MaxAttribute() const {
+    return max_attr_;
+}
+
+void SharedScan::Envelopes(std::vector<PredicateIndex::Envelope>& out) {
+    out.clear();
+    if (index_) index_->Envelopes(out);
+}
+
+const DatumKeySet* SharedScan::EqualityKeys(AttrNumber att, Oid collation) const {
+    return index_ ? index_->EqualityKeys(att, collation) : NULL;
+}
+
+void SharedScan::EqualityColumns(std::vector<AttrNumber>& out) const {
+    out.clear();
+    if (index_) index_->EqualityColumns(out);
+}
+
+int SharedScan::Route(TupleTableSlot* slot, mqo::BatchResult* result) {
+    if (index_) {
+        index_->Match(slot, candidates_);
+        if (candidates_.empty()) return 0;
+    }
+
+    ResetExprContext(econtext_);
+    econtext_->ecxt_scantuple = slot;
+    int routed = 0;
+    size_t count = index_ ? candidates_.size() : requests_.size();
+    bool recheck = !index_ || !index_->Complete();
+    bool keyed = false;
+    tuple_serial_++;
+
+    for (size_t i = 0; i < count; ++i) {
+        int r = index_ ? candidates_[i] : i;
+        if (requests_[r] == NULL) continue;
+        if (ranked_) {
+            int group = group_of_[r];
+            if (group_seen_[group] == tuple_serial_) continue; // Another request of the group decided it
+            group_seen_[group] = tuple_serial_;
+        }
+        econtext_->ecxt_param_list_info = requests_[r];
+        if (recheck && !ExecQual(qual_, econtext_)) continue;
+
+        if (ranked_) {
+            if (!keyed) { // The keys read no params, once per tuple
+                for (size_t k = 0; k < sort_keys_.size(); ++k) {
+                    current_.keys[k] = ExecEvalExprSwitchContext(sort_keys_[k], econtext_, &current_.nulls[k]);
+                }
+                keyed = true;
+            }
+            Rank(group_of_[r]);
+            continue;
+        }
+
+        routed++;
+        if (result == NULL) continue;
+        mqo::ParamRow* out = result->add_results();
+        out->add_values()->set_int_val(r);
+        for (size_t t = 0; t < targets_.size(); ++t) {
+            bool value_null;
+            Datum value = ExecEvalExprSwitchContext(targets_[t], econtext_, &value_null);
+            TypeMapper::FromDatum(value, value_null, target_types_[t], out->add_values());
+        }
+    }
+
+    econtext_->ecxt_scantuple = NULL;
+    return routed;
+}
+
+int SharedScan::Compare(const RankedRow& a, const RankedRow& b) {
+    for (size_t k = 0; k < sort_support_.size(); ++k) {
+        int cmp = ApplySortComparator(a.keys[k], a.nulls[k], b.keys[k], b.nulls[k], &sort_support_[k]);
+        if (cmp != 0) return cmp;
+    }
+    return 0;
+}
+
+void SharedScan::Rank(int group) {
+    std::vector<RankedRow>& heap = groups_[group];
+    if (group_limits_[group] == 0) return;
+    auto ahead = [this](const RankedRow& a, const RankedRow& b) { return Compare(a, b) < 0; };
+    if (static_cast<int64>(heap.size()) >= group_limits_[group]) {
+        if (Compare(current_, heap.front()) >= 0) return; // Not ahead of the last kept row
+        std::pop_heap(heap.begin(), heap.end(), ahead);
+        Release(heap.back());
+        heap.pop_back();
+    }
+
+    size_t nkeys = sort_keys_.size();
+    MemoryContext old_ctx = MemoryContextSwitchTo(scan_context_);
+    RankedRow row;
+    row.keys = static_cast<Datum*>(palloc(nkeys * sizeof(Datum)));
+    row.nulls = static_cast<bool*>(palloc(nkeys * sizeof(bool)));
+    for (size_t k = 0; k < nkeys; ++k) {
+        row.nulls[k] = current_.nulls[k];
+        row.keys[k] = row.nulls[k] ? (Datum)0 : datumCopy(current_.keys[k], sort_byval_[k], sort_typlen_[k]);
+    }
+    MemoryContextSwitchTo(old_ctx);
+
+    row.row = new mqo::ParamRow();
+    for (size_t t = 0; t < targets_.size(); ++t) {
+        bool value_null;
+        Datum value = ExecEvalExprSwitchContext(targets_[t], econtext_, &value_null);
+        TypeMapper::FromDatum(value, value_null, target_types_[t], row.row->add_values());
+    }
+    heap.push_back(row);
+    std::push_heap(heap.begin(), heap.end(), ahead);
+}
+
+void SharedScan::Release(RankedRow& row) {
+    for (size_t k = 0; k < sort_keys_.size(); ++k) {
+        if (!row.nulls[k] && !sort_byval_[k]) pfree(DatumGetPointer(row.keys[k]));
+    }
+    pfree(row.keys);
+    pfree(row.nulls);
+    delete row.row;
+}
+
+int SharedScan::Finish(mqo::BatchResult* result) {
+    if (!ranked_) return 0;
+    auto ahead = [this](const RankedRow& a, const RankedRow& b) { return Compare(a, b) < 0; };
+    for (auto& heap : groups_) std::sort_heap(heap.begin(), heap.end(), ahead);
+
+    // Each request takes the first LIMIT rows of its group, which holds at least that many when they exist.
+    int routed = 0;
+    for (size_t r = 0; r < requests_.size(); ++r) {
+        if (group_of_[r] < 0) continue;
+        const std::vector<RankedRow>& rows = groups_[group_of_[r]];
+        size_t count = static_cast<size_t>(Min(limits_[r], static_cast<int64>(rows.size())));
+        routed += count;
+        if (result == NULL) continue;
+        for (size_t i = 0; i < count; ++i) {
+            mqo::ParamRow* out = result->add_results();
+            out->add_values()->set_int_val(r);
+            out->MergeFrom(*rows[i].row);
+        }
+    }
+    return routed;
+}
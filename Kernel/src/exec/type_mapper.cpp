@@ -32,6 +32,31 @@ PgParam TypeMapper::ToPgParam(const mqo::Value& val, Oid target_type) {
     return p;
 }
 
+void TypeMapper::FromDatum(Datum value, bool isnull, Oid type_oid, mqo::Value* out) {
+    if (isnull) {
+        out->set_is_null(true);
+        return;
+    }
+
+    switch (type_oid) {
+        case INT2OID: out->set_int_val(DatumGetInt16(value)); break;
+        case INT4OID: out->set_int_val(DatumGetInt32(value)); break;
+        case INT8OID: out->set_int_val(DatumGetInt64(value)); break;
+        case FLOAT4OID: out->set_float_val(DatumGetFloat4(value)); break;
+        case FLOAT8OID: out->set_float_val(DatumGetFloat8(value)); break;
+        case BOOLOID: out->set_bool_val(DatumGetBool(value)); break;
+        default: {
+            Oid typoutput;
+            bool typisvarlena;
+            getTypeOutputInfo(type_oid, &typoutput, &typisvarlena);
+            char* text = OidOutputFunctionCall(typoutput, value);
+            out->set_string_val(text);
+            pfree(text);
+            break;
+        }
+    }
+}
+
 Oid TypeMapper::DeduceTypeOid(const mqo::Value& val) {
     switch (val.typed_value_case()) {
         case mqo::Value::kIntVal: return INT8OID;
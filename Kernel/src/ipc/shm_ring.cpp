@@ -0,0 +1,109 @@
+#include "ipc/shm_ring.hpp"
+
+extern "C" {
+#include "postgres.h"
+#include "miscadmin.h"
+#include "postmaster/postmaster.h"
+#include "storage/ipc.h"
+#include "utils/guc.h"
+}
+
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+MqoRingHeader* ShmRing::ring_ = NULL;
+int ShmRing::num_slots_ = 0;
+int ShmRing::slot_size_kb_ = 1024;
+
+static std::string RingName() {
+    return MQO_RING_NAME_PREFIX + std::to_string(PostPortNumber);
+}
+
+static void UnlinkRing(int code, Datum arg) {
+    shm_unlink(RingName().c_str());
+}
+
+void ShmRing::Init() {
+    DefineCustomIntVariable("lumos.shm_ring_slots",
+                            "Number of shared-memory payload slots for a co-located proxy (0 disables).",
+                            NULL,
+                            &num_slots_,
+                            0,
+                            0,
+                            1024,
+                            PGC_POSTMASTER,
+                            0,
+                            NULL,
+                            NULL,
+                            NULL);
+    DefineCustomIntVariable("lumos.shm_slot_size",
+                            "Size of one shared-memory payload slot.",
+                            NULL,
+                            &slot_size_kb_,
+                            1024,
+                            64,
+                            1024 * 1024,
+                            PGC_POSTMASTER,
+                            GUC_UNIT_KB,
+                            NULL,
+                            NULL,
+                            NULL);
+
+    if (!process_shared_preload_libraries_in_progress || num_slots_ == 0) return;
+
+    std::string name = RingName();
+    if (!Create()) {
+        ereport(WARNING, (errmsg("[Lumos] Could not create shared-memory ring \"%s\": %m", name.c_str())));
+        return;
+    }
+    on_proc_exit(UnlinkRing, (Datum)0);
+    elog(LOG, "[Lumos] Shared-memory ring \"%s\": %d slots x %d kB", name.c_str(), num_slots_, slot_size_kb_);
+}
+
+bool ShmRing::Create() {
+    std::string name = RingName();
+    uint64_t slot_size = static_cast<uint64_t>(slot_size_kb_) * 1024;
+    size_t size = MqoRingSize(num_slots_, slot_size);
+
+    // A segment left behind by a crashed postmaster is truncated and re-initialized.
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0660);
+    if (fd < 0) return false;
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        return false;
+    }
+    void* addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) return false;
+
+    ring_ = static_cast<MqoRingHeader*>(addr);
+    ring_->magic = 0;
+    ring_->num_slots = num_slots_;
+    ring_->slot_size = slot_size;
+    for (int i = 0; i < num_slots_; ++i) {
+        MqoSlotHeader* slot = MqoRingSlot(ring_, i);
+        slot->payload_len = 0;
+        slot->result_len = 0;
+        slot->status = 0;
+        slot->client_pid = 0;
+        slot->backend_pid = 0;
+        slot->token = 0;
+        slot->stamp = 0;
+        slot->state.store(MQO_SLOT_FREE, std::memory_order_relaxed);
+    }
+    // Published last: the proxy refuses to attach until magic is set.
+    std::atomic_thread_fence(std::memory_order_release);
+    ring_->magic = MQO_RING_MAGIC;
+    return true;
+}
+
+MqoSlotHeader* ShmRing::Slot(int slot_id) {
+    if (ring_ == NULL || slot_id < 0 || static_cast<uint32_t>(slot_id) >= ring_->num_slots) return NULL;
+    return MqoRingSlot(ring_, slot_id);
+}
+
+size_t ShmRing::SlotCapacity() {
+    return ring_ == NULL ? 0 : MqoSlotCapacity(ring_);
+}
@@ -0,0 +1,401 @@
+#include "ipc/worker_pool.hpp"
+#include "lumos_kernel.hpp"
+
+extern "C" {
+#include "postgres.h"
+#include "miscadmin.h"
+#include "access/xact.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/proc.h"
+#include "storage/shm_mq.h"
+#include "storage/shm_toc.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "tcop/tcopprot.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+#include "utils/snapmgr.h"
+}
+
+#include <unordered_map>
+#include <dlfcn.h>
+
+#define MQO_JOB_MAGIC 0x4c4a4f42 // "LJOB"
+#define MQO_JOB_QUEUE_SIZE 256
+#define MQO_JOB_KEY_REQUEST 0
+#define MQO_JOB_KEY_REPLY 1
+#define MQO_JOB_KEY_HEADER 2
+#define MQO_REPLY_QUEUE_SIZE 1024
+#define MQO_JOB_POLL_MS 1000 // Liveness check period while waiting for an unclaimed job
+
+struct WorkerSlot {
+    Latch* latch; // NULL while the worker is down
+    bool idle;
+};
+
+struct WorkerPoolShared {
+    slock_t mutex;
+    Oid database; // Set by the first worker up: jobs from other databases are refused
+    uint32 head;
+    uint32 count;
+    dsm_handle jobs[MQO_JOB_QUEUE_SIZE];
+    int num_workers;
+    WorkerSlot workers[FLEXIBLE_ARRAY_MEMBER];
+};
+
+// Who submitted the job: the worker runs it as that role, in that database only.
+struct JobHeader {
+    Oid database;
+    Oid role;
+};
+
+// Backend-local view of a submitted job
+struct PendingJob {
+    dsm_segment* seg;
+    shm_mq_handle* request;
+    shm_mq_handle* reply;
+};
+
+int WorkerPool::pool_size_ = 0;
+char* WorkerPool::worker_database_ = NULL;
+
+static WorkerPoolShared* pool = NULL;
+static int pool_workers = 0; // lumos.worker_pool_size as seen by the postmaster hooks
+static std::unordered_map<int, PendingJob> pending_jobs;
+static int next_ticket = 1;
+
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static Size PoolShmemSize(int num_workers) {
+    return add_size(offsetof(WorkerPoolShared, workers), mul_size(num_workers, sizeof(WorkerSlot)));
+}
+
+static shm_mq_result MqSend(shm_mq_handle* mqh, Size nbytes, const void* data) {
+#if PG_VERSION_NUM >= 150000
+    return shm_mq_send(mqh, nbytes, data, false, true);
+#else
+    return shm_mq_send(mqh, nbytes, data, false);
+#endif
+}
+
+#if PG_VERSION_NUM >= 150000
+static void lumos_pool_shmem_request(void) {
+    if (prev_shmem_request_hook) prev_shmem_request_hook();
+    RequestAddinShmemSpace(PoolShmemSize(pool_workers));
+}
+#endif
+
+static void lumos_pool_shmem_startup(void) {
+    if (prev_shmem_startup_hook) prev_shmem_startup_hook();
+
+    bool found;
+    LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+    pool = static_cast<WorkerPoolShared*>(ShmemInitStruct("lumos worker pool", PoolShmemSize(pool_workers), &found));
+    if (!found) {
+        memset(pool, 0, PoolShmemSize(pool_workers));
+        SpinLockInit(&pool->mutex);
+        pool->num_workers = pool_workers;
+    }
+    LWLockRelease(AddinShmemInitLock);
+}
+
+static bool PushJob(dsm_handle handle) {
+    Latch* wake = NULL;
+
+    SpinLockAcquire(&pool->mutex);
+    if (pool->count == MQO_JOB_QUEUE_SIZE) {
+        SpinLockRelease(&pool->mutex);
+        return false;
+    }
+    pool->jobs[(pool->head + pool->count) % MQO_JOB_QUEUE_SIZE] = handle;
+    pool->count++;
+    for (int i = 0; i < pool->num_workers; ++i) {
+        if (pool->workers[i].latch != NULL && pool->workers[i].idle) {
+            pool->workers[i].idle = false;
+            wake = pool->workers[i].latch;
+            break;
+        }
+    }
+    SpinLockRelease(&pool->mutex);
+
+    // No idle worker: the next worker to finish picks the job up.
+    if (wake != NULL) SetLatch(wake);
+    return true;
+}
+
+static bool AnyWorkerUp() {
+    bool up = false;
+    SpinLockAcquire(&pool->mutex);
+    for (int i = 0; i < pool->num_workers && !up; ++i) up = pool->workers[i].latch != NULL;
+    SpinLockRelease(&pool->mutex);
+    return up;
+}
+
+static void WorkerExit(int code, Datum arg) {
+    SpinLockAcquire(&pool->mutex);
+    pool->workers[DatumGetInt32(arg)].latch = NULL;
+    SpinLockRelease(&pool->mutex);
+}
+
+static bool PopJob(int worker_id, dsm_handle* handle) {
+    bool found = false;
+
+    SpinLockAcquire(&pool->mutex);
+    if (pool->count > 0) {
+        *handle = pool->jobs[pool->head];
+        pool->head = (pool->head + 1) % MQO_JOB_QUEUE_SIZE;
+        pool->count--;
+        found = true;
+    }
+    pool->workers[worker_id].idle = !found;
+    SpinLockRelease(&pool->mutex);
+    return found;
+}
+
+void WorkerPool::Init() {
+    DefineCustomIntVariable("lumos.worker_pool_size",
+                            "Number of background workers executing submitted batches (0 disables).",
+                            NULL,
+                            &pool_size_,
+                            0,
+                            0,
+                            64,
+                            PGC_POSTMASTER,
+                            0,
+                            NULL,
+                            NULL,
+                            NULL);
+    DefineCustomStringVariable("lumos.worker_database",
+                               "Database the batch workers connect to.",
+                               NULL,
+                               &worker_database_,
+                               "postgres",
+                               PGC_POSTMASTER,
+                               0,
+                               NULL,
+                               NULL,
+                               NULL);
+
+    if (!process_shared_preload_libraries_in_progress || pool_size_ == 0) return;
+    pool_workers = pool_size_;
+
+#if PG_VERSION_NUM >= 150000
+    prev_shmem_request_hook = shmem_request_hook;
+    shmem_request_hook = lumos_pool_shmem_request;
+#else
+    RequestAddinShmemSpace(PoolShmemSize(pool_workers));
+#endif
+    prev_shmem_startup_hook = shmem_startup_hook;
+    shmem_startup_hook = lumos_pool_shmem_startup;
+
+    for (int i = 0; i < pool_size_; ++i) {
+        BackgroundWorker worker;
+        memset(&worker, 0, sizeof(worker));
+        worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+        worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+        worker.bgw_restart_time = 5;
+        snprintf(worker.bgw_library_name, sizeof(worker.bgw_library_name), "%s", LibraryPath());
+        snprintf(worker.bgw_function_name, sizeof(worker.bgw_function_name), "lumos_worker_main");
+        snprintf(worker.bgw_name, sizeof(worker.bgw_name), "lumos executor %d", i);
+        snprintf(worker.bgw_type, sizeof(worker.bgw_type), "lumos executor");
+        worker.bgw_main_arg = Int32GetDatum(i);
+        RegisterBackgroundWorker(&worker);
+    }
+}
+
+const char* WorkerPool::LibraryPath() {
+    static char path[MAXPGPATH] = "";
+    if (path[0] == '\0') {
+        Dl_info info;
+        if (dladdr(reinterpret_cast<void*>(&WorkerPool::LibraryPath), &info) != 0 && info.dli_fname != NULL) {
+            strlcpy(path, info.dli_fname, sizeof(path));
+        } else {
+            strlcpy(path, "lumos_kernel", sizeof(path));
+        }
+    }
+    return path;
+}
+
+int WorkerPool::Submit(const char* data, size_t len) {
+    if (pool == NULL || pool->num_workers == 0) {
+        elog(ERROR, "[Lumos] Worker pool disabled (lumos.worker_pool_size = 0 or library not preloaded).");
+    }
+    SpinLockAcquire(&pool->mutex);
+    Oid pool_database = pool->database;
+    SpinLockRelease(&pool->mutex);
+    if (OidIsValid(pool_database) && pool_database != MyDatabaseId) {
+        elog(ERROR, "[Lumos] Worker pool serves database %u only (lumos.worker_database).", pool_database);
+    }
+
+    // The request queue holds the whole payload, so the send never waits for a worker.
+    Size request_size = MAXALIGN(len) + MAXALIGN(sizeof(Size)) + shm_mq_minimum_size;
+    shm_toc_estimator e;
+    shm_toc_initialize_estimator(&e);
+    shm_toc_estimate_chunk(&e, request_size);
+    shm_toc_estimate_chunk(&e, MQO_REPLY_QUEUE_SIZE);
+    shm_toc_estimate_chunk(&e, sizeof(JobHeader));
+    shm_toc_estimate_keys(&e, 3);
+    Size segsize = shm_toc_estimate(&e);
+
+    // Handles outlive the calling statement: mqo_wait may come in a later one.
+    MemoryContext old_ctx = MemoryContextSwitchTo(TopMemoryContext);
+    dsm_segment* seg = dsm_create(segsize, 0);
+    dsm_pin_mapping(seg);
+    shm_toc* toc = shm_toc_create(MQO_JOB_MAGIC, dsm_segment_address(seg), segsize);
+
+    JobHeader* header = static_cast<JobHeader*>(shm_toc_allocate(toc, sizeof(JobHeader)));
+    header->database = MyDatabaseId;
+    header->role = GetUserId();
+    shm_toc_insert(toc, MQO_JOB_KEY_HEADER, header);
+
+    shm_mq* request = shm_mq_create(shm_toc_allocate(toc, request_size), request_size);
+    shm_toc_insert(toc, MQO_JOB_KEY_REQUEST, request);
+    shm_mq_set_sender(request, MyProc);
+
+    shm_mq* reply = shm_mq_create(shm_toc_allocate(toc, MQO_REPLY_QUEUE_SIZE), MQO_REPLY_QUEUE_SIZE);
+    shm_toc_insert(toc, MQO_JOB_KEY_REPLY, reply);
+    shm_mq_set_receiver(reply, MyProc);
+
+    PendingJob job;
+    job.seg = seg;
+    job.request = shm_mq_attach(request, seg, NULL);
+    job.reply = shm_mq_attach(reply, seg, NULL);
+    MemoryContextSwitchTo(old_ctx);
+
+    if (MqSend(job.request, len, data) != SHM_MQ_SUCCESS || !PushJob(dsm_segment_handle(seg))) {
+        dsm_detach(seg);
+        elog(ERROR, "[Lumos] Worker pool queue full (%d jobs).", MQO_JOB_QUEUE_SIZE);
+    }
+
+    int ticket = next_ticket++;
+    pending_jobs[ticket] = job;
+    return ticket;
+}
+
+int WorkerPool::Wait(int ticket) {
+    auto it = pending_jobs.find(ticket);
+    if (it == pending_jobs.end()) {
+        elog(ERROR, "[Lumos] Unknown worker pool ticket %d.", ticket);
+    }
+    PendingJob job = it->second;
+    pending_jobs.erase(it);
+
+    // The workers are static, there is no bgworker handle to attach: once a worker has claimed the job
+    // (attached as the reply's sender) its exit detaches the queue; before that, give up when no worker
+    // is left to claim it.
+    Size nbytes;
+    void* data;
+    shm_mq_result res;
+    while ((res = shm_mq_receive(job.reply, &nbytes, &data, true)) == SHM_MQ_WOULD_BLOCK) {
+        if (shm_mq_get_sender(shm_mq_get_queue(job.reply)) == NULL && !AnyWorkerUp()) {
+            res = SHM_MQ_DETACHED;
+            break;
+        }
+        (void)WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH, MQO_JOB_POLL_MS,
+                        PG_WAIT_EXTENSION);
+        ResetLatch(MyLatch);
+        CHECK_FOR_INTERRUPTS();
+    }
+
+    int32 status = MQO_STATUS_ERROR;
+    if (res == SHM_MQ_SUCCESS && nbytes == sizeof(int32)) memcpy(&status, data, sizeof(int32));
+
+    shm_mq_detach(job.request);
+    shm_mq_detach(job.reply);
+    dsm_detach(job.seg);
+    if (res != SHM_MQ_SUCCESS) {
+        elog(ERROR, "[Lumos] Worker pool job %d lost its worker before replying.", ticket);
+    }
+    return status;
+}
+
+void WorkerPool::WorkerMain(int worker_id, LumosKernel& kernel) {
+    pqsignal(SIGTERM, die);
+    BackgroundWorkerUnblockSignals();
+    BackgroundWorkerInitializeConnection(worker_database_, NULL, 0);
+
+    before_shmem_exit(WorkerExit, Int32GetDatum(worker_id));
+    SpinLockAcquire(&pool->mutex);
+    pool->database = MyDatabaseId;
+    pool->workers[worker_id].latch = MyLatch;
+    pool->workers[worker_id].idle = false;
+    SpinLockRelease(&pool->mutex);
+    elog(LOG, "[Lumos] Executor worker %d started.", worker_id);
+
+    while (true) {
+        dsm_handle handle;
+        if (PopJob(worker_id, &handle)) {
+            RunJob(handle, kernel);
+            continue;
+        }
+
+        (void)WaitLatch(MyLatch, WL_LATCH_SET | WL_EXIT_ON_PM_DEATH, -1L, PG_WAIT_EXTENSION);
+        ResetLatch(MyLatch);
+        CHECK_FOR_INTERRUPTS();
+    }
+}
+
+void WorkerPool::RunJob(dsm_handle handle, LumosKernel& kernel) {
+    // The submitter may have given up on the job already.
+    dsm_segment* seg = dsm_attach(handle);
+    if (seg == NULL) return;
+
+    shm_toc* toc = shm_toc_attach(MQO_JOB_MAGIC, dsm_segment_address(seg));
+    JobHeader* header = static_cast<JobHeader*>(shm_toc_lookup(toc, MQO_JOB_KEY_HEADER, false));
+    shm_mq* request = static_cast<shm_mq*>(shm_toc_lookup(toc, MQO_JOB_KEY_REQUEST, false));
+    shm_mq* reply = static_cast<shm_mq*>(shm_toc_lookup(toc, MQO_JOB_KEY_REPLY, false));
+    shm_mq_set_receiver(request, MyProc);
+    shm_mq_set_sender(reply, MyProc);
+    shm_mq_handle* request_handle = shm_mq_attach(request, seg, NULL);
+    shm_mq_handle* reply_handle = shm_mq_attach(reply, seg, NULL);
+
+    volatile int32 status = MQO_STATUS_ERROR;
+    Size nbytes;
+    void* data;
+    if (header->database != MyDatabaseId) {
+        elog(WARNING, "[Lumos] Worker pool job from database %u refused, workers serve %u.", header->database,
+             MyDatabaseId);
+    } else if (shm_mq_receive(request_handle, &nbytes, &data, false) == SHM_MQ_SUCCESS) {
+        MemoryContext job_ctx = CurrentMemoryContext;
+        pgstat_report_activity(STATE_RUNNING, "lumos batch");
+        StartTransactionCommand();
+        PG_TRY();
+        {
+            // The worker's own connection is the bootstrap superuser: run the payload with the submitter's
+            // privileges. Aborting the transaction restores the worker's user id on the error path.
+            Oid save_userid;
+            int save_sec_context;
+            GetUserIdAndSecContext(&save_userid, &save_sec_context);
+            SetUserIdAndSecContext(header->role, save_sec_context | SECURITY_LOCAL_USERID_CHANGE);
+            PushActiveSnapshot(GetTransactionSnapshot());
+            status = kernel.Dispatch(static_cast<const char*>(data), nbytes);
+            PopActiveSnapshot();
+            SetUserIdAndSecContext(save_userid, save_sec_context);
+            CommitTransactionCommand();
+        }
+        PG_CATCH();
+        {
+            // Report and keep serving: a failed batch must not take the worker down.
+            MemoryContextSwitchTo(job_ctx);
+            EmitErrorReport();
+            FlushErrorState();
+            AbortCurrentTransaction();
+            status = MQO_STATUS_ERROR;
+        }
+        PG_END_TRY();
+        pgstat_report_activity(STATE_IDLE, NULL);
+    }
+
+    int32 result = status;
+    MqSend(reply_handle, sizeof(result), &result);
+    shm_mq_detach(request_handle);
+    shm_mq_detach(reply_handle);
+    dsm_detach(seg);
+}
@@ -1,42 +1,324 @@
 #include "lumos_kernel.hpp"
+#include "ipc/shm_ring.hpp"
+
+extern "C" {
+#include "access/xact.h"
+#include "miscadmin.h"
+}
+
 #include "pg_under_macro.hpp"
 #include "mqo.pb.h"
 #include "pg_redef_macro.hpp"
+#include <algorithm>
+#include <cstring>
+#include <ctime>
 #include <sstream>
 
-LumosKernel::LumosKernel() {
+#define SLOT_TRUNCATED_MARKER "\n... [truncated to the shared-memory slot]"
+
+LumosKernel::LumosKernel() : stream_status_(MQO_STATUS_OK), stream_executed_(0) {
     executor_ = std::make_unique<Executor>();
 }
 LumosKernel::~LumosKernel() {
 }
 
-void LumosKernel::Dispatch(const char* data, size_t len) {
+void LumosKernel::OnAbort() {
+    if (stream_header_) {
+        elog(DEBUG1, "[Lumos] Transaction aborted, dropping batch stream (%d requests executed).", stream_executed_);
+        stream_header_.reset();
+        stream_executed_ = 0;
+        stream_status_ = MQO_STATUS_OK;
+    }
+    executor_->GetRuntime().ResetSessionContext();
+    executor_->GetRuntime().ResetWindow();
+}
+
+void LumosKernel::ParallelWorkerMain(shm_toc* toc) {
+    try {
+        executor_->ParallelWorkerMain(toc);
+    } catch (const std::exception& e) {
+        elog(ERROR, "LumosKernel Exception: %s", e.what());
+    }
+}
+
+void LumosKernel::InvalidateRelation(Oid relid) {
+    executor_->GetRuntime().InvalidateRelation(relid);
+}
+
+void LumosKernel::InvalidateTypes() {
+    executor_->GetPlanner().InvalidateTypes();
+}
+
+int LumosKernel::Dispatch(const char* data, size_t len, mqo::BatchResult* result) {
     mqo::BatchPayload payload;
     if (!payload.ParseFromArray(data, len)) {
         elog(ERROR, "LumosKernel: Protobuf parsing failed.");
-        return;
+        return 0;
     }
 
+    if (!ResolveTemplate(payload)) return MQO_STATUS_TEMPLATE_MISS;
+
     if (payload.dry_run()) {
         elog(DEBUG1, "[Lumos] Mode: Dry-Run (Sandboxed Execution)");
     } else if (!payload.scan_table().empty()) {
-        elog(DEBUG1, "[Lumos] Mode: Shared Scan on %s", payload.scan_table().c_str());
+        elog(DEBUG1, "[Lumos] Scan hint: %s.%s", payload.scan_table().c_str(), payload.scan_col().c_str());
     }
 
     try {
-        int count = executor_->Execute(payload);
+        int count = executor_->Execute(payload, result);
         elog(DEBUG1, "[Lumos] Batch completed. Processed/Simulated %d rows.", count);
     } catch (const std::exception& e) {
         elog(ERROR, "LumosKernel Exception: %s", e.what());
     }
+    return MQO_STATUS_OK;
+}
+
+int LumosKernel::DispatchResult(const char* data, size_t len, std::string& out) {
+    mqo::BatchResult result;
+    int status = Dispatch(data, len, &result);
+    if (status == MQO_STATUS_OK && !result.SerializeToString(&out)) {
+        elog(ERROR, "LumosKernel: Protobuf serialization failed.");
+    }
+    return status;
+}
+
+void LumosKernel::DispatchMulti(const char* data, size_t len, std::string& out) {
+    mqo::MultiPayload multi;
+    if (!multi.ParseFromArray(data, len)) {
+        elog(ERROR, "LumosKernel: Protobuf parsing failed.");
+        return;
+    }
+
+    mqo::MultiResult multi_result;
+    std::vector<const mqo::BatchPayload*> batches;
+    std::vector<mqo::BatchResult*> results;
+    for (const auto& batch : multi.batches()) {
+        mqo::BatchResult* result = multi_result.add_results();
+        if (!ResolveTemplate(batch)) {
+            multi_result.add_status(MQO_STATUS_TEMPLATE_MISS);
+            continue;
+        }
+        multi_result.add_status(MQO_STATUS_OK);
+        batches.push_back(&batch);
+        results.push_back(result);
+    }
+
+    try {
+        executor_->ExecuteMulti(batches, results);
+        elog(DEBUG1, "[Lumos] Multi-template payload completed (%d batches).", multi.batches_size());
+    } catch (const std::exception& e) {
+        elog(ERROR, "LumosKernel Exception: %s", e.what());
+    }
+
+    if (!multi_result.SerializeToString(&out)) {
+        elog(ERROR, "LumosKernel: Protobuf serialization failed.");
+    }
+}
+
+void LumosKernel::DispatchWindow(const char* data, size_t len, std::string& out) {
+    mqo::WindowPayload window;
+    if (!window.ParseFromArray(data, len)) {
+        elog(ERROR, "LumosKernel: Protobuf parsing failed.");
+        return;
+    }
+
+    mqo::MultiResult window_result;
+    std::vector<const mqo::BatchPayload*> batches;
+    std::vector<mqo::BatchResult*> results;
+    bool missed = false;
+    for (const auto& batch : window.batches()) {
+        bool resolved = ResolveTemplate(batch);
+        missed = missed || !resolved;
+        window_result.add_status(resolved ? MQO_STATUS_OK : MQO_STATUS_TEMPLATE_MISS);
+        batches.push_back(&batch);
+        results.push_back(window_result.add_results());
+    }
+
+    // Order matters inside a window, a partial run is never started.
+    if (missed) {
+        for (int i = 0; i < window_result.status_size(); ++i) {
+            if (window_result.status(i) == MQO_STATUS_OK) window_result.set_status(i, MQO_STATUS_ERROR);
+        }
+    } else {
+        try {
+            bool committed = executor_->ExecuteWindow(batches, results);
+            window_result.set_rolled_back(!committed);
+            elog(DEBUG1, "[Lumos] Window completed (%d batches, %s).", window.batches_size(),
+                 committed ? "committed" : "rolled back");
+        } catch (const std::exception& e) {
+            elog(ERROR, "LumosKernel Exception: %s", e.what());
+        }
+    }
+
+    if (!window_result.SerializeToString(&out)) {
+        elog(ERROR, "LumosKernel: Protobuf serialization failed.");
+    }
+}
+
+bool LumosKernel::ResolveTemplate(const mqo::BatchPayload& payload) {
+    if (payload.template_id() == 0) return true;
+    if (!payload.template_sql().empty()) {
+        executor_->GetPlanner().RegisterTemplate(payload.template_id(), payload.template_sql());
+        return true;
+    }
+    if (!executor_->GetPlanner().HasTemplate(payload.template_id())) {
+        elog(DEBUG1, "[Lumos] Template %lu not registered, requesting resend.", payload.template_id());
+        return false;
+    }
+    return true;
+}
+
+int LumosKernel::BeginStream(const char* data, size_t len) {
+    if (stream_header_) {
+        elog(ERROR, "LumosKernel: mqo_batch_begin called inside an open batch stream (%d requests executed).",
+             stream_executed_);
+    }
+    // The stream's sub-transaction spans statements; only a transaction block can roll it back on error.
+    if (!IsTransactionBlock()) {
+        elog(ERROR, "LumosKernel: mqo_batch_begin must run inside a transaction block.");
+    }
+    stream_header_ = std::make_unique<mqo::BatchPayload>();
+    stream_executed_ = 0;
+    stream_status_ = MQO_STATUS_OK;
+
+    if (!stream_header_->ParseFromArray(data, len)) {
+        stream_header_.reset();
+        elog(ERROR, "LumosKernel: Protobuf parsing failed.");
+        return MQO_STATUS_ERROR;
+    }
+
+    // On a miss the stream stays open so the pipelined appends drain quietly,
+    // mqo_batch_execute then reports the miss.
+    if (!ResolveTemplate(*stream_header_)) {
+        stream_status_ = MQO_STATUS_TEMPLATE_MISS;
+    } else {
+        executor_->BeginStream();
+    }
+    return stream_status_;
+}
+
+int LumosKernel::AppendStream(const char* data, size_t len) {
+    if (!stream_header_) {
+        elog(ERROR, "LumosKernel: mqo_batch_append called without mqo_batch_begin.");
+        return 0;
+    }
+    if (stream_status_ != MQO_STATUS_OK) return 0;
+
+    mqo::BatchChunk chunk;
+    if (!chunk.ParseFromArray(data, len)) {
+        elog(ERROR, "LumosKernel: Protobuf parsing failed.");
+        return 0;
+    }
+
+    int count = 0;
+    try {
+        count = executor_->ExecuteChunk(*stream_header_, chunk);
+    } catch (const std::exception& e) {
+        elog(ERROR, "LumosKernel Exception: %s", e.what());
+    }
+    stream_executed_ += count;
+    return count;
+}
+
+int LumosKernel::FinishStream() {
+    if (!stream_header_) {
+        elog(ERROR, "LumosKernel: mqo_batch_execute called without mqo_batch_begin.");
+        return 0;
+    }
+    if (stream_status_ == MQO_STATUS_OK && !executor_->FinishStream()) {
+        // The error aborts the stream's sub-transaction, every chunk's writes with it.
+        elog(ERROR, "LumosKernel: batch stream rolled back, a request failed (%d requests executed).",
+             stream_executed_);
+    }
+    int result = stream_status_ == MQO_STATUS_OK ? stream_executed_ : stream_status_;
+    elog(DEBUG1, "[Lumos] Batch stream completed. Processed/Simulated %d requests.", stream_executed_);
+
+    stream_header_.reset();
+    stream_executed_ = 0;
+    stream_status_ = MQO_STATUS_OK;
+    return result;
+}
+
+int LumosKernel::DispatchSlot(int slot_id, uint64 token) {
+    MqoSlotHeader* slot = ShmRing::Slot(slot_id);
+    if (slot == NULL) {
+        elog(ERROR, "LumosKernel: Shared-memory slot %d unavailable (lumos.shm_ring_slots).", slot_id);
+    }
+
+    uint32_t expected = MQO_SLOT_READY;
+    if (!slot->state.compare_exchange_strong(expected, MQO_SLOT_BUSY)) {
+        elog(ERROR, "LumosKernel: Shared-memory slot %d is not ready (state %u).", slot_id, expected);
+    }
+
+    // The payload is copied out first and the token checked after: the bytes parsed are the bytes the
+    // token vouched for, whatever the slot's writer does meanwhile. The length is bounded by the slot.
+    char* data = MqoSlotData(slot);
+    size_t len = slot->payload_len;
+    size_t capacity = ShmRing::SlotCapacity();
+    char* payload = static_cast<char*>(palloc(Min(len, capacity)));
+    memcpy(payload, data, Min(len, capacity));
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    // The token binds the call to the proxy that filled the slot: other sessions cannot run its payload.
+    if (slot->token != token) {
+        slot->state.store(MQO_SLOT_READY, std::memory_order_release);
+        elog(ERROR, "LumosKernel: Shared-memory slot %d is not owned by the caller.", slot_id);
+    }
+    if (len > capacity) {
+        slot->state.store(MQO_SLOT_FREE, std::memory_order_release);
+        elog(ERROR, "LumosKernel: Shared-memory slot %d claims a %zu-byte payload, the slot holds %zu.", slot_id,
+             len, capacity);
+    }
+    slot->backend_pid = MyProcPid;
+    slot->stamp = time(NULL);
+
+    // The result overwrites the slot's payload.
+    int status = MQO_STATUS_ERROR;
+    PG_TRY();
+    {
+        if (slot->kind == MQO_SLOT_DEBUG) {
+            std::string report = DebugAnalyze(payload, len);
+            if (report.size() > capacity) {
+                elog(WARNING, "LumosKernel: Debug report of %zu bytes truncated to the %zu-byte slot.", report.size(),
+                     capacity);
+                report.resize(capacity - strlen(SLOT_TRUNCATED_MARKER));
+                report += SLOT_TRUNCATED_MARKER;
+            }
+            memcpy(data, report.data(), report.size());
+            slot->result_len = report.size();
+            status = MQO_STATUS_OK;
+        } else {
+            slot->result_len = 0;
+            status = Dispatch(payload, len);
+        }
+    }
+    PG_CATCH();
+    {
+        // The error reaches the proxy through the call itself: hand the slot straight back to the ring.
+        slot->backend_pid = 0;
+        slot->stamp = time(NULL);
+        slot->state.store(MQO_SLOT_FREE, std::memory_order_release);
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+    pfree(payload);
+
+    slot->status = status;
+    slot->backend_pid = 0;
+    slot->stamp = time(NULL);
+    slot->state.store(MQO_SLOT_DONE, std::memory_order_release);
+    return status;
 }
 
 std::string LumosKernel::DebugAnalyze(const char* data, size_t len) {
     mqo::BatchPayload payload;
     if (!payload.ParseFromArray(data, len)) return "Parse Error";
 
+    bool registered = payload.template_id() != 0 && executor_->GetPlanner().HasTemplate(payload.template_id());
+
     std::stringstream ss;
     ss << "SQL: " << payload.template_sql() << "\n"
+       << "TemplateId: " << payload.template_id() << (registered ? " (registered)" : "") << "\n"
        << "Rows: " << payload.rows_size() << "\n"
        << "DryRun: " << (payload.dry_run() ? "YES" : "NO") << "\n";
 
@@ -47,10 +329,19 @@ std::string LumosKernel::DebugAnalyze(const char* data, size_t len) {
     ss << "]\n";
 
     if (!payload.scan_table().empty()) {
-        ss << "ScanHint: Table=" << payload.scan_table() << ", Col=" << payload.scan_col();
+        ss << "ScanHint: Table=" << payload.scan_table() << ", Col=" << payload.scan_col() << "\n";
     } else {
-        ss << "ScanHint: NONE";
+        ss << "ScanHint: NONE\n";
     }
 
+    if (!ResolveTemplate(payload)) {
+        ss << "SharedScan: not attempted (template not registered)";
+        return ss.str();
+    }
+    try {
+        ss << executor_->CheckSharedScan(payload);
+    } catch (const std::exception& e) {
+        elog(ERROR, "LumosKernel Exception: %s", e.what());
+    }
     return ss.str();
 }
\ No newline at end of file
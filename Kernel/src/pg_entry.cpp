@@ -1,20 +1,105 @@
 #include "lumos_kernel.hpp"
+#include "exec/column_cache.hpp"
+#include "ipc/shm_ring.hpp"
+#include "ipc/worker_pool.hpp"
 
 extern "C" {
 #include "postgres.h"
 #include "fmgr.h"
+#include "access/xact.h"
+#include "catalog/pg_type.h"
+#include "storage/ipc.h"
 #include "utils/bytea.h"
 #include "utils/builtins.h"
+#include "utils/inval.h"
+#include "utils/syscache.h"
 
 #ifdef PG_MODULE_MAGIC
 PG_MODULE_MAGIC;
 #endif
 
+void _PG_init(void);
+
 PG_FUNCTION_INFO_V1(mqo_dispatch);
 Datum mqo_dispatch(PG_FUNCTION_ARGS);
 
+PG_FUNCTION_INFO_V1(mqo_dispatch_result);
+Datum mqo_dispatch_result(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(mqo_dispatch_multi);
+Datum mqo_dispatch_multi(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(mqo_dispatch_window);
+Datum mqo_dispatch_window(PG_FUNCTION_ARGS);
+
 PG_FUNCTION_INFO_V1(mqo_debug);
 Datum mqo_debug(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(mqo_dispatch_slot);
+Datum mqo_dispatch_slot(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(mqo_batch_begin);
+Datum mqo_batch_begin(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(mqo_batch_append);
+Datum mqo_batch_append(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(mqo_batch_execute);
+Datum mqo_batch_execute(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(mqo_submit);
+Datum mqo_submit(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(mqo_wait);
+Datum mqo_wait(PG_FUNCTION_ARGS);
+
+PGDLLEXPORT void lumos_worker_main(Datum main_arg);
+PGDLLEXPORT void lumos_parallel_main(dsm_segment* seg, shm_toc* toc);
+}
+
+// Per-backend kernel; forked backends inherit the instance when preloaded.
+static LumosKernel* lumos_kernel = NULL;
+static bool lumos_exit_registered = false;
+
+static void lumos_shutdown(int code, Datum arg) {
+    delete lumos_kernel;
+    lumos_kernel = NULL;
+}
+
+static void lumos_xact_callback(XactEvent event, void* arg) {
+    if (lumos_kernel == NULL) return;
+    if (event == XACT_EVENT_ABORT || event == XACT_EVENT_PARALLEL_ABORT) {
+        lumos_kernel->OnAbort();
+    }
+}
+
+static void lumos_relcache_callback(Datum arg, Oid relid) {
+    if (lumos_kernel != NULL) lumos_kernel->InvalidateRelation(relid);
+}
+
+static void lumos_type_callback(Datum arg, int cacheid, uint32 hashvalue) {
+    if (lumos_kernel != NULL) lumos_kernel->InvalidateTypes();
+}
+
+static LumosKernel& GetKernel() {
+    // on_proc_exit handlers are reset at fork, so register from the backend itself
+    if (!lumos_exit_registered) {
+        on_proc_exit(lumos_shutdown, (Datum)0);
+        lumos_exit_registered = true;
+    }
+    return *lumos_kernel;
+}
+
+void _PG_init(void) {
+    ShmRing::Init();
+    WorkerPool::Init();
+    ColumnCache::Init();
+    Executor::Init();
+
+    lumos_kernel = new LumosKernel();
+    RegisterXactCallback(lumos_xact_callback, NULL);
+    CacheRegisterRelcacheCallback(lumos_relcache_callback, (Datum)0);
+    CacheRegisterSyscacheCallback(TYPEOID, lumos_type_callback, (Datum)0);
 }
 
 Datum mqo_dispatch(PG_FUNCTION_ARGS) {
@@ -23,21 +108,110 @@ Datum mqo_dispatch(PG_FUNCTION_ARGS) {
     const char* data_content = VARDATA_ANY(data_ptr);
 
     try {
-        LumosKernel kernel;
-        kernel.Dispatch(data_content, data_len);
-        PG_RETURN_INT32(1);
+        PG_RETURN_INT32(GetKernel().Dispatch(data_content, data_len));
     } catch (...) {
         ereport(ERROR, (errmsg("[Lumos] Critical Dispatch Error.")));
     }
     PG_RETURN_INT32(0);
 }
 
+Datum mqo_dispatch_result(PG_FUNCTION_ARGS) {
+    bytea* data_ptr = PG_GETARG_BYTEA_P(0);
+    size_t data_len = VARSIZE_ANY_EXHDR(data_ptr);
+    const char* data_content = VARDATA_ANY(data_ptr);
+
+    // NULL on a template miss, the caller resends with template_sql.
+    std::string out;
+    if (GetKernel().DispatchResult(data_content, data_len, out) != MQO_STATUS_OK) PG_RETURN_NULL();
+
+    bytea* result = static_cast<bytea*>(palloc(VARHDRSZ + out.size()));
+    SET_VARSIZE(result, VARHDRSZ + out.size());
+    memcpy(VARDATA(result), out.data(), out.size());
+    PG_RETURN_BYTEA_P(result);
+}
+
+Datum mqo_dispatch_multi(PG_FUNCTION_ARGS) {
+    bytea* data_ptr = PG_GETARG_BYTEA_P(0);
+    size_t data_len = VARSIZE_ANY_EXHDR(data_ptr);
+    const char* data_content = VARDATA_ANY(data_ptr);
+
+    std::string out;
+    GetKernel().DispatchMulti(data_content, data_len, out);
+
+    bytea* result = static_cast<bytea*>(palloc(VARHDRSZ + out.size()));
+    SET_VARSIZE(result, VARHDRSZ + out.size());
+    memcpy(VARDATA(result), out.data(), out.size());
+    PG_RETURN_BYTEA_P(result);
+}
+
+Datum mqo_dispatch_window(PG_FUNCTION_ARGS) {
+    bytea* data_ptr = PG_GETARG_BYTEA_P(0);
+    size_t data_len = VARSIZE_ANY_EXHDR(data_ptr);
+    const char* data_content = VARDATA_ANY(data_ptr);
+
+    std::string out;
+    GetKernel().DispatchWindow(data_content, data_len, out);
+
+    bytea* result = static_cast<bytea*>(palloc(VARHDRSZ + out.size()));
+    SET_VARSIZE(result, VARHDRSZ + out.size());
+    memcpy(VARDATA(result), out.data(), out.size());
+    PG_RETURN_BYTEA_P(result);
+}
+
 Datum mqo_debug(PG_FUNCTION_ARGS) {
     bytea* data_ptr = PG_GETARG_BYTEA_P(0);
     size_t data_len = VARSIZE_ANY_EXHDR(data_ptr);
     const char* data_content = VARDATA_ANY(data_ptr);
 
-    LumosKernel kernel;
-    std::string report = kernel.DebugAnalyze(data_content, data_len);
+    std::string report = GetKernel().DebugAnalyze(data_content, data_len);
     PG_RETURN_TEXT_P(cstring_to_text(report.c_str()));
+}
+
+Datum mqo_dispatch_slot(PG_FUNCTION_ARGS) {
+    int32 slot_id = PG_GETARG_INT32(0);
+    uint64 token = static_cast<uint64>(PG_GETARG_INT64(1));
+
+    PG_RETURN_INT32(GetKernel().DispatchSlot(slot_id, token));
+}
+
+Datum mqo_batch_begin(PG_FUNCTION_ARGS) {
+    bytea* data_ptr = PG_GETARG_BYTEA_P(0);
+    size_t data_len = VARSIZE_ANY_EXHDR(data_ptr);
+    const char* data_content = VARDATA_ANY(data_ptr);
+
+    PG_RETURN_INT32(GetKernel().BeginStream(data_content, data_len));
+}
+
+Datum mqo_batch_append(PG_FUNCTION_ARGS) {
+    bytea* data_ptr = PG_GETARG_BYTEA_P(0);
+    size_t data_len = VARSIZE_ANY_EXHDR(data_ptr);
+    const char* data_content = VARDATA_ANY(data_ptr);
+
+    PG_RETURN_INT32(GetKernel().AppendStream(data_content, data_len));
+}
+
+Datum mqo_batch_execute(PG_FUNCTION_ARGS) {
+    PG_RETURN_INT32(GetKernel().FinishStream());
+}
+
+Datum mqo_submit(PG_FUNCTION_ARGS) {
+    bytea* data_ptr = PG_GETARG_BYTEA_P(0);
+    size_t data_len = VARSIZE_ANY_EXHDR(data_ptr);
+    const char* data_content = VARDATA_ANY(data_ptr);
+
+    PG_RETURN_INT32(WorkerPool::Submit(data_content, data_len));
+}
+
+Datum mqo_wait(PG_FUNCTION_ARGS) {
+    int32 ticket = PG_GETARG_INT32(0);
+
+    PG_RETURN_INT32(WorkerPool::Wait(ticket));
+}
+
+void lumos_worker_main(Datum main_arg) {
+    WorkerPool::WorkerMain(DatumGetInt32(main_arg), GetKernel());
+}
+
+void lumos_parallel_main(dsm_segment* seg, shm_toc* toc) {
+    GetKernel().ParallelWorkerMain(toc);
 }
\ No newline at end of file
@@ -20,6 +20,10 @@ struct HashUtils {
     }
 };
 
+// Kernel mqo_dispatch return codes (see Kernel/include/lumos_kernel.hpp)
+constexpr int KERNEL_STATUS_OK = 1;
+constexpr int KERNEL_STATUS_TEMPLATE_MISS = -1;
+
 // SQL Params Type Enum
 enum class ParamType {
     INTEGER,
@@ -3,6 +3,7 @@
 #include <iostream>
 #include <string>
 #include <stdexcept>
+#include <vector>
 #include <libpq-fe.h>
 
 class PGConnection {
@@ -50,6 +51,59 @@ public:
         PQclear(res);
     }
 
+    // Pipeline mode: queries are flushed as they are queued, results are collected at sync
+    void PipelineBegin() {
+        if (PQenterPipelineMode(conn_) != 1) {
+            throw std::runtime_error("Pipeline mode unavailable: " + std::string(PQerrorMessage(conn_)));
+        }
+    }
+
+    void PipelineSend(const std::string& sql) {
+        if (PQsendQueryParams(conn_, sql.c_str(), 0, nullptr, nullptr, nullptr, nullptr, 0) != 1 ||
+            PQflush(conn_) < 0) {
+            throw std::runtime_error("Pipeline send failed: " + std::string(PQerrorMessage(conn_)));
+        }
+    }
+
+    // Returns the first value of every queued query, in order. Pipeline mode ends here, thrown or not.
+    std::vector<std::string> PipelineSync() {
+        PipelineExit exit_guard{conn_};
+        if (PQpipelineSync(conn_) != 1) {
+            throw std::runtime_error("Pipeline sync failed: " + std::string(PQerrorMessage(conn_)));
+        }
+
+        std::vector<std::string> results;
+        std::string err;
+        while (true) {
+            PGresult* res = PQgetResult(conn_);
+            if (res == nullptr) {
+                // End of one query's results
+                if (PQstatus(conn_) == CONNECTION_BAD) throw std::runtime_error("Pipeline connection lost");
+                continue;
+            }
+
+            ExecStatusType status = PQresultStatus(res);
+            if (status == PGRES_PIPELINE_SYNC) {
+                PQclear(res);
+                break;
+            }
+            if (status == PGRES_TUPLES_OK && PQntuples(res) > 0 && PQnfields(res) > 0) {
+                results.emplace_back(PQgetvalue(res, 0, 0));
+            } else if (status == PGRES_FATAL_ERROR && err.empty()) {
+                err = PQresultErrorMessage(res);
+            }
+            PQclear(res);
+        }
+
+        if (!err.empty()) throw std::runtime_error("Pipeline failed: " + err);
+        return results;
+    }
+
 private:
+    struct PipelineExit {
+        PGconn* conn;
+        ~PipelineExit() { PQexitPipelineMode(conn); }
+    };
+
     PGconn* conn_;
 };
\ No newline at end of file
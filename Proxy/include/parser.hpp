@@ -6,5 +6,9 @@ class SQLParser {
 public:
     static bool Analyze(int req_id, const std::string& sql, ParsedQuery& out_result);
 
+    // SELECT of plain aggregates (count/sum/avg/min/max) over one base table, no GROUP BY/HAVING/ORDER/LIMIT.
+    // Such templates can share one kernel scan with others on the same relation.
+    static bool AggregateOnlyRelation(const std::string& sql, std::string& out_relation);
+
 private:
 };
@@ -4,10 +4,25 @@
 #include "db_utils.hpp"
 
 #include <map>
+#include <unordered_set>
 #include <mutex>
 #include <thread>
 #include <atomic>
 
+namespace mqo {
+class BatchPayload;
+class MultiResult;
+class ParamRow;
+}
+
+namespace google {
+namespace protobuf {
+class MessageLite;
+}
+}
+
+class ShmRingClient;
+
 class BatchScheduler {
 public:
     BatchScheduler(size_t max_batch_size, size_t window_ms, bool dry_run, const std::string& conn_str);
@@ -16,13 +31,44 @@ public:
     // Entry point for submission
     void Submit(int req_id, const std::string& sql);
 
+    // Co-located kernel: ship payloads through its shared-memory ring instead of the socket
+    void EnableShmTransport(const std::string& ring_name);
+
+    // Kernel worker pool: each window's batches are submitted together and collected afterwards
+    void EnableWorkerPool();
+
+    // Reasoning windows: every window's batches go out as one WindowPayload (one round trip)
+    void EnableWindowDispatch();
+
+    // Single batches go through mqo_debug and print the kernel's report instead of executing
+    void EnableDebugReports();
+
+    // Debug reports whose shared scan disagreed with running the requests alone
+    int CheckFailures() const;
+
+    // Runs one batch right away, outside the window (benchmarks); false unless the kernel reported success
+    bool ExecuteNow(const QueryBatch& batch);
+
 private:
     void RunLoop();
-    void FlushBatch(const QueryBatch& batch, bool use_debug_mode = false);
+    bool FlushBatch(const QueryBatch& batch);
+    void FlushBatchesToPool();
+    void FlushWindow();
+    void FlushMultiBatch(const std::string& relation, const std::vector<const QueryBatch*>& batches);
 
-    std::string GenerateKernelPayload(const QueryBatch& batch, bool use_debug_func);
+    std::string SendBatch(const QueryBatch& batch, bool use_debug_func, bool with_template);
+    std::string SendBatchStreaming(const QueryBatch& batch, bool with_template);
+    void SendMultiBatch(const std::vector<const QueryBatch*>& batches, bool force_template, mqo::MultiResult& result);
+    void SendWindow(const std::vector<const QueryBatch*>& batches, mqo::MultiResult& result);
+    std::string KernelCall(const std::string& func, const google::protobuf::MessageLite& message);
+    void BuildPayload(const QueryBatch& batch, bool with_template, mqo::BatchPayload& proto_payload);
+    void BuildHeader(const QueryBatch& batch, bool with_template, mqo::BatchPayload& proto_payload);
+    void FillParamRow(const ParsedQuery& query, mqo::ParamRow* row);
+    std::string GenerateKernelPayload(const mqo::BatchPayload& proto_payload, bool use_debug_func);
+    uint64_t TemplateId(const QueryBatch& batch);
 
     std::string ToHex(const std::string& input);
+    std::string FromHex(const std::string& input); // bytea text output (\x...) -> bytes
     std::string GetPGTypeName(ParamType type);
     void TryExtractScanHint(const std::string& sql, std::string& out_table, std::string& out_col);
 
@@ -32,8 +78,16 @@ private:
     size_t window_ms_;
 
     bool dry_run_mode_;
+    bool use_worker_pool_;
+    bool use_window_dispatch_;
+    bool use_debug_reports_;
 
     std::unique_ptr<PGConnection> db_conn_;
+    // Template ids already registered on db_conn_'s backend
+    std::unordered_set<uint64_t> registered_templates_;
+    std::unique_ptr<ShmRingClient> shm_ring_;
+
+    std::atomic<int> check_failures_;
 
     std::thread worker_thread_;
     std::mutex queue_mutex_;
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Shared-memory ring layout, mirrored from Kernel/include/ipc/shm_ring_layout.hpp.
+// [MqoRingHeader][slot 0: MqoSlotHeader | data] ... [slot N-1: MqoSlotHeader | data]
+
+#define MQO_RING_MAGIC 0x4c554d52u // "LUMR"
+#define MQO_RING_NAME_PREFIX "/lumos_ring." // + server port
+#define MQO_SLOT_STALE_SECONDS 30           // Non-free slots this old are reclaimed once their owner is gone
+
+enum MqoSlotState : uint32_t {
+    MQO_SLOT_FREE = 0,    // Unowned (also where the kernel leaves a slot whose dispatch failed)
+    MQO_SLOT_WRITING = 1, // Proxy is serializing a payload into data
+    MQO_SLOT_READY = 2,   // Payload complete, waiting for mqo_dispatch_slot()
+    MQO_SLOT_BUSY = 3,    // Kernel is executing in place
+    MQO_SLOT_DONE = 4     // Status/result written back, proxy releases the slot
+};
+
+enum MqoSlotKind : uint32_t {
+    MQO_SLOT_DISPATCH = 0,
+    MQO_SLOT_DEBUG = 1 // Result data holds the mqo_debug report
+};
+
+struct MqoRingHeader {
+    uint32_t magic;
+    uint32_t num_slots;
+    uint64_t slot_size; // Bytes per slot, MqoSlotHeader included
+};
+
+struct MqoSlotHeader {
+    std::atomic<uint32_t> state;
+    uint32_t kind;
+    uint32_t payload_len;
+    uint32_t result_len;
+    int32_t status;
+    int32_t client_pid;  // Proxy that acquired the slot
+    int32_t backend_pid; // Backend executing it while BUSY
+    uint32_t reserved;
+    uint64_t token; // Per-acquisition secret, mqo_dispatch_slot() must present it
+    int64_t stamp;  // Unix seconds of the last state change, for reclaiming slots of dead owners
+};
+
+inline uint64_t MqoRingSize(uint32_t num_slots, uint64_t slot_size) {
+    return sizeof(MqoRingHeader) + static_cast<uint64_t>(num_slots) * slot_size;
+}
+
+inline MqoSlotHeader* MqoRingSlot(MqoRingHeader* ring, uint32_t slot_id) {
+    char* base = reinterpret_cast<char*>(ring) + sizeof(MqoRingHeader);
+    return reinterpret_cast<MqoSlotHeader*>(base + static_cast<uint64_t>(slot_id) * ring->slot_size);
+}
+
+inline char* MqoSlotData(MqoSlotHeader* slot) {
+    return reinterpret_cast<char*>(slot) + sizeof(MqoSlotHeader);
+}
+
+inline uint64_t MqoSlotCapacity(const MqoRingHeader* ring) {
+    return ring->slot_size - sizeof(MqoSlotHeader);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "shm_ring_layout.hpp"
+
+// Client side of the kernel's shared-memory ring (server runs with lumos.shm_ring_slots > 0).
+// Payloads are serialized straight into a slot and executed via mqo_dispatch_slot(slot, token).
+class ShmRingClient {
+public:
+    explicit ShmRingClient(const std::string& ring_name);
+    ~ShmRingClient();
+
+    // Claims a free slot for writing, -1 when all slots are in use (after reclaiming those of dead owners).
+    int AcquireSlot();
+    // Secret of the current acquisition, passed to mqo_dispatch_slot().
+    int64_t SlotToken(int slot_id) const;
+    char* SlotData(int slot_id);
+    size_t SlotCapacity() const;
+
+    void Publish(int slot_id, size_t payload_len, bool debug);
+    std::string ReadResult(int slot_id);
+    // No-op when the slot already went back to the ring (failed dispatch) or to another owner.
+    void Release(int slot_id);
+
+private:
+    int TryAcquire();
+    void ReclaimStale();
+
+    MqoRingHeader* ring_;
+    size_t map_size_;
+    std::atomic<uint32_t> next_slot_;
+    std::vector<uint64_t> tokens_; // Per slot, written by its current owner only
+};
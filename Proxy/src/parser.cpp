@@ -10,6 +10,8 @@
 
 #define TOKEN_MINUS 45
 
+static const std::unordered_set<std::string> SHAREABLE_AGGREGATES = {"count", "sum", "avg", "min", "max"};
+
 bool SQLParser::Analyze(int req_id, const std::string& sql, ParsedQuery& out_result) {
     auto start_time = std::chrono::high_resolution_clock::now();
 
@@ -111,4 +113,42 @@ bool SQLParser::Analyze(int req_id, const std::string& sql, ParsedQuery& out_res
     }
 
     return true;
-}
\ No newline at end of file
+}
+
+bool SQLParser::AggregateOnlyRelation(const std::string& sql, std::string& out_relation) {
+    PgQueryProtobufParseResult parse_result = pg_query_parse_protobuf(sql.c_str());
+    if (parse_result.error) {
+        pg_query_free_protobuf_parse_result(parse_result);
+        return false;
+    }
+
+    pg_query_cpp::ParseResult tree;
+    bool parse_success = tree.ParseFromArray(parse_result.parse_tree.data, parse_result.parse_tree.len);
+    pg_query_free_protobuf_parse_result(parse_result);
+    if (!parse_success || tree.stmts_size() != 1 || !tree.stmts(0).stmt().has_select_stmt()) {
+        return false;
+    }
+
+    const auto& select = tree.stmts(0).stmt().select_stmt();
+    if (select.from_clause_size() != 1 || !select.from_clause(0).has_range_var() || select.group_clause_size() > 0 ||
+        select.has_having_clause() || select.sort_clause_size() > 0 || select.has_limit_count() ||
+        select.has_limit_offset() || select.has_with_clause() || select.distinct_clause_size() > 0 ||
+        select.target_list_size() == 0) {
+        return false;
+    }
+
+    for (const auto& target : select.target_list()) {
+        if (!target.has_res_target() || !target.res_target().val().has_func_call()) return false;
+        const auto& func = target.res_target().val().func_call();
+        if (func.agg_distinct() || func.has_agg_filter() || func.has_over() || func.agg_order_size() > 0 ||
+            func.funcname_size() == 0) {
+            return false;
+        }
+        const auto& name = func.funcname(func.funcname_size() - 1);
+        if (!name.has_string() || SHAREABLE_AGGREGATES.count(name.string().sval()) == 0) return false;
+    }
+
+    const auto& rel = select.from_clause(0).range_var();
+    out_relation = rel.schemaname().empty() ? rel.relname() : rel.schemaname() + "." + rel.relname();
+    return true;
+}
@@ -2,14 +2,27 @@
 #include <sstream>
 #include <vector>
 #include <regex>
+#include <algorithm>
 
 #include "scheduler.hpp"
+#include "shm_transport.hpp"
 #include "pg_query.h"
 #include "parser.hpp"
 #include "mqo.pb.h"
 
+// Batches above the threshold are streamed to the kernel in chunks over a pipeline
+const size_t STREAM_THRESHOLD_ROWS = 1024;
+const size_t STREAM_CHUNK_ROWS = 256;
+
 BatchScheduler::BatchScheduler(size_t max_batch_size, size_t window_ms, bool dry_run, const std::string& conn_str)
-    : max_batch_size_(max_batch_size), window_ms_(window_ms), dry_run_mode_(dry_run), running_(true) {
+    : max_batch_size_(max_batch_size),
+      window_ms_(window_ms),
+      dry_run_mode_(dry_run),
+      use_worker_pool_(false),
+      use_window_dispatch_(false),
+      use_debug_reports_(false),
+      check_failures_(0),
+      running_(true) {
 
     try {
         db_conn_ = std::make_unique<PGConnection>(conn_str);
@@ -47,46 +60,312 @@ void BatchScheduler::Submit(int req_id, const std::string& sql) {
     }
 }
 
+int BatchScheduler::CheckFailures() const {
+    return check_failures_;
+}
+
+bool BatchScheduler::ExecuteNow(const QueryBatch& batch) {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    return FlushBatch(batch);
+}
+
 void BatchScheduler::RunLoop() {
     while (running_) {
         std::this_thread::sleep_for(std::chrono::milliseconds(window_ms_));
         std::lock_guard<std::mutex> lock(queue_mutex_);
-        for (auto it = pending_batches_.begin(); it != pending_batches_.end();) {
-            auto& batch = it->second;
-            if (!batch.queries.empty()) {
+        if (use_worker_pool_) {
+            FlushBatchesToPool();
+            continue;
+        }
+        if (use_window_dispatch_) {
+            FlushWindow();
+            continue;
+        }
+        // Aggregate-only templates on the same relation go out together and share one kernel scan
+        std::map<std::string, std::vector<const QueryBatch*>> agg_groups;
+        for (const auto& entry : pending_batches_) {
+            const QueryBatch& batch = entry.second;
+            if (batch.queries.empty()) continue;
+            std::string relation;
+            if (SQLParser::AggregateOnlyRelation(batch.queries[0].original_sql, relation)) {
+                agg_groups[relation].push_back(&batch);
+            } else {
                 FlushBatch(batch);
             }
-            it = pending_batches_.erase(it);
         }
+        for (const auto& group : agg_groups) {
+            if (group.second.size() > 1) {
+                FlushMultiBatch(group.first, group.second);
+            } else {
+                FlushBatch(*group.second[0]);
+            }
+        }
+        pending_batches_.clear();
     }
 }
 
-void BatchScheduler::FlushBatch(const QueryBatch& batch, bool use_debug_mode) {
-    if (batch.queries.empty()) return;
-
-    use_debug_mode = true;
-
-    std::string sql = GenerateKernelPayload(batch, use_debug_mode);
+bool BatchScheduler::FlushBatch(const QueryBatch& batch) {
+    if (batch.queries.empty()) return false;
+    bool use_debug_mode = use_debug_reports_;
 
-#if 1
-    std::cout << "[Proxy] Dispatching Batch (Hash=" << batch.fp_hash << ", Size=" << batch.queries.size() << ")..."
-              << std::endl;
-#endif
+    // Template Registration: send template_sql only until the backend has seen this id
+    uint64_t template_id = TemplateId(batch);
+    bool with_template = use_debug_mode || registered_templates_.count(template_id) == 0;
 
     try {
-        std::string result = db_conn_->ExecuteScalar(sql);
+        std::string result = SendBatch(batch, use_debug_mode, with_template);
+
+        if (!use_debug_mode) {
+            if (std::stoi(result) == KERNEL_STATUS_TEMPLATE_MISS) {
+                registered_templates_.erase(template_id);
+                result = SendBatch(batch, false, true);
+            }
+            if (std::stoi(result) != KERNEL_STATUS_TEMPLATE_MISS) {
+                registered_templates_.insert(template_id);
+            }
+        }
 
         if (use_debug_mode) {
+            bool mismatch = result.find("Check: MISMATCH") != std::string::npos;
+            if (mismatch) check_failures_++;
             std::cout << "\n========== [KERNEL DEBUG REPORT] ==========\n";
             std::cout << result << std::endl;
             std::cout << "===========================================\n" << std::endl;
-        } else {
-            std::cout << "[Proxy] Batch executed successfully." << std::endl;
+            return !mismatch;
         }
+        std::cout << "[Proxy] Batch executed successfully." << std::endl;
+        return std::stoi(result) >= KERNEL_STATUS_OK; // Streamed batches answer with their request count
 
     } catch (const std::exception& e) {
         std::cerr << "[Proxy] Batch Execution Failed: " << e.what() << std::endl;
     }
+    return false;
+}
+
+void BatchScheduler::FlushWindow() {
+    std::vector<const QueryBatch*> batches;
+    for (const auto& entry : pending_batches_) {
+        if (!entry.second.queries.empty()) batches.push_back(&entry.second);
+    }
+
+    if (!batches.empty()) {
+        std::cout << "[Proxy] Dispatching Window (Batches=" << batches.size() << ")..." << std::endl;
+        try {
+            // A miss means nothing ran, so the whole window is resent with the missing templates
+            mqo::MultiResult result;
+            SendWindow(batches, result);
+            bool missed = false;
+            for (size_t i = 0; i < batches.size(); ++i) {
+                if (result.status(i) == KERNEL_STATUS_TEMPLATE_MISS) {
+                    registered_templates_.erase(TemplateId(*batches[i]));
+                    missed = true;
+                }
+            }
+            if (missed) SendWindow(batches, result);
+
+            for (size_t i = 0; i < batches.size(); ++i) {
+                if (result.status(i) != KERNEL_STATUS_TEMPLATE_MISS) registered_templates_.insert(TemplateId(*batches[i]));
+            }
+            std::cout << "[Proxy] Window executed" << (result.rolled_back() ? " (rolled back)." : ".") << std::endl;
+        } catch (const std::exception& e) {
+            std::cerr << "[Proxy] Window Execution Failed: " << e.what() << std::endl;
+        }
+    }
+    pending_batches_.clear();
+}
+
+void BatchScheduler::FlushMultiBatch(const std::string& relation, const std::vector<const QueryBatch*>& batches) {
+    std::cout << "[Proxy] Dispatching Multi-Template Batch (Relation=" << relation << ", Templates=" << batches.size()
+              << ")..." << std::endl;
+
+    try {
+        mqo::MultiResult result;
+        SendMultiBatch(batches, false, result);
+
+        std::vector<const QueryBatch*> missed;
+        for (size_t i = 0; i < batches.size(); ++i) {
+            uint64_t template_id = TemplateId(*batches[i]);
+            if (result.status(i) == KERNEL_STATUS_TEMPLATE_MISS) {
+                registered_templates_.erase(template_id);
+                missed.push_back(batches[i]);
+            } else {
+                registered_templates_.insert(template_id);
+                std::cout << "[Proxy]   Template (Hash=" << batches[i]->fp_hash << "): "
+                          << result.results(i).results_size() << " results" << std::endl;
+            }
+        }
+
+        if (!missed.empty()) {
+            mqo::MultiResult retry;
+            SendMultiBatch(missed, true, retry);
+            for (size_t i = 0; i < missed.size(); ++i) {
+                if (retry.status(i) != KERNEL_STATUS_TEMPLATE_MISS) registered_templates_.insert(TemplateId(*missed[i]));
+                std::cout << "[Proxy]   Template (Hash=" << missed[i]->fp_hash << "): "
+                          << retry.results(i).results_size() << " results" << std::endl;
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "[Proxy] Multi-Template Batch Failed: " << e.what() << std::endl;
+    }
+}
+
+void BatchScheduler::SendMultiBatch(const std::vector<const QueryBatch*>& batches,
+                                    bool force_template,
+                                    mqo::MultiResult& result) {
+    mqo::MultiPayload multi;
+    for (const QueryBatch* batch : batches) {
+        bool with_template = force_template || registered_templates_.count(TemplateId(*batch)) == 0;
+        BuildPayload(*batch, with_template, *multi.add_batches());
+    }
+
+    std::string raw = FromHex(db_conn_->ExecuteScalar(KernelCall("mqo_dispatch_multi", multi)));
+    if (!result.ParseFromString(raw) || result.status_size() != multi.batches_size() ||
+        result.results_size() != multi.batches_size()) {
+        throw std::runtime_error("Malformed MultiResult from kernel");
+    }
+}
+
+void BatchScheduler::SendWindow(const std::vector<const QueryBatch*>& batches, mqo::MultiResult& result) {
+    mqo::WindowPayload window;
+    for (const QueryBatch* batch : batches) {
+        bool with_template = registered_templates_.count(TemplateId(*batch)) == 0;
+        BuildPayload(*batch, with_template, *window.add_batches());
+    }
+
+    std::string raw = FromHex(db_conn_->ExecuteScalar(KernelCall("mqo_dispatch_window", window)));
+    if (!result.ParseFromString(raw) || result.status_size() != window.batches_size() ||
+        result.results_size() != window.batches_size()) {
+        throw std::runtime_error("Malformed MultiResult from kernel");
+    }
+}
+
+void BatchScheduler::EnableShmTransport(const std::string& ring_name) {
+    try {
+        shm_ring_ = std::make_unique<ShmRingClient>(ring_name);
+        std::cout << "[Proxy] Shared-memory transport enabled (" << ring_name << ")." << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "[Proxy] Shared-memory transport unavailable, using libpq: " << e.what() << std::endl;
+    }
+}
+
+void BatchScheduler::EnableWorkerPool() {
+    use_worker_pool_ = true;
+}
+
+void BatchScheduler::EnableWindowDispatch() {
+    use_window_dispatch_ = true;
+}
+
+void BatchScheduler::EnableDebugReports() {
+    use_debug_reports_ = true;
+}
+
+void BatchScheduler::FlushBatchesToPool() {
+    // Submit everything first so the kernel workers run this window's batches concurrently.
+    // Workers keep their own template registries, so pooled payloads always carry the SQL text.
+    std::vector<std::pair<uint64_t, std::string>> tickets;
+    for (const auto& entry : pending_batches_) {
+        const QueryBatch& batch = entry.second;
+        if (batch.queries.empty()) continue;
+
+        mqo::BatchPayload proto_payload;
+        BuildPayload(batch, true, proto_payload);
+        try {
+            tickets.emplace_back(batch.fp_hash, db_conn_->ExecuteScalar(KernelCall("mqo_submit", proto_payload)));
+        } catch (const std::exception& e) {
+            std::cerr << "[Proxy] Batch Submit Failed: " << e.what() << std::endl;
+        }
+    }
+    pending_batches_.clear();
+
+    for (const auto& ticket : tickets) {
+        try {
+            std::string status = db_conn_->ExecuteScalar("SELECT mqo_wait(" + ticket.second + ");");
+            std::cout << "[Proxy] Pooled Batch (Hash=" << ticket.first << ") finished, status " << status << std::endl;
+        } catch (const std::exception& e) {
+            std::cerr << "[Proxy] Batch Execution Failed: " << e.what() << std::endl;
+        }
+    }
+}
+
+std::string BatchScheduler::SendBatch(const QueryBatch& batch, bool use_debug_func, bool with_template) {
+    if (!use_debug_func && batch.queries.size() > STREAM_THRESHOLD_ROWS) {
+        return SendBatchStreaming(batch, with_template);
+    }
+
+    mqo::BatchPayload proto_payload;
+    BuildPayload(batch, with_template, proto_payload);
+
+    // Shared-memory path: serialize into a ring slot, only the slot id crosses the socket
+    if (shm_ring_) {
+        int slot = shm_ring_->AcquireSlot();
+        if (slot >= 0) {
+            size_t payload_len = proto_payload.ByteSizeLong();
+            if (payload_len <= shm_ring_->SlotCapacity() &&
+                proto_payload.SerializeToArray(shm_ring_->SlotData(slot), payload_len)) {
+                shm_ring_->Publish(slot, payload_len, use_debug_func);
+                std::string result;
+                try {
+                    result = db_conn_->ExecuteScalar("SELECT mqo_dispatch_slot(" + std::to_string(slot) + ", " +
+                                                     std::to_string(shm_ring_->SlotToken(slot)) + ");");
+                    if (use_debug_func) result = shm_ring_->ReadResult(slot);
+                } catch (...) {
+                    shm_ring_->Release(slot);
+                    throw;
+                }
+                shm_ring_->Release(slot);
+                return result;
+            }
+            shm_ring_->Release(slot);
+        }
+    }
+
+    return db_conn_->ExecuteScalar(GenerateKernelPayload(proto_payload, use_debug_func));
+}
+
+std::string BatchScheduler::SendBatchStreaming(const QueryBatch& batch, bool with_template) {
+    mqo::BatchPayload header;
+    BuildHeader(batch, with_template, header);
+
+    // Each chunk is encoded while the kernel executes the previous one. The stream runs in its own
+    // transaction block: a failed request aborts it and the ROLLBACK below clears the session.
+    db_conn_->PipelineBegin();
+    try {
+        db_conn_->PipelineSend("BEGIN;");
+        db_conn_->PipelineSend(KernelCall("mqo_batch_begin", header));
+        for (size_t start = 0; start < batch.queries.size(); start += STREAM_CHUNK_ROWS) {
+            size_t end = std::min(start + STREAM_CHUNK_ROWS, batch.queries.size());
+            mqo::BatchChunk chunk;
+            for (size_t i = start; i < end; ++i) {
+                FillParamRow(batch.queries[i], chunk.add_rows());
+            }
+            db_conn_->PipelineSend(KernelCall("mqo_batch_append", chunk));
+        }
+        db_conn_->PipelineSend("SELECT mqo_batch_execute();");
+        db_conn_->PipelineSend("COMMIT;");
+    } catch (...) {
+        try {
+            db_conn_->PipelineSync();
+        } catch (...) {
+        }
+        db_conn_->ExecuteCommand("ROLLBACK;");
+        throw;
+    }
+
+    std::vector<std::string> results;
+    try {
+        results = db_conn_->PipelineSync();
+    } catch (...) {
+        db_conn_->ExecuteCommand("ROLLBACK;");
+        throw;
+    }
+    return results.empty() ? "" : results.back();
+}
+
+std::string BatchScheduler::KernelCall(const std::string& func, const google::protobuf::MessageLite& message) {
+    std::string binary_data;
+    if (!message.SerializeToString(&binary_data)) return "";
+    return "SELECT " + func + "(decode('" + ToHex(binary_data) + "', 'hex'));";
 }
 
 std::string BatchScheduler::GetPGTypeName(ParamType type) {
@@ -112,21 +391,37 @@ void BatchScheduler::TryExtractScanHint(const std::string& sql, std::string& out
     }
 }
 
-std::string BatchScheduler::GenerateKernelPayload(const QueryBatch& batch, bool use_debug_func) {
-    mqo::BatchPayload proto_payload;
+uint64_t BatchScheduler::TemplateId(const QueryBatch& batch) {
+    // IN-lists of different length share a fingerprint, so the param count is folded into the id
+    uint64_t param_count = batch.queries.empty() ? 0 : batch.queries[0].params.size();
+    uint64_t id = batch.fp_hash ^ (param_count * 0x9e3779b97f4a7c15ULL);
+    return id != 0 ? id : 1;
+}
+
+void BatchScheduler::BuildPayload(const QueryBatch& batch, bool with_template, mqo::BatchPayload& proto_payload) {
+    BuildHeader(batch, with_template, proto_payload);
+    for (const auto& query : batch.queries) {
+        FillParamRow(query, proto_payload.add_rows());
+    }
+}
 
+void BatchScheduler::BuildHeader(const QueryBatch& batch, bool with_template, mqo::BatchPayload& proto_payload) {
     std::string base_sql = batch.queries[0].original_sql;
-    PgQueryNormalizeResult norm_result = pg_query_normalize(base_sql.c_str());
+    proto_payload.set_template_id(TemplateId(batch));
 
-    std::string final_template;
-    if (norm_result.error) {
-        final_template = base_sql;
-        pg_query_free_normalize_result(norm_result);
-    } else {
-        final_template = norm_result.normalized_query;
-        pg_query_free_normalize_result(norm_result);
+    if (with_template) {
+        PgQueryNormalizeResult norm_result = pg_query_normalize(base_sql.c_str());
+
+        std::string final_template;
+        if (norm_result.error) {
+            final_template = base_sql;
+            pg_query_free_normalize_result(norm_result);
+        } else {
+            final_template = norm_result.normalized_query;
+            pg_query_free_normalize_result(norm_result);
+        }
+        proto_payload.set_template_sql(final_template);
     }
-    proto_payload.set_template_sql(final_template);
 
     proto_payload.set_use_mqo(true);
     proto_payload.set_dry_run(dry_run_mode_);
@@ -144,30 +439,31 @@ std::string BatchScheduler::GenerateKernelPayload(const QueryBatch& batch, bool
             proto_payload.add_param_types(GetPGTypeName(p.type));
         }
     }
+}
 
-    for (const auto& query : batch.queries) {
-        mqo::ParamRow* row = proto_payload.add_rows();
-        for (const auto& p : query.params) {
-            mqo::Value* val = row->add_values();
-            val->set_is_null(false); 
-            switch (p.type) {
-                case ParamType::INTEGER: try { val->set_int_val(std::stoll(p.value));
-                    } catch (...) {
-                        val->set_int_val(0);
-                    }
-                    break;
-                case ParamType::FLOAT: try { val->set_float_val(std::stod(p.value));
-                    } catch (...) {
-                        val->set_float_val(0.0);
-                    }
-                    break;
-                case ParamType::BOOL: val->set_bool_val((p.value == "true" || p.value == "t")); break;
-                case ParamType::NULL_VAL: val->set_is_null(true); break;
-                default: val->set_string_val(p.value); break;
-            }
+void BatchScheduler::FillParamRow(const ParsedQuery& query, mqo::ParamRow* row) {
+    for (const auto& p : query.params) {
+        mqo::Value* val = row->add_values();
+        val->set_is_null(false); 
+        switch (p.type) {
+            case ParamType::INTEGER: try { val->set_int_val(std::stoll(p.value));
+                } catch (...) {
+                    val->set_int_val(0);
+                }
+                break;
+            case ParamType::FLOAT: try { val->set_float_val(std::stod(p.value));
+                } catch (...) {
+                    val->set_float_val(0.0);
+                }
+                break;
+            case ParamType::BOOL: val->set_bool_val((p.value == "true" || p.value == "t")); break;
+            case ParamType::NULL_VAL: val->set_is_null(true); break;
+            default: val->set_string_val(p.value); break;
         }
     }
+}
 
+std::string BatchScheduler::GenerateKernelPayload(const mqo::BatchPayload& proto_payload, bool use_debug_func) {
     std::string binary_data;
     if (!proto_payload.SerializeToString(&binary_data)) return "";
 
@@ -182,6 +478,22 @@ std::string BatchScheduler::GenerateKernelPayload(const QueryBatch& batch, bool
     return ss.str();
 }
 
+std::string BatchScheduler::FromHex(const std::string& input) {
+    auto nibble = [](char c) -> int {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return 0;
+    };
+    size_t start = (input.size() >= 2 && input[0] == '\\' && input[1] == 'x') ? 2 : 0;
+    std::string output;
+    output.reserve((input.size() - start) / 2);
+    for (size_t i = start; i + 1 < input.size(); i += 2) {
+        output.push_back(static_cast<char>((nibble(input[i]) << 4) | nibble(input[i + 1])));
+    }
+    return output;
+}
+
 std::string BatchScheduler::ToHex(const std::string& input) {
     static const char hex_digits[] = "0123456789ABCDEF";
     std::string output;
@@ -0,0 +1,132 @@
+#include "shm_transport.hpp"
+
+#include <cerrno>
+#include <ctime>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+ShmRingClient::ShmRingClient(const std::string& ring_name) : ring_(nullptr), map_size_(0), next_slot_(0) {
+    int fd = shm_open(ring_name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        throw std::runtime_error("Shared-memory ring " + ring_name + " not found");
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(MqoRingHeader)) {
+        close(fd);
+        throw std::runtime_error("Shared-memory ring " + ring_name + " has invalid size");
+    }
+    map_size_ = st.st_size;
+
+    void* addr = mmap(nullptr, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        throw std::runtime_error("Shared-memory ring " + ring_name + " mmap failed");
+    }
+
+    ring_ = static_cast<MqoRingHeader*>(addr);
+    if (ring_->magic != MQO_RING_MAGIC || MqoRingSize(ring_->num_slots, ring_->slot_size) > map_size_) {
+        munmap(addr, map_size_);
+        throw std::runtime_error("Shared-memory ring " + ring_name + " is not initialized");
+    }
+    tokens_.assign(ring_->num_slots, 0);
+}
+
+ShmRingClient::~ShmRingClient() {
+    if (ring_) munmap(ring_, map_size_);
+}
+
+static uint64_t NewToken() {
+    thread_local std::mt19937_64 rng(std::random_device{}());
+    uint64_t token;
+    do {
+        token = rng();
+    } while (token == 0); // 0 is the token of a never-acquired slot
+    return token;
+}
+
+// Only ESRCH proves the owner gone: EPERM is a live process of another user (a backend).
+static bool ProcessGone(int32_t pid) {
+    return pid > 0 && kill(pid, 0) != 0 && errno == ESRCH;
+}
+
+int ShmRingClient::AcquireSlot() {
+    int slot_id = TryAcquire();
+    if (slot_id >= 0) return slot_id;
+    ReclaimStale();
+    return TryAcquire();
+}
+
+int ShmRingClient::TryAcquire() {
+    uint32_t n = ring_->num_slots;
+    uint32_t start = next_slot_.fetch_add(1);
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t slot_id = (start + i) % n;
+        MqoSlotHeader* slot = MqoRingSlot(ring_, slot_id);
+        uint32_t expected = MQO_SLOT_FREE;
+        if (slot->state.compare_exchange_strong(expected, MQO_SLOT_WRITING)) {
+            tokens_[slot_id] = NewToken();
+            slot->token = tokens_[slot_id];
+            slot->client_pid = getpid();
+            slot->backend_pid = 0;
+            slot->stamp = time(nullptr);
+            return static_cast<int>(slot_id);
+        }
+    }
+    return -1;
+}
+
+// Slots left behind by a crashed proxy (WRITING/READY/DONE) or backend (BUSY) go back to the ring.
+void ShmRingClient::ReclaimStale() {
+    int64_t now = time(nullptr);
+    for (uint32_t slot_id = 0; slot_id < ring_->num_slots; ++slot_id) {
+        MqoSlotHeader* slot = MqoRingSlot(ring_, slot_id);
+        uint32_t state = slot->state.load(std::memory_order_acquire);
+        if (state == MQO_SLOT_FREE || now - slot->stamp < MQO_SLOT_STALE_SECONDS) continue;
+        if (!ProcessGone(state == MQO_SLOT_BUSY ? slot->backend_pid : slot->client_pid)) continue;
+        if (slot->state.compare_exchange_strong(state, MQO_SLOT_FREE)) {
+            std::cerr << "[Proxy] Reclaimed shared-memory slot " << slot_id << " of a dead owner (state " << state
+                      << ")" << std::endl;
+        }
+    }
+}
+
+int64_t ShmRingClient::SlotToken(int slot_id) const {
+    return static_cast<int64_t>(tokens_[slot_id]);
+}
+
+char* ShmRingClient::SlotData(int slot_id) {
+    return MqoSlotData(MqoRingSlot(ring_, slot_id));
+}
+
+size_t ShmRingClient::SlotCapacity() const {
+    return MqoSlotCapacity(ring_);
+}
+
+void ShmRingClient::Publish(int slot_id, size_t payload_len, bool debug) {
+    MqoSlotHeader* slot = MqoRingSlot(ring_, slot_id);
+    slot->kind = debug ? MQO_SLOT_DEBUG : MQO_SLOT_DISPATCH;
+    slot->payload_len = static_cast<uint32_t>(payload_len);
+    slot->result_len = 0;
+    slot->stamp = time(nullptr);
+    slot->state.store(MQO_SLOT_READY, std::memory_order_release);
+}
+
+std::string ShmRingClient::ReadResult(int slot_id) {
+    MqoSlotHeader* slot = MqoRingSlot(ring_, slot_id);
+    if (slot->state.load(std::memory_order_acquire) != MQO_SLOT_DONE) return "";
+    return std::string(MqoSlotData(slot), slot->result_len);
+}
+
+void ShmRingClient::Release(int slot_id) {
+    MqoSlotHeader* slot = MqoRingSlot(ring_, slot_id);
+    uint32_t state = slot->state.load(std::memory_order_acquire);
+    if (state == MQO_SLOT_FREE || state == MQO_SLOT_BUSY || slot->token != tokens_[slot_id]) return;
+    slot->state.compare_exchange_strong(state, MQO_SLOT_FREE);
+}